@@ -30,6 +30,7 @@
 #include "tokpar.h"
 #include "prelude.h"
 #include "compression.h"
+#include "mem.h"
 
 int main(int argc, char **argv) {
 
@@ -142,7 +143,7 @@ int main(int argc, char **argv) {
     printf("\n\nDECOMPRESS TEST: %s\n\n", decompress_code);
     
     t = tokpar_parse_compressed(compressed_code);
-    free(compressed_code);
+    mem_free(compressed_code);
   } else { 
     t = tokpar_parse(code_buffer);
   } 
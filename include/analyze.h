@@ -0,0 +1,67 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ANALYZE_H_
+#define ANALYZE_H_
+
+#include <stdbool.h>
+
+#include "typedefs.h"
+
+/*
+   A lambda or a let is analyzed once, when it is first evaluated,
+   into nodes that the evaluator runs without looking at the special
+   form symbols or the shape of the form again. A node is a list of
+   cells headed by a node symbol (symrepr.h):
+
+   (node_quote . datum)
+   (node_define key . exp)
+   (node_progn exp1 ... expn)               n > 1
+   (node_lambda params . body)
+   (node_if cond then . else)
+   (node_let (key1 ... keyn) (exp1 ... expn) . body)
+   (node_app fun arg1 ... argn)
+   (node_local . k)
+   (node_global . sym)
+
+   where exp, body, cond and so on are analyzed too. (progn exp) and
+   (let () exp) are replaced by exp.
+
+   A variable bound by a lambda or a let is found, in the frames of
+   the local environment (env.h), at the cell k cdrs from the start.
+   k is worked out from the frames the analyzed code makes and the
+   environment env it is analyzed for, and holds wherever the node
+   runs. Any other variable is global (or a fundamental).
+
+   Missing parts of a form are nil and extra parts are ignored, as
+   before, also in a let binding. Constants are left as they are, and
+   so is a form of the wrong shape, a let binding whose key is not a
+   symbol or an improper list for example, or one nested deeper than
+   ANALYZE_MAX_DEPTH. The evaluator runs such a form as before,
+   looking variables up by name.
+*/
+
+#define ANALYZE_MAX_DEPTH 64
+
+// Cells analyze needs for exp.
+extern unsigned int analyze_cells(VALUE exp, VALUE env);
+// Analyze exp, to run in the local environment env, into *res. False
+// if a cell could not be allocated, heap_reserve(analyze_cells(exp,
+// env)) before makes sure that it can.
+extern bool analyze(VALUE exp, VALUE env, VALUE *res);
+
+#endif
@@ -35,7 +35,7 @@ extern void compression_init_state(decomp_state *s, char *src);
    the input string and cannot be called on constant string literal pointers 
    for example.
  
-   Compress returns an array that caller must free 
+   Compress returns an array that caller must free with mem_free
 */ 
 extern char *compression_compress(char *string, uint32_t *res_size);
 extern int  compression_decompress_incremental(decomp_state *s, char *dest_buff, uint32_t dest_n);
@@ -20,12 +20,22 @@
 
 #include "typedefs.h"
 
-extern VALUE env_copy_shallow(VALUE env);
+/*
+   The global environment is a list of (key . value) bindings.
+
+   A local environment is a chain of frames, one per closure
+   application or let, each made of n + 1 cells:
+
+   (names v1 ... vn . parent)
+
+   where names is the list of the n names bound, the parameters of
+   the closure for example. Analyzed code (analyze.h) finds a value by
+   its position in the chain, without looking at the names.
+*/
+
 extern VALUE env_lookup(VALUE sym, VALUE env);
 extern VALUE env_set(VALUE env, VALUE key, VALUE val);
-extern VALUE env_modify_binding(VALUE env, VALUE key, VALUE val);
-extern VALUE env_build_params_args(VALUE params,
-	     			   VALUE args,
-				   VALUE env0);
+extern VALUE env_frame_lookup(VALUE sym, VALUE env);
+extern VALUE env_build_frame(VALUE names, VALUE *values, unsigned int n, VALUE env);
 
 #endif
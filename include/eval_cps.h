@@ -24,14 +24,19 @@ typedef struct eval_context_s{
   VALUE curr_exp;
   VALUE curr_env;
   stack K;
+  bool scope;
   struct eval_context_s *next;
 } eval_context_t;
 
 eval_context_t *eval_cps_get_current_context(void);
 extern eval_context_t *eval_cps_new_context_inherit_env(VALUE program, VALUE curr_exp);
-extern void eval_cps_drop_top_context(void);
+extern VALUE eval_cps_drop_top_context(VALUE res);
+extern VALUE run_eval(eval_context_t *ctx);
 
 extern VALUE eval_cps_get_env(void);
+extern void eval_cps_set_env(VALUE env);
+extern int eval_cps_freeze(void);
+extern int eval_cps_gc(void);
 extern int eval_cps_init(unsigned int initial_stack_size,
 			 bool grow_continuation_stack);
 extern void eval_cps_del(void);
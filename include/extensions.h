@@ -20,6 +20,13 @@
 
 #include "typedefs.h"
 
+/*
+   An extension that allocates keeps the values it builds alive with
+   heap_push_root and heap_pop_roots. When an allocation fails it can
+   call eval_cps_gc and try again. If it returns the MERROR symbol
+   instead, the evaluator collects garbage and calls it again from
+   the start.
+*/
 typedef VALUE (*extension_fptr)(VALUE*,int);
 
 extern extension_fptr extensions_lookup(UINT sym);
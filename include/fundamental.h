@@ -19,6 +19,7 @@
 #define _FUNDAMENTAL_H_
 
 extern VALUE fundamental_exec(VALUE* args, UINT nargs, VALUE op);
+extern unsigned int fundamental_cells(VALUE* args, UINT nargs, VALUE op);
 #endif
 
 
@@ -83,11 +83,27 @@ If four types is all that should be possible (unboxed). then 2 bits are needed t
 2 + 1 + 1 = 4 => 28bits for data.
 
 bit 0: ptr/!ptr
-bit 1: gc
-bit 2-3: type (if not ptr)
+bit 1: immediate float (if not ptr, bits 2-3 are then zero)
+bit 2-3: type (if not ptr and not float)
 bit 3 - 24 ptr (if ptr)
 bit 4 - 31 value (if value)
 
+Floats are 32 bit IEEE floats on all platforms. On 64 bit a float is
+always immediate, its IEEE bits are kept in the upper 32 bits of the
+value. On 32 bit a float whose lowest four IEEE bits are zero, 1.5 or
+500.0 for example, is stored immediately with the tag 0x2 in place of
+those bits. Any other float is boxed, so no precision is lost, but
+most results of arithmetic on 32 bit need a cell. Build with
+-DBOXED_FLOATS to box all floats.
+
+CDR-coding (see heap_set_cdr_coding): in a cdr-coded cell both the
+car and the cdr hold list elements and the cdr of the second element
+is the next cell. Cdr-coded cells are kept in a bitmap on the side. A
+pointer to the second element has bit 1 (PTR_CDR_WORD) set. set_cdr
+on an element of a cdr-coded cell moves the element to a new cell and
+leaves an invisible pointer (PTR_TYPE_INVISIBLE) to it in its place,
+invisible pointers are only ever seen by the heap.
+
 An unboxed value can occupy a car or cdr field in a cons cell.
 
 types (boxed) extra information in pointer to cell can contain information
@@ -149,40 +165,98 @@ Aux bits could be used for storing vector size. Up to 30bits should be available
 
 0000 00XX XXXX XXXX XXXX XXXX XXXX X000   : 0x03FF FFF8
 1111 AA00 0000 0000 0000 0000 0000 0000   : 0xFC00 0000 (AA bits left unused for now, future heap growth?)
+
+64 bit platforms use the same layout in a 64 bit word. The pointer
+type is in the top 6 bits and the cell index in bits 3 - 57, the size
+of a heap is limited by the cell counts (unsigned int) only.
+Unboxed integers have 60 bits.
+
+0000 00XX ... XXXX X000   : 0x03FF FFFF FFFF FFF8
+1111 AA00 ... 0000 0000   : 0xFC00 0000 0000 0000
  */
 
 #define CONS_CELL_SIZE       8
 #define ADDRESS_SHIFT        3
 #define VAL_SHIFT            4
 
+#if defined(_32_BIT_)
 #define PTR_MASK             0x00000001u
 #define PTR                  0x00000001u
+#define PTR_CDR_WORD         0x00000002u
 #define PTR_VAL_MASK         0x03FFFFF8u
+#define HEAP_MAX_CELLS       ((PTR_VAL_MASK >> ADDRESS_SHIFT) + 1)
 #define PTR_TYPE_MASK        0xFC000000u
 
 #define PTR_TYPE_CONS        0x10000000u
 #define PTR_TYPE_BOXED_I     0x20000000u
 #define PTR_TYPE_BOXED_U     0x30000000u
 #define PTR_TYPE_BOXED_F     0x40000000u
+#define PTR_TYPE_INVISIBLE   0x50000000u
 
 #define PTR_TYPE_BYTECODE    0xC0000000u 
 #define PTR_TYPE_ARRAY       0xD0000000u
 #define PTR_TYPE_REF         0xE0000000u //untyped reference to memory location
 #define PTR_TYPE_STREAM      0xF0000000u
 
-#define GC_MASK              0x00000002u
-#define GC_MARKED            0x00000002u
-
 #define VAL_MASK             0xFFFFFFF0u
-#define VAL_TYPE_MASK        0x0000000Cu
+#define VAL_TYPE_MASK        0x0000000Eu
 
 #define VAL_TYPE_SYMBOL      0x00000000u
+#define VAL_TYPE_FLOAT       0x00000002u
 #define VAL_TYPE_CHAR        0x00000004u
 #define VAL_TYPE_I           0x00000008u
 #define VAL_TYPE_U           0x0000000Cu
+#endif
+
+#if defined(_64_BIT_)
+#define PTR_MASK             0x0000000000000001u
+#define PTR                  0x0000000000000001u
+#define PTR_CDR_WORD         0x0000000000000002u
+#define PTR_VAL_MASK         0x03FFFFFFFFFFFFF8u
+#define HEAP_MAX_CELLS       0xFFFFFFFFu
+#define PTR_TYPE_MASK        0xFC00000000000000u
+
+#define PTR_TYPE_CONS        0x1000000000000000u
+#define PTR_TYPE_BOXED_I     0x2000000000000000u
+#define PTR_TYPE_BOXED_U     0x3000000000000000u
+#define PTR_TYPE_BOXED_F     0x4000000000000000u
+#define PTR_TYPE_INVISIBLE   0x5000000000000000u
+
+#define PTR_TYPE_BYTECODE    0xC000000000000000u
+#define PTR_TYPE_ARRAY       0xD000000000000000u
+#define PTR_TYPE_REF         0xE000000000000000u //untyped reference to memory location
+#define PTR_TYPE_STREAM      0xF000000000000000u
+
+#define VAL_MASK             0xFFFFFFFFFFFFFFF0u
+#define VAL_TYPE_MASK        0x000000000000000Eu
+
+#define VAL_TYPE_SYMBOL      0x0000000000000000u
+#define VAL_TYPE_FLOAT       0x0000000000000002u
+#define VAL_TYPE_CHAR        0x0000000000000004u
+#define VAL_TYPE_I           0x0000000000000008u
+#define VAL_TYPE_U           0x000000000000000Cu
+#endif
 
 #define MAX_CONSTANTS        256
 
+#define GC_INC_IDLE          0
+#define GC_INC_MARK          1
+#define GC_INC_SWEEP         2
+
+#define GC_INC_STACK_SIZE    1024
+#define GC_MARK_STACK_SIZE   1024
+#define GC_MAX_THREADS       64
+#define HEAP_ROOT_STACK_SIZE 64
+
+#define HEAP_ROOTS_EVAL       0    // Expressions and environments of the evaluator.
+#define HEAP_ROOTS_STACK      1    // Continuation stack.
+#define HEAP_ROOTS_EXTERN     2    // Roots registered by C code.
+#define HEAP_ROOTS_FROZEN     3    // Written cards of the frozen segment.
+#define HEAP_ROOTS_REMEMBERED 4    // Remembered set of a minor collection.
+#define HEAP_NUM_ROOT_SETS    5
+
+#define HEAP_PAUSE_BUCKETS    24
+
 typedef struct {
   VALUE car;
   VALUE cdr;
@@ -192,9 +266,14 @@ typedef struct {
   cons_t  *heap;            
   bool  malloced;           // allocated by heap_init
   VALUE freelist;           // list of free cons cells.
+  unsigned int freelist_length;    // Number of cells on the free list.
 
   unsigned int heap_size;          // In number of cells.
-  unsigned int heap_bytes;         // In bytes.
+  size_t heap_bytes;               // In bytes.
+
+  UINT *gc_bits;                   // Mark bitmap, one bit per cell.
+  unsigned int gc_bits_size;       // Size of the mark bitmap in words.
+  bool gc_bits_malloced;           // The mark bitmap was allocated by the heap.
 
   unsigned int num_alloc;          // Number of cells allocated.
   unsigned int num_alloc_arrays;   // Number of arrays allocated.
@@ -203,13 +282,123 @@ typedef struct {
   unsigned int gc_marked;          // Number of cells marked by mark phase.
   unsigned int gc_recovered;       // Number of cells recovered by sweep phase.
   unsigned int gc_recovered_arrays;// Number of arrays recovered by sweep.
+
+  // Generational collection (disabled when nursery_size is 0)
+  unsigned int nursery_size;       // Max number of young cells between minor GCs.
+  UINT *young;                     // Indices of cells allocated since last GC.
+  unsigned int num_young;          // Number of young cells in the young list.
+  unsigned int young_overflow;     // Young cells that did not fit in young list.
+  UINT *remembered;                // Old cells that may point to young cells.
+  unsigned int remembered_size;    // Capacity of the remembered set.
+  unsigned int num_remembered;     // Number of entries in the remembered set.
+  bool remembered_overflow;        // Remembered set overflowed, minor GC unsafe.
+  unsigned int gc_num_minor;       // Number of minor (nursery only) collections.
+
+  // Incremental collection (disabled when gc_budget is 0)
+  unsigned int gc_budget;          // Max number of cells marked or swept per step.
+  unsigned int gc_inc_start;       // Number of allocated cells that starts a cycle.
+  int gc_inc_phase;                // GC_INC_IDLE, GC_INC_MARK or GC_INC_SWEEP.
+  VALUE gc_inc_freelist;           // Part of the free list not yet marked.
+  VALUE *gc_inc_stack;             // Grey cells.
+  unsigned int gc_inc_sp;          // Number of grey cells on the stack.
+  bool gc_inc_overflow;            // Grey stack overflowed, heap must be rescanned.
+  unsigned int gc_inc_rescan;      // Rescan position.
+  unsigned int gc_inc_sweep;       // Sweep position.
+  unsigned int gc_inc_max_work;    // Most work done by any single step.
+
+  // Lazy sweeping
+  bool lazy_sweep;                 // Sweep on allocation instead of after marking.
+  unsigned int gc_lazy_sweep;      // Next word of the mark bitmap to sweep.
+  bool bg_sweep;                   // Sweep in a background thread after marking.
+
+  // Compacting collection
+  bool compacting;                 // Slide live cells to the bottom of the heap.
+  unsigned int bump;               // Cells from here to heap_size are free.
+  UINT *gc_fwd;                    // Live cells below each word of the mark bitmap.
+
+  // Array arena
+  unsigned char *arena;            // Array headers and data, NULL if arrays are malloced.
+  unsigned int arena_size;         // Size of the arena in bytes.
+  unsigned int arena_top;          // Bytes in use, including freed arrays.
+  unsigned int arena_free;         // Bytes of freed arrays below arena_top.
+  bool arena_malloced;             // The arena was allocated by the heap.
+
+  // Growth policy
+  unsigned int region_size;        // Cells per added region, 0 for a fixed size heap.
+  unsigned int min_size;           // Size of the first region, never released.
+  unsigned int max_size;           // Largest size the heap may grow to.
+  unsigned int num_regions;        // Regions in the heap, including the first.
+  unsigned int grow_threshold;     // Grow when more than this percentage survives a collection.
+  bool release_regions;            // Release regions that are empty after a collection.
+
+  // Parallel marking
+  unsigned int gc_threads;         // Threads marking a full collection, 0 or 1 for one.
+
+  // Collection at a watermark (disabled when gc_watermark is 0)
+  unsigned int gc_watermark;       // Collect at a safe point when fewer cells are free.
+  unsigned int gc_watermark_skip;  // Collection after which the watermark is ignored.
+
+  // CDR-coding
+  bool cdr_coding;                 // Lists are built with cdr-coded cells.
+  UINT *cdr_bits;                  // Cdr-coded cells, one bit per cell, NULL if there are none.
+
+  // Scoped allocation (disabled when scope_size is 0)
+  unsigned int scope_size;         // Capacity of the scope log.
+  UINT *scope_log;                 // Cells allocated since the scope was opened.
+  unsigned int scope_num;          // Number of cells in the scope log.
+  UINT *scope_bits;                // Cells of the open scope, one bit per cell.
+  bool scope_open;                 // Allocation is logged.
+  bool scope_keep;                 // The cells of the scope must be left to the collector.
+  unsigned int scope_gc;           // Collections performed when the scope was opened.
+  unsigned int scope_young;        // Young cells when the scope was opened.
+
+  // Frozen segment
+  unsigned int frozen;             // Cells below this index are frozen, never marked or swept.
+  UINT *frozen_cards;              // One bit per mark bitmap word of frozen cells written since the freeze.
 } heap_state_t;
 
+// Telemetry, all of it kept up to date as the heap is used so that
+// reading it is cheap. Pause times are in microseconds and need a
+// timer, see heap_set_timer, otherwise all pauses take 0 us.
+typedef struct {
+  unsigned int num_free;           // Free cells, swept or not.
+  unsigned int freelist_length;    // Free cells on the free list.
+  unsigned int num_frozen;         // Cells in the frozen segment.
+  unsigned int num_gc;             // Collections, major and minor.
+  unsigned int num_minor;          // Minor collections, also counted in num_gc.
+
+  unsigned int num_pauses;         // Collections and incremental steps.
+  unsigned int pause_hist[HEAP_PAUSE_BUCKETS]; // Bucket i counts pauses of [2^(i-1), 2^i) us, the last one longer pauses too.
+  uint32_t pause_max;              // Longest pause.
+  uint64_t pause_total;            // Sum of all pauses.
+
+  unsigned int marked[HEAP_NUM_ROOT_SETS]; // Cells first reached from each set of roots by the last collection.
+
+  uint64_t alloc_total;            // Cells allocated since the heap was initialized.
+  unsigned int alloc_rate;         // Cells allocated per second between the last two pauses.
+
+  // Outside the frozen segment, after the last major collection.
+  unsigned int live_cons;          // Live cells that are not boxed values or arrays.
+  unsigned int live_boxed;         // Live boxed values.
+  unsigned int live_arrays;        // Live arrays.
+  unsigned int live_array_bytes;   // Bytes used by the live arrays, headers included.
+
+  unsigned int scope_freed;        // Cells given back by closed scopes.
+  unsigned int scope_kept;         // Cells of closed scopes left to the collector.
+} heap_stats_t;
+
+// A list under construction, see heap_list_append.
+typedef struct {
+  VALUE head;
+  VALUE last;               // Last cell of the list.
+  bool pending;             // The cdr of last holds an element with no cdr yet.
+} heap_list_t;
+
 typedef struct {
   TYPE elt_type;            // Type of elements: VAL_TYPE_FLOAT, U, I or CHAR
   unsigned int size;        // Number of elements
   union {
-    float    *f;
+    FLOAT    *f;
     UINT     *u; 
     INT      *i;
     char     *c;
@@ -223,33 +412,75 @@ typedef struct {
   VALUE   constants[MAX_CONSTANTS];
 } bytecode_t;
 
+// heap_init_addr uses num_cells cells at addr, the mark bitmap
+// (GC_BITS_WORDS(num_cells) words) is allocated with mem_malloc.
 extern int heap_init_addr(cons_t *addr, unsigned int num_cells);
 extern int heap_init(unsigned int num_cells);
+extern int heap_init_image(cons_t *addr, unsigned int num_cells, UINT *gc_bits, VALUE freelist, unsigned int num_alloc, unsigned int bump, unsigned int frozen, UINT *frozen_cards, UINT *cdr_bits);
 extern void heap_del(void);
 extern unsigned int heap_num_free(void);
 extern unsigned int heap_num_allocated(void);
 extern unsigned int heap_size(void);
 extern VALUE heap_allocate_cell(TYPE type);
-extern unsigned int heap_size_bytes(void);
+extern VALUE heap_allocate_cells(unsigned int num_cells);
+extern VALUE heap_allocate_list(unsigned int num_elts);
+extern void heap_list_init(heap_list_t *l);
+extern bool heap_list_append(heap_list_t *l, VALUE v);
+extern VALUE heap_list_finish(heap_list_t *l, VALUE tail);
+extern size_t heap_size_bytes(void);
+extern int heap_set_nursery_size(unsigned int num_cells);
+extern bool heap_nursery_full(void);
+extern int heap_set_gc_budget(unsigned int num_cells);
+extern bool heap_gc_incremental(void);
+extern int heap_set_lazy_sweep(bool on);
+extern int heap_set_background_sweep(bool on);
+extern int heap_set_compacting(bool on);
+extern bool heap_compacting(void);
+extern int heap_set_gc_threads(unsigned int num_threads);
+extern int heap_set_array_arena(unsigned int num_bytes);
+extern int heap_set_array_arena_addr(unsigned char *addr, unsigned int num_bytes);
+extern int heap_set_cdr_coding(bool on);
+extern int heap_set_scope_size(unsigned int num_cells);
+extern bool heap_scope_open(void);
+extern int heap_scope_close(VALUE *roots, unsigned int num_roots);
+extern int heap_set_growth(unsigned int region_size, unsigned int max_size, unsigned int grow_threshold, bool release_regions);
+extern int heap_grow(void);
+extern int heap_finish_gc(void);
 
 extern VALUE cons(VALUE car, VALUE cdr);
 extern VALUE car(VALUE cons);
 extern VALUE cdr(VALUE cons);
 extern void set_car(VALUE c, VALUE v);
-extern void set_cdr(VALUE c, VALUE v);
+extern bool set_cdr(VALUE c, VALUE v);
 extern unsigned int length(VALUE c);
 extern VALUE reverse(VALUE list);
 extern VALUE copy(VALUE list);
 
 // State and statistics
 extern void heap_get_state(heap_state_t *);
+extern void heap_get_stats(heap_stats_t *);
+extern void heap_set_timer(uint32_t (*usec)(void));
 
 // Garbage collection
 extern int heap_perform_gc(VALUE env);
 extern int heap_perform_gc_aux(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size);
+extern int heap_perform_gc_compact(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size);
+extern int heap_freeze(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size);
+extern unsigned int heap_num_frozen(void);
+extern bool heap_reserve(unsigned int num_cells);
+extern int heap_set_gc_watermark(unsigned int num_cells);
+extern bool heap_gc_due(void);
+extern void heap_gc_watermark_done(void);
+extern bool heap_push_root(VALUE *root);
+extern void heap_pop_roots(unsigned int n);
+extern void heap_set_aux_scanner(unsigned int (*scan)(UINT *aux_data, unsigned int aux_size,
+						      void (*slot)(VALUE *v, void *arg), void *arg));
+extern int heap_perform_gc_step(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size);
 
 // Array functionality
 extern int heap_allocate_array(VALUE *res, unsigned int size, TYPE type);
+extern int heap_restore_array(unsigned int ix, unsigned int size, TYPE type, void *data);
+extern unsigned int heap_array_elt_size(TYPE type);
 
 static inline TYPE val_type(VALUE x) {
   return (x & VAL_TYPE_MASK);
@@ -271,7 +502,7 @@ static inline VALUE enc_cons_ptr(UINT x) {
   return ((x << ADDRESS_SHIFT) | PTR_TYPE_CONS | PTR);
 }
 
-static inline uint32_t dec_ptr(VALUE p) {
+static inline UINT dec_ptr(VALUE p) {
   return ((PTR_VAL_MASK & p) >> ADDRESS_SHIFT);
 }
 
@@ -279,7 +510,7 @@ static inline VALUE set_ptr_type(VALUE p, TYPE t) {
   return (PTR_VAL_MASK & p) | t | PTR;
 }
 
-static inline VALUE enc_sym(uint32_t s) {
+static inline VALUE enc_sym(UINT s) {
   return (s << VAL_SHIFT) | VAL_TYPE_SYMBOL;
 }
 
@@ -304,13 +535,28 @@ static inline VALUE enc_U(UINT x) {
 }
 
 static inline VALUE enc_F(FLOAT x) {
-  UINT t;
-  memcpy(&t, &x, sizeof(float));
-  VALUE f = cons(t, enc_sym(DEF_REPR_BOXED_F_TYPE));
+  uint32_t t;
+  memcpy(&t, &x, sizeof(FLOAT));
+  VALUE f = cons((UINT)t, enc_sym(DEF_REPR_BOXED_F_TYPE));
   if (type_of(f) == VAL_TYPE_SYMBOL) return f;
   return set_ptr_type(f, PTR_TYPE_BOXED_F);
 }
 
+// Immediate on 64 bit, on 32 bit if that is exact and otherwise boxed
+// (can return merror).
+static inline VALUE enc_f(FLOAT x) {
+#ifndef BOXED_FLOATS
+  uint32_t t;
+  memcpy(&t, &x, sizeof(FLOAT));
+#if defined(_64_BIT_)
+  return ((VALUE)t << 32) | VAL_TYPE_FLOAT;
+#else
+  if ((t & ~VAL_MASK) == 0) return t | VAL_TYPE_FLOAT;
+#endif
+#endif
+  return enc_F(x);
+}
+
 static inline VALUE enc_char(char x) {
   return ((UINT)x << VAL_SHIFT) | VAL_TYPE_CHAR;
 }
@@ -331,9 +577,13 @@ static inline UINT dec_sym(VALUE x) {
   return x >> VAL_SHIFT;
 }
 
-static inline FLOAT dec_f(VALUE x) { // Use only when knowing that x is a VAL_TYPE_F
+static inline FLOAT dec_f(VALUE x) { // Use only when knowing that x is a float, immediate or boxed
   FLOAT f_tmp;
-  UINT tmp = car(x);
+#if defined(_64_BIT_)
+  uint32_t tmp = (uint32_t)(is_ptr(x) ? car(x) : x >> 32);
+#else
+  uint32_t tmp = is_ptr(x) ? car(x) : (x & VAL_MASK);
+#endif
   memcpy(&f_tmp, &tmp, sizeof(FLOAT));
   return f_tmp;
 }
@@ -346,18 +596,6 @@ static inline INT dec_I(VALUE x) {
   return (INT)car(x);
 }
 
-static inline VALUE val_set_gc_mark(VALUE x) {
-  return x | GC_MARKED;
-}
-
-static inline VALUE val_clr_gc_mark(VALUE x) {
-  return x & ~GC_MASK;
-}
-
-static inline bool val_get_gc_mark(VALUE x) {
-  return x & GC_MASK;
-}
-
 static inline bool is_fundamental(VALUE symrep) {
   return ((type_of(symrep) == VAL_TYPE_SYMBOL)  &&
 	  ((dec_sym(symrep) & 0xFFFF) == 0xFFFF));
@@ -369,7 +607,8 @@ static inline bool is_number(VALUE x) {
 	  (t == VAL_TYPE_U) ||
 	  (t == PTR_TYPE_BOXED_I) ||
 	  (t == PTR_TYPE_BOXED_U) ||
-	  (t == PTR_TYPE_BOXED_F));
+	  (t == PTR_TYPE_BOXED_F) ||
+	  (t == VAL_TYPE_FLOAT));
 }
 
 #endif
@@ -0,0 +1,43 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEAP_STATS_H_
+#define HEAP_STATS_H_
+
+#include "typedefs.h"
+
+/*
+   Heap telemetry for Lisp programs. Added with
+
+     extensions_add("heap-stats", ext_heap_stats);
+
+   (heap-stats) returns an association list, for example
+   (lookup 'pause-max (heap-stats)). pause-hist is a list with the
+   buckets of heap_stats_t and marked an association list from root
+   sets to cells. The totals, alloc-total and pause-total, are boxed.
+*/
+extern VALUE ext_heap_stats(VALUE *args, int argn);
+
+/*
+   (mem-stats), added as "mem-stats", returns an association list from
+   the modules of mem.h to (bytes blocks peak-bytes allocations
+   failed) and from pool to (size free largest), zeros unless
+   mem_pool_init is used.
+*/
+extern VALUE ext_mem_stats(VALUE *args, int argn);
+
+#endif
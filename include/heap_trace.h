@@ -0,0 +1,89 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HEAP_TRACE_H_
+#define HEAP_TRACE_H_
+
+#include <stdint.h>
+
+/*
+   Heap event trace. Events are written to a ring buffer given to
+   heap_trace_init, the oldest events are overwritten when it is
+   full. Writing an event does not take a lock, so collector threads
+   can trace too. With no buffer, or with the event masked out, the
+   cost is a test of heap_trace_mask.
+
+   heap_trace_read takes the events out of the buffer, in order. The
+   events are plain data, utils/heap_trace.py turns a file of them
+   into a timeline of the collections and into heap maps.
+
+   Event        sub       a                b
+   ALLOC        -         cell             -
+   GC_BEGIN     kind      cells in use     collections so far
+   GC_MINOR     -         young cells      -
+   GC_END       kind      cells marked     cells recovered
+   ARRAY_ALLOC  -         cell             bytes
+   ARRAY_FREE   -         cell             bytes
+   RESIZE       -         heap size        -
+   SCOPE        -         cells freed      cells kept
+
+   ALLOC is written for every cell allocated and is not part of
+   HEAP_TRACE_DEFAULT.
+*/
+
+#define HEAP_TRACE_ALLOC        0
+#define HEAP_TRACE_GC_BEGIN     1
+#define HEAP_TRACE_GC_MINOR     2
+#define HEAP_TRACE_GC_END       3
+#define HEAP_TRACE_ARRAY_ALLOC  4
+#define HEAP_TRACE_ARRAY_FREE   5
+#define HEAP_TRACE_RESIZE       6
+#define HEAP_TRACE_SCOPE        7
+
+// Kinds of GC_BEGIN and GC_END.
+#define HEAP_TRACE_COLLECT      0
+#define HEAP_TRACE_STEP         1   // Incremental
+#define HEAP_TRACE_COMPACT      2
+#define HEAP_TRACE_FREEZE       3
+
+#define HEAP_TRACE_BIT(e)       ((uint32_t)1 << (e))
+#define HEAP_TRACE_ALL          ((uint32_t)0xFF)
+#define HEAP_TRACE_DEFAULT      (HEAP_TRACE_ALL & ~HEAP_TRACE_BIT(HEAP_TRACE_ALLOC))
+
+typedef struct {
+  uint64_t time;     // Nanoseconds, from the clock of heap_trace_set_clock
+  uint32_t a;
+  uint32_t b;
+  uint16_t type;
+  uint16_t sub;
+  uint32_t seq;      // Number of the event, from 1
+} heap_trace_event_t;
+
+extern uint32_t heap_trace_mask;
+
+extern int  heap_trace_init(unsigned char *addr, unsigned int num_bytes, uint32_t mask);
+extern void heap_trace_stop(void);
+extern void heap_trace_set_clock(uint64_t (*nsec)(void));
+extern unsigned int heap_trace_read(heap_trace_event_t *events, unsigned int max);
+extern uint32_t heap_trace_lost(void);
+extern void heap_trace_emit(uint16_t type, uint16_t sub, uint32_t a, uint32_t b);
+
+static inline void heap_trace(uint16_t type, uint16_t sub, uint32_t a, uint32_t b) {
+  if (heap_trace_mask & HEAP_TRACE_BIT(type)) heap_trace_emit(type, sub, a, b);
+}
+
+#endif
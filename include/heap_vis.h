@@ -1,6 +0,0 @@
-#ifndef HEAP_VIS_H_
-#define HEAP_VIS_H_
-
-extern void heap_vis_gen_image(void);
-
-#endif
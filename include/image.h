@@ -0,0 +1,45 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stdbool.h>
+
+#include "typedefs.h"
+
+/*
+   A heap image holds the heap cells, arrays and symbol table of an
+   initialized system, for example after the prelude has been
+   evaluated, together with the global environment.
+
+   image_load maps the image into memory, the cells are used in place
+   with copy on write. It is called after symrepr_init, instead of
+   heap_init, and the environment it returns is given to
+   eval_cps_set_env after eval_cps_init. The image must have been
+   saved by a build with the same word size.
+
+   image_save collects garbage before saving, with the environment
+   and the roots of heap_push_root as the only roots. It is called
+   between evaluations.
+*/
+
+extern int image_save(char *filename, VALUE env);
+extern int image_load(char *filename, VALUE *env);
+extern void image_del(void);
+
+#endif
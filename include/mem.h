@@ -0,0 +1,82 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEM_H_
+#define MEM_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+   All memory the library allocates outside of the heap cells goes
+   through mem_malloc/mem_free. Every block is tagged with the module
+   that allocated it, so that the bytes and blocks in use can be
+   followed per module.
+
+   The blocks come from malloc unless another allocator is installed
+   with mem_set_allocator, or mem_pool_init places them in a static
+   pool, before anything is allocated (before symrepr_init and
+   heap_init). The pool is a TLSF (two-level segregated fit)
+   allocator, allocation and free take a bounded number of steps
+   independent of how many blocks there are.
+*/
+
+typedef enum {
+  MEM_HEAP = 0,
+  MEM_STACK,
+  MEM_EVAL,
+  MEM_SYMREPR,
+  MEM_EXTENSIONS,
+  MEM_TOKPAR,
+  MEM_BYTECODE,
+  MEM_IMAGE,
+  MEM_COMPRESSION,
+  MEM_NUM_MODULES
+} mem_module_t;
+
+typedef struct {
+  void *(*malloc)(size_t size, void *arg);
+  void  (*free)(void *ptr, void *arg);
+  void *arg;
+} mem_allocator_t;
+
+typedef struct {
+  size_t       bytes;       // Bytes in use
+  size_t       peak_bytes;
+  unsigned int blocks;      // Blocks in use
+  unsigned int num_alloc;   // Allocations since start
+  unsigned int num_failed;
+} mem_module_stats_t;
+
+typedef struct {
+  mem_module_stats_t module[MEM_NUM_MODULES];
+  size_t pool_size;         // 0 unless the pool is used
+  size_t pool_free;
+  size_t pool_largest;      // Largest block that can be allocated
+} mem_stats_t;
+
+extern void *mem_malloc(mem_module_t module, size_t size);
+extern void *mem_calloc(mem_module_t module, size_t num, size_t size);
+extern void *mem_realloc(mem_module_t module, void *ptr, size_t size);
+extern void  mem_free(void *ptr);
+
+extern int  mem_set_allocator(mem_allocator_t *allocator);
+extern int  mem_pool_init(unsigned char *addr, size_t num_bytes);
+extern void mem_get_stats(mem_stats_t *stats);
+extern const char *mem_module_name(mem_module_t module);
+
+#endif
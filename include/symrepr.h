@@ -65,6 +65,17 @@
 #define DEF_REPR_TYPE_SYMBOL    0x30FFFF
 #define DEF_REPR_TYPE_CHAR      0x31FFFF
 
+// Nodes of analyzed expressions (analyze.h)
+#define DEF_REPR_NODE_QUOTE     0x38FFFF
+#define DEF_REPR_NODE_DEFINE    0x39FFFF
+#define DEF_REPR_NODE_PROGN     0x3AFFFF
+#define DEF_REPR_NODE_LAMBDA    0x3BFFFF
+#define DEF_REPR_NODE_IF        0x3CFFFF
+#define DEF_REPR_NODE_LET       0x3DFFFF
+#define DEF_REPR_NODE_APP       0x3EFFFF
+#define DEF_REPR_NODE_LOCAL     0x3FFFFF
+#define DEF_REPR_NODE_GLOBAL    0x40FFFF
+
 // Fundamental Operations
 #define SYM_ADD                 0x100FFFF
 #define SYM_SUB                 0x101FFFF
@@ -99,6 +110,8 @@ extern bool symrepr_init(void);
 extern int symrepr_lookup(char *, UINT*);
 extern char* symrepr_lookup_name(UINT);
 extern void symrepr_del(void);
+extern bool symrepr_each(bool (*f)(UINT id, char *name, void *arg), void *arg);
+extern bool symrepr_restore(char *name, UINT id);
 
 static inline UINT symrepr_nil(void)         { return DEF_REPR_NIL; }
 static inline UINT symrepr_quote(void)       { return DEF_REPR_QUOTE; }
@@ -40,6 +40,7 @@ typedef float    FLOAT;
 #define PRI_TYPE  PRIu32
 #define PRI_UINT  PRIu32
 #define PRI_INT   PRId32
+#define PRI_HEX   PRIx32
 #define PRI_FLOAT "f"
 #endif
 
@@ -50,12 +51,13 @@ typedef uint64_t TYPE;
 
 typedef uint64_t UINT;
 typedef int64_t  INT;
-typedef double   FLOAT;
+typedef float    FLOAT;
 
 #define PRI_VALUE PRIu64
 #define PRI_TYPE  PRIu64
 #define PRI_UINT  PRIu64
 #define PRI_INT   PRId64
+#define PRI_HEX   PRIx64
 #define PRI_FLOAT "f"
 #endif
 
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include "heap.h"
 #include "symrepr.h"
@@ -27,6 +28,8 @@
 #include "print.h"
 #include "tokpar.h"
 #include "prelude.h"
+#include "heap_stats.h"
+#include "mem.h"
 
 #define EVAL_CPS_STACK_SIZE 256
 
@@ -58,6 +61,12 @@ VALUE ext_print(VALUE *args, int argn) {
 }
 
 
+uint32_t timer_usec(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint32_t)t.tv_sec * 1000000u + (uint32_t)(t.tv_nsec / 1000);
+}
+
 /* load a file, caller is responsible for freeing the returned string */ 
 char * load_file(char *filename) {
   char *file_str = NULL;
@@ -102,6 +111,8 @@ int main(int argc, char **argv) {
   int res = 0;
 
   heap_state_t heap_state;
+  heap_stats_t heap_stats;
+  mem_stats_t mem_stats;
 
   res = symrepr_init();
   if (res)
@@ -119,6 +130,7 @@ int main(int argc, char **argv) {
     printf("Error initializing heap!\n");
     return 0;
   }
+  heap_set_timer(timer_usec);
 
   res = eval_cps_init(EVAL_CPS_STACK_SIZE, false); // dont grow stack 
   if (res)
@@ -128,6 +140,8 @@ int main(int argc, char **argv) {
   }
 
   res = extensions_add("print", ext_print);
+  res = res && extensions_add("heap-stats", ext_heap_stats);
+  res = res && extensions_add("mem-stats", ext_mem_stats);
   if (res)
     printf("Extension added.\n");
   else
@@ -165,6 +179,25 @@ int main(int argc, char **argv) {
       printf("Recovered arrays: %u\n", heap_state.gc_recovered_arrays);
       printf("Marked: %d\n", heap_state.gc_marked);
       printf("Free cons cells: %d\n", heap_num_free());
+      heap_get_stats(&heap_stats);
+      printf("Free list length: %u\n", heap_stats.freelist_length);
+      printf("Live cons/boxed/arrays: %u/%u/%u\n", heap_stats.live_cons, heap_stats.live_boxed, heap_stats.live_arrays);
+      printf("Live array bytes: %u\n", heap_stats.live_array_bytes);
+      printf("Scope cells freed/kept: %u/%u\n", heap_stats.scope_freed, heap_stats.scope_kept);
+      printf("Allocated cells: %" PRIu64 " (%u per second)\n", heap_stats.alloc_total, heap_stats.alloc_rate);
+      printf("Pauses: %u, max %" PRIu32 " us, total %" PRIu64 " us\n", heap_stats.num_pauses, heap_stats.pause_max, heap_stats.pause_total);
+      printf("Pause histogram (us):");
+      for (int i = 0; i < HEAP_PAUSE_BUCKETS; i ++) {
+	if (heap_stats.pause_hist[i]) printf(" <%lu:%u", 1ul << i, heap_stats.pause_hist[i]);
+      }
+      printf("\n");
+      mem_get_stats(&mem_stats);
+      printf("Memory (bytes/blocks/peak):");
+      for (int i = 0; i < MEM_NUM_MODULES; i ++) {
+	mem_module_stats_t *m = &mem_stats.module[i];
+	if (m->num_alloc) printf(" %s:%zu/%u/%zu", mem_module_name((mem_module_t)i), m->bytes, m->blocks, m->peak_bytes);
+      }
+      printf("\n");
       printf("############################################################\n");
     } else if (n >= 5 && strncmp(str, ":load", 5) == 0) {
       char *file_str = load_file(&str[5]);
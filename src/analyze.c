@@ -0,0 +1,298 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "symrepr.h"
+#include "heap.h"
+#include "typedefs.h"
+#include "analyze.h"
+
+typedef enum {
+  FORM_KEEP,      // Left as it is
+  FORM_VAR,
+  FORM_QUOTE,
+  FORM_DEFINE,
+  FORM_PROGN,
+  FORM_LAMBDA,
+  FORM_IF,
+  FORM_LET,
+  FORM_APP
+} form_t;
+
+// The frames made by the code being analyzed, innermost first. The
+// frames of the environment the code runs in follow. The names of
+// a let are taken from its (key exp) bindings.
+typedef struct scope_s {
+  VALUE names;
+  bool bindings;
+  struct scope_s *next;
+} scope_t;
+
+static bool is_nil(VALUE v) {
+  return type_of(v) == VAL_TYPE_SYMBOL && dec_sym(v) == symrepr_nil();
+}
+
+static bool is_node(VALUE v) {
+  if (type_of(v) != VAL_TYPE_SYMBOL) return false;
+  UINT s = dec_sym(v);
+  return s >= DEF_REPR_NODE_QUOTE && s <= DEF_REPR_NODE_GLOBAL;
+}
+
+// Length of a proper list, or -1.
+static int list_length(VALUE l) {
+  int n = 0;
+  while (type_of(l) == PTR_TYPE_CONS) {
+    n ++;
+    l = cdr(l);
+  }
+  return is_nil(l) ? n : -1;
+}
+
+// The bindings of a let are (key exp) lists. A missing exp is nil
+// and extra parts are ignored.
+static bool let_bindings(VALUE binds) {
+  if (list_length(binds) < 0) return false;
+  for (VALUE b = binds; type_of(b) == PTR_TYPE_CONS; b = cdr(b)) {
+    if (list_length(car(b)) < 1 ||
+	type_of(car(car(b))) != VAL_TYPE_SYMBOL) return false;
+  }
+  return true;
+}
+
+static form_t form_of(VALUE exp, unsigned int depth) {
+
+  if (type_of(exp) == VAL_TYPE_SYMBOL) {
+    return is_nil(exp) ? FORM_KEEP : FORM_VAR;
+  }
+  if (type_of(exp) != PTR_TYPE_CONS ||
+      depth >= ANALYZE_MAX_DEPTH) return FORM_KEEP;
+
+  VALUE head = car(exp);
+  int n = list_length(exp);
+
+  if (n < 0 || is_node(head)) return FORM_KEEP;
+  if (type_of(head) != VAL_TYPE_SYMBOL) return FORM_APP;
+
+  // Parts that are missing are nil and parts too many are
+  // ignored, as when the form is evaluated unanalyzed.
+  UINT s = dec_sym(head);
+  if (s == symrepr_quote()) {
+    return FORM_QUOTE;
+  }
+  if (s == symrepr_define()) {
+    VALUE key = car(cdr(exp));
+    return (type_of(key) == VAL_TYPE_SYMBOL &&
+	    !is_nil(key)) ? FORM_DEFINE : FORM_KEEP;
+  }
+  if (s == symrepr_progn()) {
+    return n >= 2 ? FORM_PROGN : FORM_KEEP;
+  }
+  if (s == symrepr_lambda()) {
+    return list_length(car(cdr(exp))) >= 0 ? FORM_LAMBDA : FORM_KEEP;
+  }
+  if (s == symrepr_if()) {
+    return FORM_IF;
+  }
+  if (s == symrepr_let()) {
+    VALUE binds = car(cdr(exp));
+    return (type_of(binds) != PTR_TYPE_CONS ||
+	    let_bindings(binds)) ? FORM_LET : FORM_KEEP;
+  }
+  return FORM_APP;
+}
+
+// Position of sym in names, from 1, or 0 and the number of names in *n.
+static UINT name_index(VALUE sym, VALUE names, bool bindings, UINT *n) {
+  UINT i = 1;
+  for (; type_of(names) == PTR_TYPE_CONS; names = cdr(names), i ++) {
+    VALUE name = bindings ? car(car(names)) : car(names);
+    if (name == sym) return i;
+  }
+  *n = i - 1;
+  return 0;
+}
+
+// The number of cdrs from the start of the local environment to the
+// cell that holds the value of sym, or 0 if sym is not bound there.
+static UINT local_offset(VALUE sym, scope_t *scope, VALUE env) {
+  UINT k = 0;
+  UINT n;
+  UINT i;
+
+  for (; scope; scope = scope->next) {
+    if ((i = name_index(sym, scope->names, scope->bindings, &n))) return k + i;
+    k += n + 1;
+  }
+  while (type_of(env) == PTR_TYPE_CONS) {
+    if ((i = name_index(sym, car(env), false, &n))) return k + i;
+    k += n + 1;
+    for (UINT j = 0; j <= n; j ++) env = cdr(env);
+  }
+  return 0;
+}
+
+static unsigned int cells(VALUE exp, scope_t *scope, VALUE env, unsigned int depth);
+
+static unsigned int list_cells(VALUE exps, scope_t *scope, VALUE env, unsigned int depth) {
+  unsigned int n = 0;
+  for (VALUE e = exps; type_of(e) == PTR_TYPE_CONS; e = cdr(e)) {
+    n += 1 + cells(car(e), scope, env, depth);
+  }
+  return n;
+}
+
+static unsigned int cells(VALUE exp, scope_t *scope, VALUE env, unsigned int depth) {
+
+  VALUE args = cdr(exp);
+  depth ++;
+
+  switch (form_of(exp, depth - 1)) {
+  case FORM_VAR:
+  case FORM_QUOTE:
+    return 1;
+  case FORM_DEFINE:
+    return 2 + cells(car(cdr(args)), scope, env, depth);
+  case FORM_PROGN:
+    if (is_nil(cdr(args))) return cells(car(args), scope, env, depth);
+    return 1 + list_cells(args, scope, env, depth);
+  case FORM_LAMBDA: {
+    scope_t frame = { car(args), false, scope };
+    return 2 + cells(car(cdr(args)), is_nil(car(args)) ? scope : &frame, env, depth);
+  }
+  case FORM_IF:
+    return 3 + cells(car(args), scope, env, depth) +
+      cells(car(cdr(args)), scope, env, depth) +
+      cells(car(cdr(cdr(args))), scope, env, depth);
+  case FORM_LET: {
+    VALUE binds = car(args);
+    if (type_of(binds) != PTR_TYPE_CONS) {
+      return cells(car(cdr(args)), scope, env, depth);
+    }
+    scope_t frame = { binds, true, scope };
+    unsigned int n = 3 + cells(car(cdr(args)), &frame, env, depth);
+    for (VALUE b = binds; type_of(b) == PTR_TYPE_CONS; b = cdr(b)) {
+      n += 2 + cells(car(cdr(car(b))), &frame, env, depth);
+    }
+    return n;
+  }
+  case FORM_APP:
+    return 1 + list_cells(exp, scope, env, depth);
+  default:
+    return 0;
+  }
+}
+
+unsigned int analyze_cells(VALUE exp, VALUE env) {
+  return cells(exp, NULL, env, 0);
+}
+
+static bool cons_to(VALUE *r, VALUE a, VALUE b) {
+  *r = cons(a, b);
+  return type_of(*r) != VAL_TYPE_SYMBOL;
+}
+
+static bool list_finish(heap_list_t *l, VALUE *res) {
+  *res = heap_list_finish(l, enc_sym(symrepr_nil()));
+  return type_of(*res) != VAL_TYPE_SYMBOL || is_nil(*res);
+}
+
+static bool analyze_exp(VALUE exp, scope_t *scope, VALUE env, unsigned int depth, VALUE *res);
+
+// The expressions of a list, analyzed, in a new list.
+static bool analyze_list(VALUE exps, scope_t *scope, VALUE env, unsigned int depth, VALUE *res) {
+  heap_list_t l;
+  heap_list_init(&l);
+
+  for (VALUE e = exps; type_of(e) == PTR_TYPE_CONS; e = cdr(e)) {
+    VALUE a;
+    if (!analyze_exp(car(e), scope, env, depth, &a) ||
+	!heap_list_append(&l, a)) return false;
+  }
+  return list_finish(&l, res);
+}
+
+static bool analyze_exp(VALUE exp, scope_t *scope, VALUE env, unsigned int depth, VALUE *res) {
+
+  VALUE args = cdr(exp);
+  VALUE a, b, c;
+  depth ++;
+
+  switch (form_of(exp, depth - 1)) {
+  case FORM_VAR: {
+    UINT k = local_offset(exp, scope, env);
+    if (k) return cons_to(res, enc_sym(DEF_REPR_NODE_LOCAL), enc_u(k));
+    return cons_to(res, enc_sym(DEF_REPR_NODE_GLOBAL), exp);
+  }
+  case FORM_QUOTE:
+    return cons_to(res, enc_sym(DEF_REPR_NODE_QUOTE), car(args));
+  case FORM_DEFINE:
+    if (!analyze_exp(car(cdr(args)), scope, env, depth, &a)) return false;
+    if (!cons_to(&a, car(args), a)) return false;
+    return cons_to(res, enc_sym(DEF_REPR_NODE_DEFINE), a);
+  case FORM_PROGN:
+    if (is_nil(cdr(args))) return analyze_exp(car(args), scope, env, depth, res);
+    if (!analyze_list(args, scope, env, depth, &a)) return false;
+    return cons_to(res, enc_sym(DEF_REPR_NODE_PROGN), a);
+  case FORM_LAMBDA: {
+    scope_t frame = { car(args), false, scope };
+    if (!analyze_exp(car(cdr(args)), is_nil(car(args)) ? scope : &frame,
+		     env, depth, &a)) return false;
+    if (!cons_to(&a, car(args), a)) return false;
+    return cons_to(res, enc_sym(DEF_REPR_NODE_LAMBDA), a);
+  }
+  case FORM_IF:
+    if (!analyze_exp(car(args), scope, env, depth, &a) ||
+	!analyze_exp(car(cdr(args)), scope, env, depth, &b) ||
+	!analyze_exp(car(cdr(cdr(args))), scope, env, depth, &c)) return false;
+    if (!cons_to(&b, b, c)) return false;
+    if (!cons_to(&a, a, b)) return false;
+    return cons_to(res, enc_sym(DEF_REPR_NODE_IF), a);
+  case FORM_LET: {
+    VALUE binds = car(args);
+    if (type_of(binds) != PTR_TYPE_CONS) {
+      return analyze_exp(car(cdr(args)), scope, env, depth, res);
+    }
+    scope_t frame = { binds, true, scope };
+    heap_list_t names;
+    heap_list_t exps;
+    heap_list_init(&names);
+    heap_list_init(&exps);
+    for (VALUE bs = binds; type_of(bs) == PTR_TYPE_CONS; bs = cdr(bs)) {
+      if (!heap_list_append(&names, car(car(bs)))) return false;
+    }
+    if (!list_finish(&names, &a)) return false;
+    for (VALUE bs = binds; type_of(bs) == PTR_TYPE_CONS; bs = cdr(bs)) {
+      if (!analyze_exp(car(cdr(car(bs))), &frame, env, depth, &b) ||
+	  !heap_list_append(&exps, b)) return false;
+    }
+    if (!list_finish(&exps, &b)) return false;
+    if (!analyze_exp(car(cdr(args)), &frame, env, depth, &c)) return false;
+    if (!cons_to(&b, b, c)) return false;
+    if (!cons_to(&a, a, b)) return false;
+    return cons_to(res, enc_sym(DEF_REPR_NODE_LET), a);
+  }
+  case FORM_APP:
+    if (!analyze_list(exp, scope, env, depth, &a)) return false;
+    return cons_to(res, enc_sym(DEF_REPR_NODE_APP), a);
+  default:
+    *res = exp;
+    return true;
+  }
+}
+
+bool analyze(VALUE exp, VALUE env, VALUE *res) {
+  return analyze_exp(exp, NULL, env, 0, res);
+}
@@ -27,6 +27,7 @@
 #include "print.h"
 #include "fundamental.h" 
 #include "eval_cps.h"
+#include "mem.h"
 
 /*
  *  TODO:
@@ -104,7 +105,7 @@ bool emit(code_gen_state *gs, uint8_t b) {
 
   if (gs->functions[ix]->code_size == gs->functions[ix]->code_buffer_size) {
     uint8_t *new_buffer =
-      (uint8_t*)realloc(gs->functions[ix]->code,
+      (uint8_t*)mem_realloc(MEM_BYTECODE, gs->functions[ix]->code,
 			gs->functions[ix]->code_buffer_size +
 			CODE_REALLOC_STEP);
     if (new_buffer == NULL) return false;
@@ -121,7 +122,7 @@ bool next_function(code_gen_state *gs, unsigned int *res) {
 
   if ( gs->num_functions == gs->functions_buffer_size) {
     code_buffer **new_buffer =
-      (code_buffer **)realloc(gs->functions,
+      (code_buffer **)mem_realloc(MEM_BYTECODE, gs->functions,
 			      gs->functions_buffer_size +
 			      (FUNCTIONS_REALLOC_STEP *
 			       sizeof(code_buffer*)));
@@ -132,7 +133,7 @@ bool next_function(code_gen_state *gs, unsigned int *res) {
 
   if ( gs->num_functions < gs->functions_buffer_size) {
     *res = gs->num_functions;
-    gs->functions[gs->num_functions]->code = (uint8_t*)malloc(CODE_REALLOC_STEP);
+    gs->functions[gs->num_functions]->code = (uint8_t*)mem_malloc(MEM_BYTECODE, CODE_REALLOC_STEP);
     if (!gs->functions[gs->num_functions]->code) return false;
     gs->functions[gs->num_functions]->code_size = 0;
     gs->functions[gs->num_functions]->code_buffer_size = CODE_REALLOC_STEP;
@@ -145,9 +146,9 @@ bool next_function(code_gen_state *gs, unsigned int *res) {
 void code_gen_state_del(code_gen_state *gs) {
 
   for (unsigned int i = 0; i < gs->num_functions; i ++) {
-    if (gs->functions[i]->code) free(gs->functions[i]->code);
+    if (gs->functions[i]->code) mem_free(gs->functions[i]->code);
   }
-  free(gs);
+  mem_free(gs);
 }
 
 int index_of(VALUE *constants, unsigned int num, VALUE v, unsigned int *res) {
@@ -230,7 +231,7 @@ void continuation(stack *s, code_gen_state *gs, VALUE arg,
 
 bool bytecode_create(bytecode_t *bc, int size) {
   bc->code = NULL;
-  bc->code = malloc(size);
+  bc->code = mem_malloc(MEM_BYTECODE, size);
   if (bc->code == NULL) return false;
   bc->num_constants = 0;
   return true;
@@ -238,12 +239,11 @@ bool bytecode_create(bytecode_t *bc, int size) {
 
 void bytecode_del(bytecode_t *bc) {
   if (bc) {
-    if (bc->code) free(bc->code);
-    free(bc);
+    if (bc->code) mem_free(bc->code);
+    mem_free(bc);
   }
 }
 
-extern VALUE run_eval(eval_context_t *ctx); // TODO
 VALUE try_reduce_constant(VALUE exp) {
 
   eval_context_t *ctx = eval_cps_new_context_inherit_env(exp, exp);
@@ -260,23 +260,22 @@ VALUE try_reduce_constant(VALUE exp) {
     res =  exp;
   }
 
-  eval_cps_drop_top_context();
-
-  return res;
+  // Garbage of the evaluation is freed along with the context.
+  return eval_cps_drop_top_context(res);
 }
 
 code_gen_state* create_gen_state(void) {
-  code_gen_state* state = (code_gen_state *)malloc(sizeof(code_gen_state));
+  code_gen_state* state = (code_gen_state *)mem_malloc(MEM_BYTECODE, sizeof(code_gen_state));
   if(!state) return NULL;
 
-  state->functions = (code_buffer**)malloc(FUNCTIONS_REALLOC_STEP *
+  state->functions = (code_buffer**)mem_malloc(MEM_BYTECODE, FUNCTIONS_REALLOC_STEP *
 					   sizeof(code_buffer*));
   if (!state->functions) {
-    free(state);
+    mem_free(state);
     return NULL;
   }
   for (int i = 0; i < FUNCTIONS_REALLOC_STEP; i ++) {
-    state->functions[i] = (code_buffer*)malloc(sizeof(code_buffer));
+    state->functions[i] = (code_buffer*)mem_malloc(MEM_BYTECODE, sizeof(code_buffer));
     state->functions[i]->code = NULL;
     state->functions[i]->code_size = 0;
     state->functions[i]->code_buffer_size = 0;
@@ -292,7 +291,7 @@ code_gen_state* create_gen_state(void) {
 bytecode_t *state_to_bytecode(code_gen_state *gs) {
   unsigned int size = total_code_size(gs);
 
-  bytecode_t *bc = (bytecode_t *)malloc(sizeof(bytecode_t));
+  bytecode_t *bc = (bytecode_t *)mem_malloc(MEM_BYTECODE, sizeof(bytecode_t));
   if (!bc) return false;
   bytecode_create(bc, size);
 
@@ -448,7 +447,7 @@ VALUE bytecode_eval(stack *s, bytecode_t *bc) {
   uint8_t *code = bc->code;
   bool running = true;
   uint8_t ix;
-  uint32_t val;
+  VALUE val;
   VALUE hack = enc_sym(symrepr_nil());
   uint8_t n_args = 0;
   //  bi_fptr bi_fun_ptr = NULL;
@@ -22,6 +22,7 @@
 #include <stdbool.h>
 
 #include "compression.h"
+#include "mem.h"
 
 #define  KEY  0
 #define  CODE 1
@@ -425,7 +426,7 @@ char *compression_compress(char *string, uint32_t *res_size) {
 
   if (header_value == 0) return NULL;
 
-  char *compressed = malloc(c_size_bytes);
+  char *compressed = mem_malloc(MEM_COMPRESSION, c_size_bytes);
   if (!compressed) return NULL;
   memset(compressed, 0, c_size_bytes);
   *res_size = c_size_bytes;
@@ -23,29 +23,6 @@
 #include "print.h"
 #include "typedefs.h"
 
-// Copies just the skeleton structure of an environment
-// The new "copy" will have pointers to the original key-val bindings.
-VALUE env_copy_shallow(VALUE env) {
-
-  VALUE res = enc_sym(symrepr_nil());
-  VALUE curr = env;
-
-  while (type_of(curr) == PTR_TYPE_CONS) {
-    VALUE key = car(car(curr));
-    if (dec_sym(key) != symrepr_nil()) {
-      res = cons(car(curr), res);
-
-      // Check for "out of memory"
-      if (type_of(res) == VAL_TYPE_SYMBOL &&
-	  dec_sym(res) == symrepr_merror()) {
-	return res;
-      }
-    }
-    curr = cdr(curr);
-  }
-  return  res;
-}
-
 VALUE env_lookup(VALUE sym, VALUE env) {
   VALUE curr = env;
 
@@ -70,7 +47,10 @@ VALUE env_set(VALUE env, VALUE key, VALUE val) {
   
   while(type_of(curr) == PTR_TYPE_CONS) {
     if (car(car(curr)) == key) {
-      set_cdr(car(curr),val);
+      // A cdr-coded binding needs a new cell for the value.
+      if (!set_cdr(car(curr),val)) {
+	return enc_sym(symrepr_merror());
+      }
       return env;
     }
     curr = cdr(curr);
@@ -90,50 +70,42 @@ VALUE env_set(VALUE env, VALUE key, VALUE val) {
 }
 
 
-VALUE env_modify_binding(VALUE env, VALUE key, VALUE val) {
-
+// The value of sym in a chain of frames, see env.h.
+VALUE env_frame_lookup(VALUE sym, VALUE env) {
   VALUE curr = env;
 
+  if(dec_sym(sym) == symrepr_nil()) {
+    return sym;
+  }
+
   while (type_of(curr) == PTR_TYPE_CONS) {
-    if (car(car(curr)) == key) {
-      set_cdr(car(curr), val);
-      return env;
-    }
+    VALUE names = car(curr);
     curr = cdr(curr);
-
+    while (type_of(names) == PTR_TYPE_CONS) {
+      if (car(names) == sym) {
+	return car(curr);
+      }
+      names = cdr(names);
+      curr = cdr(curr);
+    }
   }
   return enc_sym(symrepr_not_found());
 }
 
+// A frame binding the n names to the n values, nil if values is
+// NULL, in front of env. At most n + 1 cells are used.
+VALUE env_build_frame(VALUE names, VALUE *values, unsigned int n, VALUE env) {
 
-VALUE env_build_params_args(VALUE params,
-			    VALUE args,
-			    VALUE env0) {
-  VALUE curr_param = params;
-  VALUE curr_arg = args;
-
-  // TODO: This should be checked outside of this function.
-  //
-  if (length(params) != length(args)) { // programmer error
-    return enc_sym(symrepr_fatal_error());
-  }
-
-  VALUE env = env0;
-  while (type_of(curr_param) == PTR_TYPE_CONS) {
-
-    VALUE entry = cons(car(curr_param), car(curr_arg));
-    if (type_of(entry) == VAL_TYPE_SYMBOL &&
-	dec_sym(entry) == symrepr_merror())
-      return enc_sym(symrepr_merror());
-
-    env = cons(entry,env);
+  if (n == 0) return env;
 
-    if (type_of(env) == VAL_TYPE_SYMBOL &&
-	dec_sym(env) == symrepr_merror())
-      return enc_sym(symrepr_merror());
+  if (!heap_reserve(n + 1)) return enc_sym(symrepr_merror());
 
-    curr_param = cdr(curr_param);
-    curr_arg   = cdr(curr_arg);
+  heap_list_t l;
+  heap_list_init(&l);
+  bool ok = heap_list_append(&l, names);
+  for (unsigned int i = 0; i < n && ok; i ++) {
+    ok = heap_list_append(&l, values ? values[i] : enc_sym(symrepr_nil()));
   }
-  return env;
+  if (!ok) return enc_sym(symrepr_merror());
+  return heap_list_finish(&l, env);
 }
@@ -23,9 +23,8 @@
 #include "stack.h"
 #include "fundamental.h"
 #include "extensions.h"
-#ifdef VISUALIZE_HEAP
-#include "heap_vis.h"
-#endif
+#include "mem.h"
+#include "analyze.h"
 
 #define DONE              1
 #define SET_GLOBAL_ENV    2
@@ -46,39 +45,82 @@ static VALUE eval_cps_global_env;
 static VALUE NIL;
 static VALUE NONSENSE;
 
+// A fundamental evaluates to itself unless the global environment
+// binds its symbol. Until a special symbol is defined the global
+// environment is not searched for fundamentals.
+static bool special_defined = false;
+
 eval_context_t *eval_context = NULL;
+static unsigned int eval_depth = 0;
 
 eval_context_t *eval_cps_get_current_context(void) {
   return eval_context;
 }
 
 eval_context_t *eval_cps_new_context_inherit_env(VALUE program, VALUE curr_exp) {
-  eval_context_t *ctx = malloc(sizeof(eval_context_t));
+  eval_context_t *ctx = mem_malloc(MEM_EVAL, sizeof(eval_context_t));
   ctx->program = program;
   ctx->curr_exp = curr_exp;
   ctx->curr_env = eval_context->curr_env; /* TODO: Copy environment */
   stack_allocate(&ctx->K, 100, true);
+  ctx->scope = heap_scope_open();
   ctx->next = eval_context;
   eval_context = ctx;
   return ctx;
 }
 
-void eval_cps_drop_top_context(void) {
+// The cells allocated by the context, if it has a heap scope, are
+// freed unless they can be reached from res or the global
+// environment. Returns res.
+VALUE eval_cps_drop_top_context(VALUE res) {
   eval_context_t *ctx = eval_context;
+  if (ctx->scope) {
+    VALUE roots[] = { res, eval_cps_global_env };
+    heap_scope_close(roots, 2);
+  }
   eval_context = eval_context->next;
   stack_free(&ctx->K);
-  free(ctx);
+  mem_free(ctx);
+  return res;
 }
 
 VALUE eval_cps_get_env(void) {
   return eval_cps_global_env;
 }
 
+static bool special_key(VALUE key) {
+  return is_fundamental(key) && dec_sym(key) != symrepr_nil();
+}
+
+void eval_cps_set_env(VALUE env) {
+  eval_cps_global_env = env;
+  special_defined = false;
+  for (VALUE curr = env; type_of(curr) == PTR_TYPE_CONS; curr = cdr(curr)) {
+    if (special_key(car(car(curr)))) special_defined = true;
+  }
+}
+
+// Freeze everything that is live, the prelude for example, into the
+// frozen segment of the heap. Only between evaluations.
+int eval_cps_freeze(void) {
+  eval_context_t *ctx = eval_context;
+  if (eval_depth > 0 || ctx == NULL || ctx->next != NULL) return 0;
+
+  VALUE *roots[] = { &eval_cps_global_env,
+		     &ctx->curr_env,
+		     &ctx->curr_exp,
+		     &ctx->program };
+  return heap_freeze(roots, 4, ctx->K.data, ctx->K.sp);
+}
+
 VALUE eval_cps_bi_eval(VALUE exp) {
   eval_context_t *ctx = eval_cps_get_current_context();
 
   ctx->curr_exp = exp;
-  return run_eval(ctx);
+  eval_depth ++;
+  VALUE res = run_eval(ctx);
+  eval_depth --;
+  return res;
 }
 
 // ////////////////////////////////////////////////////////
@@ -89,6 +131,13 @@ VALUE cont_set_global_env(eval_context_t *ctx, VALUE val, bool *done, bool *perf
 
   VALUE key;
   pop_u32(&ctx->K, &key);
+
+  // A new binding takes two cells.
+  if (!heap_reserve(2)) {
+    FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, key, enc_u(SET_GLOBAL_ENV)));
+    *perform_gc = true;
+    return val;
+  }
   VALUE new_env = env_set(eval_cps_global_env,key,val);
 
   if (type_of(new_env) == VAL_TYPE_SYMBOL) {
@@ -103,9 +152,126 @@ VALUE cont_set_global_env(eval_context_t *ctx, VALUE val, bool *done, bool *perf
     }
   }
   eval_cps_global_env = new_env;
+  if (special_key(key)) special_defined = true;
   return enc_sym(symrepr_true());
 }
 
+// The value of the symbol sym in the global environment. A
+// fundamental or an extension evaluates to itself. False if sym has
+// no value.
+static bool lookup_global(VALUE sym, VALUE *value) {
+
+  if (!special_defined && is_fundamental(sym)) {
+    *value = sym;
+    return true;
+  }
+
+  *value = env_lookup(sym, eval_cps_global_env);
+  if (type_of(*value) == VAL_TYPE_SYMBOL &&
+      dec_sym(*value) == symrepr_not_found()) {
+
+    if (!is_fundamental(sym) &&
+	extensions_lookup(dec_sym(sym)) == NULL) {
+      return false;
+    }
+    *value = sym; // symbol representing extension
+                  // evaluates to itself at this stage.
+  }
+  return true;
+}
+
+// The value of the symbol sym in the frames of env or else in the
+// global environment.
+static bool lookup_sym(VALUE sym, VALUE env, VALUE *value) {
+
+  *value = env_frame_lookup(sym, env);
+  if (type_of(*value) == VAL_TYPE_SYMBOL &&
+      dec_sym(*value) == symrepr_not_found()) {
+    return lookup_global(sym, value);
+  }
+  return true;
+}
+
+// The value of a node_local or node_global variable (analyze.h).
+static bool eval_var(VALUE node, VALUE env, VALUE *value) {
+
+  VALUE v = cdr(node);
+  if (dec_sym(car(node)) == DEF_REPR_NODE_GLOBAL) {
+    return lookup_global(v, value);
+  }
+  for (UINT k = dec_u(v); k > 0; k --) {
+    env = cdr(env);
+  }
+  *value = car(env);
+  return true;
+}
+
+// Evaluate exp in env on the spot if it is a symbol, a constant, a
+// variable or a quote node. False otherwise, or if the value is and/or or there is
+// no value, run_eval takes care of those.
+static bool eval_atom(VALUE exp, VALUE env, VALUE *value) {
+
+  switch (type_of(exp)) {
+  case VAL_TYPE_SYMBOL:
+    if (!lookup_sym(exp, env, value)) return false;
+    break;
+  case PTR_TYPE_BOXED_F:
+  case PTR_TYPE_BOXED_U:
+  case PTR_TYPE_BOXED_I:
+  case VAL_TYPE_FLOAT:
+  case VAL_TYPE_I:
+  case VAL_TYPE_U:
+  case VAL_TYPE_CHAR:
+  case PTR_TYPE_ARRAY:
+    *value = exp;
+    break;
+  case PTR_TYPE_CONS: {
+    VALUE head = car(exp);
+    if (head == enc_sym(DEF_REPR_NODE_QUOTE)) {
+      *value = cdr(exp);
+    } else if (head == enc_sym(DEF_REPR_NODE_LOCAL) ||
+	       head == enc_sym(DEF_REPR_NODE_GLOBAL)) {
+      if (!eval_var(exp, env, value)) return false;
+    } else {
+      return false;
+    }
+    break;
+  }
+  default:
+    return false;
+  }
+  return (type_of(*value) != VAL_TYPE_SYMBOL ||
+	  (dec_sym(*value) != symrepr_and() &&
+	   dec_sym(*value) != symrepr_or()));
+}
+
+// The function and the first count arguments of an application are on
+// the stack, rest are the argument expressions left. The arguments
+// that are atoms are pushed without going through run_eval, the first
+// one that is not is evaluated next.
+static VALUE application_args(eval_context_t *ctx, VALUE env, UINT count, VALUE rest,
+			      bool *done, bool *app_cont) {
+
+  VALUE value;
+  while (type_of(rest) == PTR_TYPE_CONS &&
+	 eval_atom(car(rest), env, &value)) {
+    FATAL_ON_FAIL(*done, push_u32(&ctx->K, value));
+    count ++;
+    rest = cdr(rest);
+  }
+
+  if (type_of(rest) == VAL_TYPE_SYMBOL &&
+      rest == NIL) {
+    FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, enc_u(count), enc_u(APPLICATION)));
+    *app_cont = true;
+    return NONSENSE;
+  }
+  FATAL_ON_FAIL(*done, push_u32_4(&ctx->K, env, enc_u(count + 1), cdr(rest), enc_u(APPLICATION_ARGS)));
+  ctx->curr_exp = car(rest);
+  ctx->curr_env = env;
+  return NONSENSE;
+}
+
 VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perform_gc, bool *app_cont){
 
   VALUE k;
@@ -143,6 +309,7 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
     if (type_of(cdr(rest)) == VAL_TYPE_SYMBOL &&
 	cdr(rest) == NIL) {
       ctx->curr_exp = car(rest);
+      ctx->curr_env = env;
       return NONSENSE;
     }
     // Else create a continuation
@@ -152,45 +319,35 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
     return NONSENSE;
   }
   case APPLICATION: {
+    // The frame stays on the stack until the application is done. A
+    // collection in an extension or in a nested evaluation finds the
+    // function and the arguments through it.
+    FATAL_ON_FAIL(*done, push_u32(&ctx->K, k));
     VALUE count;
-    pop_u32(&ctx->K, &count);
+    FATAL_ON_FAIL(*done, stack_arg_ix(&ctx->K, 1, &count));
 
-    UINT *fun_args = stack_ptr(&ctx->K, dec_u(count)+1);
+    UINT *fun_args = stack_ptr(&ctx->K, dec_u(count)+3);
 
     VALUE fun = fun_args[0];
 
     if (type_of(fun) == PTR_TYPE_CONS) { // a closure (it better be)
-      VALUE args = NIL;
-      for (UINT i = dec_u(count); i > 0; i --) {
-	args = cons(fun_args[i], args);
-	if (type_of(args) == VAL_TYPE_SYMBOL) {
-	  FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, count, enc_u(APPLICATION)));
-	  *perform_gc = true;
-	  *app_cont = true;
-	  return fun;
-	}
-      }
       VALUE params  = car(cdr(fun));
       VALUE exp     = car(cdr(cdr(fun)));
       VALUE clo_env = car(cdr(cdr(cdr(fun))));
 
-      if (length(params) != length(args)) { // programmer error
+      if (length(params) != dec_u(count)) { // programmer error
 	*done = true;
 	return enc_sym(symrepr_eerror());
       }
 
-      VALUE local_env = env_build_params_args(params, args, clo_env);
-      if (type_of(local_env) == VAL_TYPE_SYMBOL) {
-	if (dec_sym(local_env) == symrepr_merror() ) {
-	  FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, count, enc_u(APPLICATION)));
-	  *perform_gc = true;
-	  *app_cont = true;
-	  return fun;
-	}
-
-	if (dec_sym(local_env) == symrepr_fatal_error()) {
-	  return local_env;
-	}
+      // The arguments go into a frame in front of the closure
+      // environment.
+      VALUE local_env = env_build_frame(params, &fun_args[1], dec_u(count), clo_env);
+      if (type_of(local_env) == VAL_TYPE_SYMBOL &&
+	  dec_sym(local_env) == symrepr_merror()) {
+	*perform_gc = true;
+	*app_cont = true;
+	return fun;
       }
 
       /* ************************************************************
@@ -203,7 +360,7 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
 	 I am very unsure about the correctness here.
          ************************************************************ */
 
-      stack_drop(&ctx->K, dec_u(count)+1);
+      stack_drop(&ctx->K, dec_u(count)+3);
       ctx->curr_exp = exp;
       ctx->curr_env = local_env;
       return NONSENSE;
@@ -212,6 +369,11 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
       VALUE res;
 
       if (is_fundamental(fun)) {
+	if (!heap_reserve(fundamental_cells(&fun_args[1], dec_u(count), fun))) {
+	  *perform_gc = true;
+	  *app_cont = true;
+	  return fun;
+	}
 	res = fundamental_exec(&fun_args[1], dec_u(count), fun);
 	if (type_of(res) == VAL_TYPE_SYMBOL &&
 	    dec_sym(res) == symrepr_eerror()) {
@@ -220,12 +382,11 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
 	  return  res;
 	} else if (type_of(res) == VAL_TYPE_SYMBOL &&
 		   dec_sym(res) == symrepr_merror()) {
-	  FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, count, enc_u(APPLICATION)));
 	  *perform_gc = true;
 	  *app_cont = true;
 	  return fun;
 	}
-	stack_drop(&ctx->K, dec_u(count)+1);
+	stack_drop(&ctx->K, dec_u(count)+3);
 	*app_cont = true;
 	return res;
       }
@@ -243,13 +404,12 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
 
     if (type_of(ext_res) == VAL_TYPE_SYMBOL &&
 	(dec_sym(ext_res) == symrepr_merror())) {
-      FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, count, enc_u(APPLICATION)));
       *perform_gc = true;
       *app_cont = true;
       return fun;
     }
 
-    stack_drop(&ctx->K, dec_u(count) + 1);
+    stack_drop(&ctx->K, dec_u(count) + 3);
 
     *app_cont = true;
     return ext_res;
@@ -332,34 +492,21 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
 
     FATAL_ON_FAIL(*done, push_u32(&ctx->K, arg));
     /* Deal with general fundamentals */ 
-    if (type_of(rest) == VAL_TYPE_SYMBOL &&
-	rest == NIL) {
-      // no arguments
-      FATAL_ON_FAIL(*done, push_u32_2(&ctx->K, count, enc_u(APPLICATION)));
-      *app_cont = true;
-      return NONSENSE;
-    }
-    FATAL_ON_FAIL(*done, push_u32_4(&ctx->K, env, enc_u(dec_u(count) + 1), cdr(rest), enc_u(APPLICATION_ARGS)));
-    ctx->curr_exp = car(rest);
-    ctx->curr_env = env;
-    return NONSENSE;
+    return application_args(ctx, env, dec_u(count), rest, done, app_cont);
   }
   case BIND_TO_KEY_REST:{
-    VALUE key;
+    VALUE cell;
     VALUE env;
     VALUE rest;
 
-    pop_u32_3(&ctx->K, &key, &env, &rest);
+    pop_u32_3(&ctx->K, &cell, &env, &rest);
 
-    env_modify_binding(env, key, arg);
+    set_car(cell, arg);
 
     if ( type_of(rest) == PTR_TYPE_CONS ){
-      VALUE keyn = car(car(rest));
-      VALUE valn_exp = car(cdr(car(rest)));
-
-      FATAL_ON_FAIL(*done, push_u32_4(&ctx->K, cdr(rest), env, keyn, enc_u(BIND_TO_KEY_REST)));
+      FATAL_ON_FAIL(*done, push_u32_4(&ctx->K, cdr(rest), env, cdr(cell), enc_u(BIND_TO_KEY_REST)));
 
-      ctx->curr_exp = valn_exp;
+      ctx->curr_exp = car(rest);
       ctx->curr_env = env;
       return NONSENSE;
     }
@@ -374,8 +521,13 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
   case IF: {
     VALUE then_branch;
     VALUE else_branch;
+    VALUE env;
+
+    pop_u32_3(&ctx->K, &then_branch, &else_branch, &env);
 
-    pop_u32_2(&ctx->K, &then_branch, &else_branch);
+    // The condition may have been a call that left its own
+    // environment behind.
+    ctx->curr_env = env;
 
     if (type_of(arg) == VAL_TYPE_SYMBOL && dec_sym(arg) == symrepr_true()) {
       ctx->curr_exp = then_branch;
@@ -389,6 +541,252 @@ VALUE apply_continuation(eval_context_t *ctx, VALUE arg, bool *done, bool *perfo
   return enc_sym(symrepr_eerror());
 }
 
+// Visit the values on the continuation stack. Frames are walked from
+// the top, the kind on top of each frame gives its layout. Kinds,
+// counts and keys (symbols) are skipped. The evaluated function and
+// arguments of an application sit below its APPLICATION_ARGS or
+// APPLICATION frame. Returns the number of words at the bottom that
+// do not parse as frames, those are left to the collector to scan
+// conservatively.
+static unsigned int scan_continuations(UINT *K, unsigned int sp,
+				       void (*slot)(VALUE *v, void *arg), void *arg) {
+  unsigned int i = sp;
+
+  while (i > 0) {
+    UINT *t = &K[i-1];
+    unsigned int n;
+    unsigned int args = 0;
+
+    if (is_ptr(*t) || val_type(*t) != VAL_TYPE_U) return i;
+
+    switch (dec_u(*t)) {
+    case DONE:
+      n = 1;
+      break;
+    case SET_GLOBAL_ENV:
+      n = 2;
+      break;
+    case PROGN_REST:
+    case AND:
+    case OR:
+      n = 3;
+      break;
+    case IF:
+      n = 4;
+      break;
+    case BIND_TO_KEY_REST:
+      n = 5;
+      break;
+    case APPLICATION:
+      if (i < 2) return i;
+      args = dec_u(t[-1]) + 1;
+      n = 2;
+      break;
+    case APPLICATION_ARGS:
+      if (i < 4) return i;
+      args = dec_u(t[-2]);
+      n = 4;
+      break;
+    default:
+      return i;
+    }
+    if (n + args > i) return i;
+
+    switch (dec_u(*t)) {
+    case PROGN_REST:
+    case AND:
+    case OR:
+      slot(&t[-1], arg);
+      slot(&t[-2], arg);
+      break;
+    case IF:
+      slot(&t[-1], arg);
+      slot(&t[-2], arg);
+      slot(&t[-3], arg);
+      break;
+    case BIND_TO_KEY_REST:
+      slot(&t[-1], arg);
+      slot(&t[-2], arg);
+      slot(&t[-3], arg);
+      slot(&t[-4], arg);
+      break;
+    case APPLICATION_ARGS:
+      slot(&t[-1], arg);
+      slot(&t[-3], arg);
+      break;
+    default:
+      break;
+    }
+    i -= n;
+    for (unsigned int j = 0; j < args; j ++) {
+      slot(&K[i - 1 - j], arg);
+    }
+    i -= args;
+  }
+  return 0;
+}
+
+// The collector is handed the stack of the running context. The
+// contexts it is nested in are live too and are scanned here.
+static unsigned int scan_contexts(UINT *K, unsigned int sp,
+				  void (*slot)(VALUE *v, void *arg), void *arg) {
+  for (eval_context_t *ctx = eval_context; ctx; ctx = ctx->next) {
+    if (ctx->K.data == K) continue;
+    slot(&ctx->program, arg);
+    slot(&ctx->curr_exp, arg);
+    slot(&ctx->curr_env, arg);
+    unsigned int n = scan_continuations(ctx->K.data, ctx->K.sp, slot, arg);
+    for (unsigned int i = 0; i < n; i ++) {
+      slot(&ctx->K.data[i], arg);
+    }
+  }
+  return scan_continuations(K, sp, slot, arg);
+}
+
+static int gc(eval_context_t *ctx, VALUE *r) {
+  // Cells can only be moved when every reference to them is known.
+  // A nested evaluation has live values on the C stack of the outer one.
+  if (heap_compacting() &&
+      eval_depth == 0 &&
+      ctx == eval_context &&
+      ctx->next == NULL) {
+    VALUE *roots[] = { &eval_cps_global_env,
+		       &ctx->curr_env,
+		       &ctx->curr_exp,
+		       &ctx->program,
+		       r };
+    return heap_perform_gc_compact(roots, 5,
+				   ctx->K.data,
+				   ctx->K.sp);
+  }
+  return heap_perform_gc_aux(eval_cps_global_env,
+			     ctx->curr_env,
+			     ctx->curr_exp,
+			     ctx->program,
+			     *r,
+			     ctx->K.data,
+			     ctx->K.sp);
+}
+
+// Collect garbage from within an extension, for example when an
+// allocation fails halfway through building a result. Values the
+// extension holds must be registered with heap_push_root. The
+// arguments of the extension are on the continuation stack and are
+// kept (and updated) by the collector.
+int eval_cps_gc(void) {
+  VALUE r = NIL;
+  if (!gc(eval_context, &r)) return 0;
+  return heap_num_free() > 0 || heap_grow();
+}
+
+static int gc_step(eval_context_t *ctx, VALUE r) {
+  return heap_perform_gc_step(eval_cps_global_env,
+			      ctx->curr_env,
+			      ctx->curr_exp,
+			      ctx->program,
+			      r,
+			      ctx->K.data,
+			      ctx->K.sp);
+}
+
+// (closure params body env), or merror. Four cells.
+static VALUE mk_closure(VALUE params, VALUE body, VALUE env) {
+
+  VALUE env_end = cons(env, NIL);
+  VALUE body_   = cons(body, env_end);
+  VALUE params_ = cons(params, body_);
+  VALUE closure = cons(enc_sym(symrepr_closure()), params_);
+
+  if (type_of(env_end) == VAL_TYPE_SYMBOL ||
+      type_of(body_)   == VAL_TYPE_SYMBOL ||
+      type_of(params_) == VAL_TYPE_SYMBOL ||
+      type_of(closure) == VAL_TYPE_SYMBOL) {
+    return enc_sym(symrepr_merror());
+  }
+  return closure;
+}
+
+// Run ctx->curr_exp if it is a node of an analyzed expression
+// (analyze.h). The shape of a node is known, so the parts are taken
+// without checks. False if head is not a node symbol.
+static bool eval_node(eval_context_t *ctx, VALUE head,
+		      VALUE *r, bool *done, bool *perform_gc, bool *app_cont) {
+
+  VALUE rest = cdr(ctx->curr_exp);
+
+  switch (dec_sym(head)) {
+  case DEF_REPR_NODE_QUOTE:
+    *r = rest;
+    *app_cont = true;
+    return true;
+  case DEF_REPR_NODE_DEFINE:
+    if (!push_u32_2(&ctx->K, car(rest), enc_u(SET_GLOBAL_ENV))) break;
+    ctx->curr_exp = cdr(rest);
+    return true;
+  case DEF_REPR_NODE_PROGN:
+    if (!push_u32_3(&ctx->K, ctx->curr_env, cdr(rest), enc_u(PROGN_REST))) break;
+    ctx->curr_exp = car(rest);
+    return true;
+  case DEF_REPR_NODE_LAMBDA: {
+    // The closure shares the frames of the environment.
+    VALUE closure = mk_closure(car(rest), cdr(rest), ctx->curr_env);
+    if (type_of(closure) == VAL_TYPE_SYMBOL) {
+      *perform_gc = true;
+      return true;
+    }
+    *r = closure;
+    *app_cont = true;
+    return true;
+  }
+  case DEF_REPR_NODE_IF:
+    if (!push_u32_4(&ctx->K, ctx->curr_env, cdr(cdr(rest)), car(cdr(rest)), enc_u(IF))) break;
+    ctx->curr_exp = car(rest);
+    return true;
+  case DEF_REPR_NODE_LET: {
+    VALUE names = car(rest);
+    VALUE exps  = car(cdr(rest));
+    // The frame is filled in by BIND_TO_KEY_REST, the expressions
+    // see all of it (letrec).
+    VALUE env = env_build_frame(names, NULL, length(names), ctx->curr_env);
+    if (type_of(env) == VAL_TYPE_SYMBOL &&
+	dec_sym(env) == symrepr_merror()) {
+      *perform_gc = true;
+      return true;
+    }
+    if (!push_u32_5(&ctx->K, cdr(cdr(rest)), cdr(exps), env,
+		    cdr(env), enc_u(BIND_TO_KEY_REST))) break;
+    ctx->curr_exp = car(exps);
+    ctx->curr_env = env;
+    return true;
+  }
+  case DEF_REPR_NODE_LOCAL:
+  case DEF_REPR_NODE_GLOBAL:
+    if (!eval_var(ctx->curr_exp, ctx->curr_env, r)) {
+      *done = true;
+      *r = enc_sym(symrepr_eerror());
+      return true;
+    }
+    *app_cont = true;
+    return true;
+  case DEF_REPR_NODE_APP: {
+    VALUE fun;
+    if (eval_atom(car(rest), ctx->curr_env, &fun)) {
+      if (!push_u32(&ctx->K, fun)) break;
+      *r = application_args(ctx, ctx->curr_env, 0, cdr(rest), done, app_cont);
+      return true;
+    }
+    if (!push_u32_4(&ctx->K, ctx->curr_env, enc_u(0), cdr(rest), enc_u(APPLICATION_ARGS))) break;
+    ctx->curr_exp = car(rest);
+    return true;
+  }
+  default:
+    return false;
+  }
+  *done = true;
+  *r = enc_sym(symrepr_fatal_error());
+  return true;
+}
+
 VALUE run_eval(eval_context_t *ctx){
 
 
@@ -405,26 +803,34 @@ VALUE run_eval(eval_context_t *ctx){
 
   while (!done) {
 
-#ifdef VISUALIZE_HEAP
-    heap_vis_gen_image();
-#endif
-
     if (perform_gc) {
       if (non_gc == 0) {
-	done = true;
-	r = enc_sym(symrepr_merror());
-	continue;
+	// The last collection did not free enough, the heap
+	// grows if the growth policy allows it.
+	if (!heap_grow()) {
+	  done = true;
+	  r = enc_sym(symrepr_merror());
+	  continue;
+	}
+      } else {
+	non_gc = 0;
+	gc(ctx, &r);
       }
-      non_gc = 0;
-      heap_perform_gc_aux(eval_cps_global_env,
-			  ctx->curr_env,
-			  ctx->curr_exp,
-			  ctx->program,
-			  r,
-			  ctx->K.data,
-			  ctx->K.sp);
       perform_gc = false;
     } else {
+      // The nursery is collected before it overflows.
+      if (heap_nursery_full()) {
+	gc(ctx, &r);
+      }
+      // Collect before allocation fails when few cells are left.
+      if (heap_gc_due()) {
+	gc(ctx, &r);
+	heap_gc_watermark_done();
+      }
+      // Incremental collection does a bounded amount of work per step.
+      if (heap_gc_incremental()) {
+	gc_step(ctx, r);
+      }
       non_gc ++;
     }
 
@@ -440,26 +846,10 @@ VALUE run_eval(eval_context_t *ctx){
 
     case VAL_TYPE_SYMBOL:
 
-      value = env_lookup(ctx->curr_exp, ctx->curr_env);
-      if (type_of(value) == VAL_TYPE_SYMBOL &&
-	  dec_sym(value) == symrepr_not_found()) {
-
-	value = env_lookup(ctx->curr_exp, eval_cps_global_env);
-
-	if (type_of(value) == VAL_TYPE_SYMBOL &&
-	    dec_sym(value) == symrepr_not_found()) {
-
-	  if (is_fundamental(ctx->curr_exp)) {
-	    value = ctx->curr_exp;
-	  } else if (extensions_lookup(dec_sym(ctx->curr_exp)) == NULL) {
-	    r = enc_sym(symrepr_eerror());
-	    done = true;
-	    continue;
-	  } else {
-	    value = ctx->curr_exp; // symbol representing extension
-	                           // evaluates to itself at this stage.
-	  }
-	}
+      if (!lookup_sym(ctx->curr_exp, ctx->curr_env, &value)) {
+	r = enc_sym(symrepr_eerror());
+	done = true;
+	continue;
       }
       app_cont = true;
       r = value;
@@ -467,6 +857,7 @@ VALUE run_eval(eval_context_t *ctx){
     case PTR_TYPE_BOXED_F:
     case PTR_TYPE_BOXED_U:
     case PTR_TYPE_BOXED_I:
+    case VAL_TYPE_FLOAT:
     case VAL_TYPE_I:
     case VAL_TYPE_U:
     case VAL_TYPE_CHAR:
@@ -484,6 +875,10 @@ VALUE run_eval(eval_context_t *ctx){
 
       if (type_of(head) == VAL_TYPE_SYMBOL) {
 
+	if (eval_node(ctx, head, &r, &done, &perform_gc, &app_cont)) {
+	  continue;
+	}
+
 	// Special form: QUOTE
 	if (dec_sym(head) == symrepr_quote()) {
 	  r = car(cdr(ctx->curr_exp));
@@ -530,38 +925,74 @@ VALUE run_eval(eval_context_t *ctx){
 	  continue;
 	}
 
-	// Special form: LAMBDA
-	if (dec_sym(head) == symrepr_lambda()) {
+	// Special forms: LAMBDA and LET. They are analyzed into nodes
+	// (analyze.h) that run in the next step. A lambda of a shape
+	// that is not analyzed is made into a closure as it is.
+	if (dec_sym(head) == symrepr_lambda() ||
+	    dec_sym(head) == symrepr_let()) {
+	  VALUE node;
 
-	  VALUE env_cpy = env_copy_shallow(ctx->curr_env);
-
-	  if (type_of(env_cpy) == VAL_TYPE_SYMBOL &&
-	      dec_sym(env_cpy) == symrepr_merror()) {
+	  // The nodes and four cells of closure.
+	  if (!heap_reserve(analyze_cells(ctx->curr_exp, ctx->curr_env) + 4) ||
+	      !analyze(ctx->curr_exp, ctx->curr_env, &node)) {
 	    perform_gc = true;
 	    app_cont = false;
 	    continue; // perform gc and resume evaluation at same expression
 	  }
-
-	  VALUE env_end;
-	  VALUE body;
-	  VALUE params;
-	  VALUE closure;
-	  env_end = cons(env_cpy,NIL);
-	  body    = cons(car(cdr(cdr(ctx->curr_exp))), env_end);
-	  params  = cons(car(cdr(ctx->curr_exp)), body);
-	  closure = cons(enc_sym(symrepr_closure()), params);
-
-	  if (type_of(env_end) == VAL_TYPE_SYMBOL ||
-	      type_of(body)    == VAL_TYPE_SYMBOL ||
-	      type_of(params)  == VAL_TYPE_SYMBOL ||
-	      type_of(closure) == VAL_TYPE_SYMBOL) {
+	  if (node != ctx->curr_exp) {
+	    ctx->curr_exp = node;
+	    continue;
+	  }
+	  if (dec_sym(head) == symrepr_let()) {
+	    // Implements letrec by name, with the keys and expressions
+	    // of the bindings in a frame like that of a node_let.
+	    VALUE binds = car(cdr(ctx->curr_exp));
+	    unsigned int n = 0;
+	    for (VALUE b = binds; type_of(b) == PTR_TYPE_CONS; b = cdr(b)) n ++;
+	    if (n == 0) {
+	      ctx->curr_exp = car(cdr(cdr(ctx->curr_exp)));
+	      continue;
+	    }
+	    if (!heap_reserve(3 * n + 1)) {
+	      perform_gc = true;
+	      app_cont = false;
+	      continue;
+	    }
+	    heap_list_t names;
+	    heap_list_t exps;
+	    heap_list_init(&names);
+	    heap_list_init(&exps);
+	    for (VALUE b = binds; type_of(b) == PTR_TYPE_CONS; b = cdr(b)) {
+	      heap_list_append(&names, car(car(b)));
+	    }
+	    VALUE ks = heap_list_finish(&names, enc_sym(symrepr_nil()));
+	    for (VALUE b = binds; type_of(b) == PTR_TYPE_CONS; b = cdr(b)) {
+	      heap_list_append(&exps, car(cdr(car(b))));
+	    }
+	    VALUE es = heap_list_finish(&exps, enc_sym(symrepr_nil()));
+	    VALUE env = env_build_frame(ks, NULL, n, ctx->curr_env);
+	    if (type_of(env) == VAL_TYPE_SYMBOL &&
+		dec_sym(env) == symrepr_merror()) {
+	      perform_gc = true;
+	      app_cont = false;
+	      continue;
+	    }
+	    FATAL_ON_FAIL(done,
+			  push_u32_5(&ctx->K, car(cdr(cdr(ctx->curr_exp))),
+				     cdr(es), env, cdr(env),
+				     enc_u(BIND_TO_KEY_REST)));
+	    ctx->curr_exp = car(es);
+	    ctx->curr_env = env;
+	    continue;
+	  }
+	  r = mk_closure(car(cdr(ctx->curr_exp)),
+			 car(cdr(cdr(ctx->curr_exp))),
+			 ctx->curr_env);
+	  if (type_of(r) == VAL_TYPE_SYMBOL) {
 	    perform_gc = true;
-	    app_cont = false;
-	    continue; // perform gc and resume evaluation at same expression
+	    continue;
 	  }
-
 	  app_cont = true;
-	  r = closure;
 	  continue;
 	}
 
@@ -569,55 +1000,14 @@ VALUE run_eval(eval_context_t *ctx){
 	if (dec_sym(head) == symrepr_if()) {
 
 	  FATAL_ON_FAIL(done,
-			push_u32_3(&ctx->K,
+			push_u32_4(&ctx->K,
+				   ctx->curr_env,
 				   car(cdr(cdr(cdr(ctx->curr_exp)))), // Else branch
 				   car(cdr(cdr(ctx->curr_exp))),      // Then branch
 				   enc_u(IF)));
 	  ctx->curr_exp = car(cdr(ctx->curr_exp));
 	  continue;
 	}
-	// Special form: LET
-	if (dec_sym(head) == symrepr_let()) {
-	  VALUE orig_env = ctx->curr_env;
-	  VALUE binds    = car(cdr(ctx->curr_exp)); // key value pairs.
-	  VALUE exp      = car(cdr(cdr(ctx->curr_exp))); // exp to evaluate in the new env.
-
-	  VALUE curr = binds;
-	  VALUE new_env = orig_env;
-
-	  if (type_of(binds) != PTR_TYPE_CONS) {
-	    // binds better be nil or there is a programmer error.
-	    ctx->curr_exp = exp;
-	    continue;
-	  }
-
-	  // Implements letrec by "preallocating" the key parts
-	  while (type_of(curr) == PTR_TYPE_CONS) {
-	    VALUE key = car(car(curr));
-	    VALUE val = NIL;
-	    VALUE binding;
-	    binding = cons(key, val);
-	    new_env = cons(binding, new_env);
-
-	    if (type_of(binding) == VAL_TYPE_SYMBOL ||
-		type_of(new_env) == VAL_TYPE_SYMBOL) {
-	      perform_gc = true;
-	      app_cont = false;
-	      continue;
-	    }
-	    curr = cdr(curr);
-	  }
-
-	  VALUE key0 = car(car(binds));
-	  VALUE val0_exp = car(cdr(car(binds)));
-
-	  FATAL_ON_FAIL(done,
-			push_u32_5(&ctx->K, exp, cdr(binds), new_env,
-				   key0, enc_u(BIND_TO_KEY_REST)));
-	  ctx->curr_exp = val0_exp;
-	  ctx->curr_env = new_env;
-	  continue;
-	}
       } // If head is symbol
       FATAL_ON_FAIL(done,
 		    push_u32_4(&ctx->K,
@@ -644,18 +1034,19 @@ VALUE eval_cps_program(VALUE lisp) {
 
   ctx->program  = lisp;
   VALUE res = NIL;
-  VALUE curr = lisp;
 
   if (symrepr_is_error(dec_sym(lisp))) return lisp;
 
-  while (type_of(curr) == PTR_TYPE_CONS) {
+  // The rest of the program is kept in the context, where the
+  // collector can find (and move) it.
+  while (type_of(ctx->program) == PTR_TYPE_CONS) {
     if (ctx->K.sp > 0) {
       stack_clear(&ctx->K); // clear stack if garbage left from failed previous evaluation
     }
-    ctx->curr_exp = car(curr);
+    ctx->curr_exp = car(ctx->program);
     ctx->curr_env = NIL;
     res =  run_eval(ctx);
-    curr = cdr(curr);
+    ctx->program = cdr(ctx->program);
   }
   return res;
 }
@@ -666,11 +1057,18 @@ int eval_cps_init(unsigned int initial_stack_size, bool grow_continuation_stack)
   NONSENSE = enc_sym(symrepr_nonsense());
 
   eval_cps_global_env = NIL;
+  special_defined = false;
 
-  eval_context = (eval_context_t*)malloc(sizeof(eval_context_t));
+  eval_context = (eval_context_t*)mem_malloc(MEM_EVAL, sizeof(eval_context_t));
+  eval_context->program = NIL;
+  eval_context->curr_exp = NIL;
+  eval_context->curr_env = NIL;
+  eval_context->scope = false;
+  eval_context->next = NULL;
 
   /* TODO: There should be an eval_context_create function */
   res = stack_allocate(&(eval_context->K), initial_stack_size, grow_continuation_stack);
+  heap_set_aux_scanner(scan_contexts);
 
   VALUE nil_entry = cons(NIL, NIL);
   eval_cps_global_env = cons(nil_entry, eval_cps_global_env);
@@ -683,5 +1081,5 @@ int eval_cps_init(unsigned int initial_stack_size, bool grow_continuation_stack)
 
 void eval_cps_del(void) {
   stack_free(&eval_context->K);
-  free(eval_context);
+  mem_free(eval_context);
 }
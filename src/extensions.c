@@ -23,6 +23,7 @@
 #include "symrepr.h"
 #include "heap.h"
 #include "extensions.h"
+#include "mem.h"
 
 typedef struct s_extension_function{
   VALUE sym;
@@ -45,11 +46,13 @@ extension_fptr extensions_lookup(UINT sym) {
 
 bool extensions_add(char *sym_str, extension_fptr ext) {
   VALUE symbol;
-  int res = symrepr_addsym(sym_str, &symbol);
+  // The symbol may already exist, in a symbol table loaded from an image.
+  int res = symrepr_lookup(sym_str, &symbol);
+  if (!res) res = symrepr_addsym(sym_str, &symbol);
 
   if (!res) return false;
 
-  extension_function_t *extension = malloc(sizeof(extension_function_t));
+  extension_function_t *extension = mem_malloc(MEM_EXTENSIONS, sizeof(extension_function_t));
 
   if (!extension) return false;
 
@@ -66,7 +69,7 @@ void extensions_del(void) {
   while (curr) {
     t = curr;
     curr = curr->next;
-    free(t);
+    mem_free(t);
   }
   extensions = NULL;
 }
@@ -25,9 +25,6 @@
 
 static UINT as_i(UINT a) {
 
-  UINT tmp;
-  FLOAT f_tmp;
-
   switch (type_of(a)) {
   case VAL_TYPE_I:
     return dec_i(a);
@@ -36,19 +33,15 @@ static UINT as_i(UINT a) {
   case PTR_TYPE_BOXED_I:
   case PTR_TYPE_BOXED_U:
     return (INT)car(a);
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
-    tmp = car(a);
-    memcpy(&f_tmp, &tmp, sizeof(FLOAT));
-    return (INT)f_tmp;
+    return (INT)dec_f(a);
   }
   return 0;
 }
 
 static UINT as_u(UINT a) {
 
-  UINT tmp;
-  FLOAT f_tmp;
-
   switch (type_of(a)) {
   case VAL_TYPE_I:
     return (UINT) dec_i(a);
@@ -57,18 +50,14 @@ static UINT as_u(UINT a) {
   case PTR_TYPE_BOXED_I:
   case PTR_TYPE_BOXED_U:
     return (UINT)car(a);
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
-    tmp = car(a);
-    memcpy(&f_tmp, &tmp, sizeof(FLOAT));
-    return (UINT)f_tmp;
+    return (UINT)dec_f(a);
   }
   return 0;
 }
 
-static UINT as_f(UINT a) {
-
-  UINT tmp;
-  FLOAT f_tmp;
+static FLOAT as_f(UINT a) {
 
   switch (type_of(a)) {
   case VAL_TYPE_I:
@@ -78,10 +67,27 @@ static UINT as_f(UINT a) {
   case PTR_TYPE_BOXED_I:
   case PTR_TYPE_BOXED_U:
     return (FLOAT)car(a);
+  case VAL_TYPE_FLOAT:
+  case PTR_TYPE_BOXED_F:
+    return dec_f(a);
+  }
+  return 0;
+}
+
+static int num_rank(UINT a) {
+
+  switch (type_of(a)) {
+  case VAL_TYPE_I:
+    return 1;
+  case VAL_TYPE_U:
+    return 2;
+  case PTR_TYPE_BOXED_I:
+    return 3;
+  case PTR_TYPE_BOXED_U:
+    return 4;
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
-    tmp = car(a);
-    memcpy(&f_tmp, &tmp, sizeof(FLOAT));
-    return f_tmp;
+    return 5;
   }
   return 0;
 }
@@ -98,7 +104,7 @@ static UINT add2(UINT a, UINT b) {
   FLOAT f0;
   FLOAT f1;
 
-  if (type_of(a) < type_of(b)) {
+  if (num_rank(a) < num_rank(b)) {
     t_min = a;
     t_max = b;
   } else {
@@ -131,12 +137,13 @@ static UINT add2(UINT a, UINT b) {
     i1 = as_i(t_min);
     retval = enc_I(i0 + i1); //cons(i0+i1, enc_sym(DEF_REPR_BOXED_I_TYPE));
     break;
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
     f0 = dec_f(t_max);
     f1 = as_f(t_min);
     f0 = f0 + f1;
     //memcpy(&retval, &f0, sizeof(FLOAT));
-    retval = enc_F(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
+    retval = enc_f(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
     break;
   }
   return retval;
@@ -154,7 +161,7 @@ static UINT mul2(UINT a, UINT b) {
   FLOAT f0;
   FLOAT f1;
 
-  if (type_of(a) < type_of(b)) {
+  if (num_rank(a) < num_rank(b)) {
     t_min = a;
     t_max = b;
   } else {
@@ -185,12 +192,13 @@ static UINT mul2(UINT a, UINT b) {
     i1 = as_i(t_min);
     retval = enc_I(i0 * i1); //cons(i0+i1, enc_sym(DEF_REPR_BOXED_I_TYPE));
     break;
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
     f0 = dec_f(t_max);
     f1 = as_f(t_min);
     f0 = f0 * f1;
     //memcpy(&retval, &f0, sizeof(FLOAT));
-    retval = enc_F(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
+    retval = enc_f(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
     break;
   }
   return retval;
@@ -208,7 +216,7 @@ static UINT div2(UINT a, UINT b) {
   FLOAT f0;
   FLOAT f1;
 
-  if (type_of(a) < type_of(b)) {
+  if (num_rank(a) < num_rank(b)) {
     t_min = a;
     t_max = b;
   } else {
@@ -243,13 +251,14 @@ static UINT div2(UINT a, UINT b) {
     if (i1 == 0) return enc_sym(symrepr_divzero());
     retval = enc_I(i0 / i1); //cons(i0+i1, enc_sym(DEF_REPR_BOXED_I_TYPE));
     break;
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
     f0 = dec_f(t_max);
     f1 = as_f(t_min);
     if (f1 == 0) return enc_sym(symrepr_divzero());
     f0 = f0 / f1;
     //memcpy(&retval, &f0, sizeof(FLOAT));
-    retval = enc_F(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
+    retval = enc_f(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
     break;
   }
   return retval;
@@ -265,7 +274,7 @@ static UINT mod2(UINT a, UINT b) {
   UINT u0;
   UINT u1;
 
-  if (type_of(a) < type_of(b)) {
+  if (num_rank(a) < num_rank(b)) {
     t_min = a;
     t_max = b;
   } else {
@@ -300,6 +309,7 @@ static UINT mod2(UINT a, UINT b) {
     if (i1 == 0) return enc_sym(symrepr_divzero());
     retval = enc_I(i0 % i1); 
     break;
+  case VAL_TYPE_FLOAT:
   case PTR_TYPE_BOXED_F:
     retval = enc_sym(symrepr_terror());
     break;
@@ -314,7 +324,7 @@ static UINT negate(UINT a) {
   UINT u0;
   FLOAT f0;
 
-  if (type_of(a) > VAL_TYPE_CHAR) {
+  if (is_number(a)) {
     switch (type_of(a)) {
     case VAL_TYPE_I:
       i0 = dec_i(a);
@@ -332,11 +342,12 @@ static UINT negate(UINT a) {
       i0 = dec_I(a);
       retval = enc_I(-i0); //cons(-i0, enc_sym(DEF_REPR_BOXED_I_TYPE));
       break;
+    case VAL_TYPE_FLOAT:
     case PTR_TYPE_BOXED_F:
       f0 = dec_f(a);
       f0 = -f0;
       //memcpy(&retval, &f0, sizeof(FLOAT));
-      retval = enc_F(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
+      retval = enc_f(f0); //cons(retval, enc_sym(DEF_REPR_BOXED_F_TYPE));
       break;
     }
   }
@@ -355,7 +366,7 @@ static UINT sub2(UINT a, UINT b) {
   FLOAT f0;
   FLOAT f1;
 
-  if (type_of(a) < type_of(b)) {
+  if (num_rank(a) < num_rank(b)) {
     t_min = a;
     t_max = b;
   } else {
@@ -363,7 +374,7 @@ static UINT sub2(UINT a, UINT b) {
     t_max = a;
   }
 
-  if (type_of(t_min) > VAL_TYPE_CHAR) {
+  if (is_number(t_min)) {
     switch (type_of(t_max)) {
     case VAL_TYPE_I:
       i0 = dec_i(t_max);
@@ -385,11 +396,12 @@ static UINT sub2(UINT a, UINT b) {
       i1 = as_u(t_min);
       retval = enc_I(i0 - i1);
       break;
+    case VAL_TYPE_FLOAT:
     case PTR_TYPE_BOXED_F:
       f0 = dec_f(t_max);
       f1 = as_f(t_min);
       f0 = f0 - f1;
-      retval = enc_F(f0);
+      retval = enc_f(f0);
       break;
     }
   }
@@ -440,6 +452,8 @@ static bool struct_eq(VALUE a, VALUE b) {
 	return (dec_u(a) == dec_u(b));
       case VAL_TYPE_CHAR:
 	return (dec_char(a) == dec_char(b));
+      case VAL_TYPE_FLOAT:
+	return (dec_f(a) == dec_f(b));
       default:
 	return false;
 	break;
@@ -460,7 +474,7 @@ static bool struct_eq(VALUE a, VALUE b) {
       case PTR_TYPE_BOXED_U:
 	return (car(a) == car(b));
       case PTR_TYPE_BOXED_F:
-	return ((FLOAT)car(a) == (FLOAT)car(b));
+	return (dec_f(a) == dec_f(b));
       case PTR_TYPE_ARRAY:
 	return array_equality(a, b);
       default:
@@ -499,14 +513,14 @@ static int compare(UINT a, UINT b) {
   FLOAT f1;
   bool swapped = false;
 
-  if (type_of(a) < type_of(b)) {
+  if (num_rank(a) < num_rank(b)) {
     tmp = a;
     a   = b;
     b   = tmp;
     swapped = true;
   }
 
-  if (type_of(b) > VAL_TYPE_CHAR) {
+  if (is_number(b)) {
     switch (type_of(a)) {
     case VAL_TYPE_I:
       i0 = dec_i(a);
@@ -528,6 +542,7 @@ static int compare(UINT a, UINT b) {
       i1 = as_u(b);
       retval = cmpi(i0,i1,swapped);
       break;
+    case VAL_TYPE_FLOAT:
     case PTR_TYPE_BOXED_F:
       f0 = dec_f(a);
       f1 = as_f(b);
@@ -607,9 +622,7 @@ void array_read(VALUE *args, UINT nargs, UINT *result) {
       *result = set_ptr_type(*result, PTR_TYPE_BOXED_I);
       break;
     case PTR_TYPE_BOXED_F:
-      *result = cons(array->data.f[ix], enc_sym(DEF_REPR_BOXED_F_TYPE));
-      if (type_of(*result) == VAL_TYPE_SYMBOL) return;
-      *result = set_ptr_type(*result, PTR_TYPE_BOXED_F);
+      *result = enc_f(array->data.f[ix]);
       break;
     default:
       *result = enc_sym(symrepr_eerror());
@@ -625,8 +638,6 @@ void array_write(VALUE *args, UINT nargs, UINT *result) {
   VALUE arr = args[0];
   VALUE index = args[1];
   VALUE val = args[2];
-  UINT uv;
-  FLOAT v;
   UINT ix;
   INT tmp;
   switch (type_of(index)) {
@@ -660,7 +671,8 @@ void array_write(VALUE *args, UINT nargs, UINT *result) {
   if (type_of(arr) == PTR_TYPE_ARRAY) {
     array_t *array = (array_t*)car(arr);
 
-    if (type_of(val) != array->elt_type ||
+    UINT val_t = type_of(val) == VAL_TYPE_FLOAT ? PTR_TYPE_BOXED_F : type_of(val);
+    if (val_t != array->elt_type ||
 	ix >= array->size) {
       *result =  enc_sym(symrepr_nil());
       return;
@@ -683,9 +695,7 @@ void array_write(VALUE *args, UINT nargs, UINT *result) {
       array->data.i[ix] = dec_I(val);
       break;
     case PTR_TYPE_BOXED_F:
-      uv = car(val);
-      memcpy(&v, &uv, sizeof(FLOAT));
-      array->data.f[ix] = v;
+      array->data.f[ix] = dec_f(val);
       break;
     default:
       *result = enc_sym(symrepr_eerror());
@@ -719,6 +729,30 @@ VALUE index_list(VALUE l, int n) {
 
 }
 
+// The largest number of cells fundamental_exec can allocate, so
+// that the evaluator can make sure they are free before it starts.
+// Arithmetic may box every intermediate result.
+unsigned int fundamental_cells(VALUE* args, UINT nargs, VALUE op) {
+
+  switch (dec_sym(op)) {
+  case SYM_CONS:
+  case SYM_ARRAY_READ:
+  case SYM_ARRAY_CREATE:
+    return 1;
+  case SYM_LIST:
+  case SYM_ADD:
+  case SYM_SUB:
+  case SYM_MUL:
+  case SYM_DIV:
+  case SYM_MOD:
+    return nargs;
+  case SYM_APPEND:
+    return nargs == 2 ? length(args[0]) : 0;
+  default:
+    return 0;
+  }
+}
+
 VALUE fundamental_exec(VALUE* args, UINT nargs, VALUE op) {
 
   UINT result = enc_sym(symrepr_eerror());
@@ -743,11 +777,11 @@ VALUE fundamental_exec(VALUE* args, UINT nargs, VALUE op) {
     break;
   }
   case SYM_LIST: {
-    result = enc_sym(symrepr_nil());
-    for (UINT i = 1; i <= nargs; i ++) {
-      result = cons(args[nargs-i], result);
-      if (type_of(result) == VAL_TYPE_SYMBOL)
-	break;
+    result = heap_allocate_list(nargs);
+    VALUE curr = result;
+    for (UINT i = 0; i < nargs && is_ptr(curr); i ++) {
+      set_car(curr, args[i]);
+      curr = cdr(curr);
     }
     break;
   }
@@ -757,21 +791,23 @@ VALUE fundamental_exec(VALUE* args, UINT nargs, VALUE op) {
     VALUE a = args[0];
     VALUE b = args[1];
     
-    result = b;
-    VALUE curr = a;
-    int n = 0;
-    while (type_of(curr) == PTR_TYPE_CONS) {
-      n++;
-      curr = cdr(curr);
+    unsigned int n = length(a);
+    if (n == 0) {
+      result = b;
+      break;
     }
 
-    for (int i = n-1; i >= 0; i --) {
-      result = cons(index_list(a,i), result);
-      if (type_of(result) == VAL_TYPE_SYMBOL)
-	break;
+    // Built with heap_list_append so that the copy of a can be
+    // cdr-coded and b is attached without a set_cdr.
+    heap_list_t l;
+    heap_list_init(&l);
+    bool ok = true;
+    for (VALUE curr = a; ok && type_of(curr) == PTR_TYPE_CONS; curr = cdr(curr)) {
+      ok = heap_list_append(&l, car(curr));
     }
+    result = ok ? heap_list_finish(&l, b) : enc_sym(symrepr_merror());
     break;
-  } 
+  }
   case SYM_ADD: {
     UINT sum = args[0];
     for (UINT i = 1; i < nargs; i ++) {
@@ -918,6 +954,7 @@ VALUE fundamental_exec(VALUE* args, UINT nargs, VALUE op) {
       return enc_sym(symrepr_type_i32());
     case PTR_TYPE_BOXED_U:
       return enc_sym(symrepr_type_u32());
+    case VAL_TYPE_FLOAT:
     case PTR_TYPE_BOXED_F:
       return enc_sym(symrepr_type_float());
     case VAL_TYPE_I:
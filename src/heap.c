@@ -19,19 +19,32 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "heap.h"
 #include "symrepr.h"
 #include "stack.h"
-#ifdef VISUALIZE_HEAP
-#include "heap_vis.h"
+#include "mem.h"
+#include "heap_trace.h"
+#if defined(GC_PARALLEL_MARK) || defined(GC_BACKGROUND_SWEEP)
+#include <pthread.h>
+#include <sched.h>
 #endif
 
 static heap_state_t heap_state;
+static heap_stats_t heap_stats;
+static bool gc_cycle_timed = false;      // Start of the last collection, for the allocation rate.
+static uint32_t gc_cycle_time;
+static uint64_t gc_cycle_alloc;
 
 static VALUE        NIL;
 static VALUE        RECOVERED;
 
+static int gc_lazy_sweep_finish(void);
+static int gc_lazy_sweep(void);
+static int gc_bg_sweep_finish(void);
+static void gc_grow_policy(void);
+
 // ref_cell: returns a reference to the cell addressed by bits 3 - 26
 //           Assumes user has checked that is_ptr was set
 cons_t* ref_cell(VALUE addr) {
@@ -55,19 +68,161 @@ static void set_cdr_(cons_t *cell, VALUE v) {
   cell->cdr = v;
 }
 
+// GC marks are kept in a bitmap on the side, one bit per cell.
+#define GC_BITS_PER_WORD     (sizeof(UINT) * 8)
+#define GC_BITS_WORDS(n)     (((n) + GC_BITS_PER_WORD - 1) / GC_BITS_PER_WORD)
+#define GC_BITS_ALL          (~(UINT)0)
+
+// An array is a single block, a header followed by the array_t and
+// its data. In the arena the header tells which cell refers to the
+// array so that the cell can be updated when the array is moved.
+typedef struct {
+  UINT owner;               // Index of the cell, ARENA_FREE if the array is dead
+  UINT size;                // Size of the block in bytes
+} arena_block_t;
+
+#define ARENA_FREE           (~(UINT)0)
+#define ARENA_ALIGN(n)       (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+#define ARENA_ARRAY_OFFSET   ARENA_ALIGN(sizeof(arena_block_t))
+#define ARENA_DATA_OFFSET    ARENA_ALIGN(sizeof(array_t))
+
 static void set_gc_mark(cons_t *cell) {
-  VALUE cdr = read_cdr(cell);
-  set_cdr_(cell, val_set_gc_mark(cdr));
+  UINT ix = (UINT)(cell - heap_state.heap);
+  heap_state.gc_bits[ix / GC_BITS_PER_WORD] |= ((UINT)1 << (ix % GC_BITS_PER_WORD));
 }
 
 static void clr_gc_mark(cons_t *cell) {
-  VALUE cdr = read_cdr(cell);
-  set_cdr_(cell, val_clr_gc_mark(cdr));
+  UINT ix = (UINT)(cell - heap_state.heap);
+  heap_state.gc_bits[ix / GC_BITS_PER_WORD] &= ~((UINT)1 << (ix % GC_BITS_PER_WORD));
 }
 
 static bool get_gc_mark(cons_t* cell) {
-  VALUE cdr = read_cdr(cell);
-  return val_get_gc_mark(cdr);
+  UINT ix = (UINT)(cell - heap_state.heap);
+  return heap_state.gc_bits[ix / GC_BITS_PER_WORD] & ((UINT)1 << (ix % GC_BITS_PER_WORD));
+}
+
+// Cdr-coded cells are kept in a second bitmap, see heap.h.
+static bool gc_cdr_coded(UINT ix) {
+  return (heap_state.cdr_bits &&
+	  (heap_state.cdr_bits[ix / GC_BITS_PER_WORD] & ((UINT)1 << (ix % GC_BITS_PER_WORD))));
+}
+
+static void set_cdr_coded(UINT ix) {
+  heap_state.cdr_bits[ix / GC_BITS_PER_WORD] |= ((UINT)1 << (ix % GC_BITS_PER_WORD));
+}
+
+static void clr_cdr_coded(UINT ix) {
+  if (heap_state.cdr_bits) {
+    heap_state.cdr_bits[ix / GC_BITS_PER_WORD] &= ~((UINT)1 << (ix % GC_BITS_PER_WORD));
+  }
+}
+
+static bool is_invisible(VALUE v) {
+  return is_ptr(v) && ptr_type(v) == PTR_TYPE_INVISIBLE;
+}
+
+// The cell after a cdr-coded cell is the cdr of its second element,
+// unless set_cdr has replaced it.
+static VALUE gc_cdr_link(UINT ix) {
+  if (!gc_cdr_coded(ix) || is_invisible(heap_state.heap[ix].cdr)) return NIL;
+  return enc_cons_ptr(ix + 1);
+}
+
+// Cells allocated in the open scope, see heap_scope_open.
+static bool gc_in_scope(UINT ix) {
+  return heap_state.scope_bits[ix / GC_BITS_PER_WORD] & ((UINT)1 << (ix % GC_BITS_PER_WORD));
+}
+
+static void gc_scope_clr(UINT ix) {
+  heap_state.scope_bits[ix / GC_BITS_PER_WORD] &= ~((UINT)1 << (ix % GC_BITS_PER_WORD));
+}
+
+static void gc_scope_add(UINT ix) {
+  if (heap_state.scope_num < heap_state.scope_size) {
+    heap_state.scope_log[heap_state.scope_num++] = ix;
+    heap_state.scope_bits[ix / GC_BITS_PER_WORD] |= ((UINT)1 << (ix % GC_BITS_PER_WORD));
+  } else {
+    heap_state.scope_keep = true;
+  }
+}
+
+// Cells of the frozen segment are always marked.
+#define GC_FROZEN_WORDS      (heap_state.frozen / GC_BITS_PER_WORD)
+
+static void gc_clear_marks(void) {
+  unsigned int fw = GC_FROZEN_WORDS;
+  memset(&heap_state.gc_bits[fw], 0, (heap_state.gc_bits_size - fw) * sizeof(UINT));
+}
+
+static bool is_heap_ptr(VALUE v) {
+  if (!is_ptr(v)) return false;
+  TYPE t = ptr_type(v);
+  return (t == PTR_TYPE_CONS ||
+	  t == PTR_TYPE_BOXED_I ||
+	  t == PTR_TYPE_BOXED_U ||
+	  t == PTR_TYPE_BOXED_F ||
+	  t == PTR_TYPE_ARRAY ||
+	  t == PTR_TYPE_INVISIBLE);
+}
+
+// A frozen cell that is written is a root from then on. Writes are
+// recorded in a card table, one bit per word of the mark bitmap.
+static bool gc_card_dirty(unsigned int w) {
+  return heap_state.frozen_cards[w / GC_BITS_PER_WORD] & ((UINT)1 << (w % GC_BITS_PER_WORD));
+}
+
+static void gc_card_set(unsigned int w) {
+  heap_state.frozen_cards[w / GC_BITS_PER_WORD] |= ((UINT)1 << (w % GC_BITS_PER_WORD));
+}
+
+// Generational mode keeps the GC mark set on old cells between
+// collections. A cell that is unmarked is young. The write
+// barrier records old cells that are made to point at young cells so
+// that a minor collection can treat them as roots.
+static void gc_write_barrier(VALUE c, cons_t *cell, VALUE v) {
+  if (heap_state.scope_open && is_heap_ptr(v) &&
+      gc_in_scope(dec_ptr(v)) && !gc_in_scope(dec_ptr(c))) {
+    heap_state.scope_keep = true;
+  }
+
+  if (dec_ptr(c) < heap_state.frozen && is_heap_ptr(v)) {
+    gc_card_set(dec_ptr(c) / GC_BITS_PER_WORD);
+  }
+
+  if (!heap_state.nursery_size) return;
+
+  if (get_gc_mark(cell) &&
+      is_heap_ptr(v) &&
+      !get_gc_mark(ref_cell(v))) {
+    UINT ix = dec_ptr(c);
+    if (heap_state.num_remembered > 0 &&
+	heap_state.remembered[heap_state.num_remembered-1] == ix) {
+      return;
+    }
+    if (heap_state.num_remembered < heap_state.remembered_size) {
+      heap_state.remembered[heap_state.num_remembered++] = ix;
+    } else {
+      heap_state.remembered_overflow = true;
+    }
+  }
+}
+
+#define GC_FROZEN_CARD_WORDS(n) GC_BITS_WORDS((n) / GC_BITS_PER_WORD)
+
+// Cells below frozen, a multiple of the bits per word, are left out
+// of marking and sweeping. All cards are clean.
+static int gc_set_frozen(unsigned int frozen) {
+
+  UINT *cards = NULL;
+  if (frozen > 0) {
+    cards = (UINT *)mem_calloc(MEM_HEAP, GC_FROZEN_CARD_WORDS(frozen), sizeof(UINT));
+    if (!cards) return 0;
+  }
+  if (heap_state.frozen_cards) mem_free(heap_state.frozen_cards);
+  heap_state.frozen_cards = cards;
+  heap_state.frozen = frozen;
+  memset(heap_state.gc_bits, 0xFF, GC_FROZEN_WORDS * sizeof(UINT));
+  return 1;
 }
 
 int generate_freelist(size_t num_cells) {
@@ -89,67 +244,248 @@ int generate_freelist(size_t num_cells) {
   // Replace the incorrect pointer at the last cell.
   t = ref_cell(enc_cons_ptr(num_cells-1));
   set_cdr_(t, NIL);
+  heap_state.freelist_length = (unsigned int)num_cells;
 
   return 1;
 }
 
-static void heap_init_state(cons_t *addr, unsigned int num_cells, bool malloced) {
+static void heap_init_state(cons_t *addr, unsigned int num_cells, UINT *gc_bits, bool malloced) {
   heap_state.heap         = addr;
-  heap_state.heap_bytes   = (unsigned int)(num_cells * sizeof(cons_t));
+  heap_state.heap_bytes   = num_cells * sizeof(cons_t);
   heap_state.heap_size    = num_cells;
   heap_state.malloced = malloced;
 
+  heap_state.gc_bits      = gc_bits;
+  heap_state.gc_bits_size = (unsigned int)GC_BITS_WORDS(num_cells);
+  heap_state.gc_bits_malloced = malloced;
+  heap_state.frozen       = 0;
+  heap_state.frozen_cards = NULL;
+  gc_clear_marks();
+
   heap_state.num_alloc           = 0;
   heap_state.num_alloc_arrays    = 0;
   heap_state.gc_num              = 0;
   heap_state.gc_marked           = 0;
   heap_state.gc_recovered        = 0;
   heap_state.gc_recovered_arrays = 0;
+
+  heap_state.nursery_size        = 0;
+  heap_state.young               = NULL;
+  heap_state.num_young           = 0;
+  heap_state.young_overflow      = 0;
+  heap_state.remembered          = NULL;
+  heap_state.remembered_size     = 0;
+  heap_state.num_remembered      = 0;
+  heap_state.remembered_overflow = false;
+  heap_state.gc_num_minor        = 0;
+
+  heap_state.gc_budget           = 0;
+  heap_state.gc_inc_start        = 0;
+  heap_state.gc_inc_phase        = GC_INC_IDLE;
+  heap_state.gc_inc_freelist     = enc_sym(symrepr_nil());
+  heap_state.gc_inc_stack        = NULL;
+  heap_state.gc_inc_sp           = 0;
+  heap_state.gc_inc_overflow     = false;
+  heap_state.gc_inc_rescan       = num_cells;
+  heap_state.gc_inc_sweep        = 0;
+  heap_state.gc_inc_max_work     = 0;
+
+  heap_state.lazy_sweep          = false;
+  heap_state.bg_sweep            = false;
+  heap_state.gc_lazy_sweep       = heap_state.gc_bits_size;
+
+  heap_state.compacting          = false;
+  heap_state.bump                = num_cells;
+  heap_state.gc_fwd              = NULL;
+
+  heap_state.arena               = NULL;
+  heap_state.arena_size          = 0;
+  heap_state.arena_top           = 0;
+  heap_state.arena_free          = 0;
+  heap_state.arena_malloced      = false;
+
+  heap_state.region_size         = 0;
+  heap_state.min_size            = num_cells;
+  heap_state.max_size            = num_cells;
+  heap_state.num_regions         = 1;
+  heap_state.grow_threshold      = 100;
+  heap_state.release_regions     = false;
+
+  heap_state.gc_threads          = 0;
+
+  heap_state.gc_watermark        = 0;
+  heap_state.gc_watermark_skip   = 0;
+
+  heap_state.cdr_coding          = false;
+  heap_state.cdr_bits            = NULL;
+
+  heap_state.scope_size          = 0;
+  heap_state.scope_log           = NULL;
+  heap_state.scope_num           = 0;
+  heap_state.scope_bits          = NULL;
+  heap_state.scope_open          = false;
+  heap_state.scope_keep          = false;
+  heap_state.scope_gc            = 0;
+  heap_state.scope_young         = 0;
+
+  heap_state.freelist_length     = 0;
+  memset(&heap_stats, 0, sizeof(heap_stats_t));
+  gc_cycle_timed = false;
 }
 
+// All num_cells cells of the memory area are heap cells, the mark
+// bitmap is allocated separately.
 int heap_init_addr(cons_t *addr, unsigned int num_cells) {
 
   NIL = enc_sym(symrepr_nil());
   RECOVERED = enc_sym(DEF_REPR_RECOVERED);
 
-  heap_init_state(addr, num_cells, false);
-  
+  UINT *gc_bits = (UINT *)mem_malloc(MEM_HEAP, GC_BITS_WORDS(num_cells) * sizeof(UINT));
+  if (!gc_bits) return 0;
+
+  heap_init_state(addr, num_cells, gc_bits, false);
+  heap_state.gc_bits_malloced = true;
+
   return generate_freelist(num_cells);  
 }
 
+// Take over the cells of a heap image. The cells are not owned by
+// the heap and the free list, bump pointer and number of allocated
+// cells are as they were when the image was made.
+int heap_init_image(cons_t *addr, unsigned int num_cells, UINT *gc_bits, VALUE freelist, unsigned int num_alloc, unsigned int bump, unsigned int frozen, UINT *frozen_cards, UINT *cdr_bits) {
+
+  NIL = enc_sym(symrepr_nil());
+  RECOVERED = enc_sym(DEF_REPR_RECOVERED);
+
+  if (num_alloc > num_cells || bump > num_cells ||
+      frozen > bump || frozen % GC_BITS_PER_WORD != 0) return 0;
+
+  heap_init_state(addr, num_cells, gc_bits, false);
+  heap_state.freelist  = freelist;
+  heap_state.num_alloc = num_alloc;
+  heap_state.bump      = bump;
+
+  for (VALUE c = freelist; is_ptr(c) && dec_ptr(c) < num_cells; c = read_cdr(ref_cell(c))) {
+    heap_state.freelist_length ++;
+  }
+
+  if (!gc_set_frozen(frozen)) return 0;
+  if (frozen_cards && frozen) {
+    memcpy(heap_state.frozen_cards, frozen_cards, GC_FROZEN_CARD_WORDS(frozen) * sizeof(UINT));
+  }
+  if (cdr_bits) {
+    heap_state.cdr_bits = (UINT *)mem_malloc(MEM_HEAP, heap_state.gc_bits_size * sizeof(UINT));
+    if (!heap_state.cdr_bits) return 0;
+    memcpy(heap_state.cdr_bits, cdr_bits, heap_state.gc_bits_size * sizeof(UINT));
+  }
+  return 1;
+}
+
 int heap_init(unsigned int num_cells) {
 
   NIL = enc_sym(symrepr_nil());
   RECOVERED = enc_sym(DEF_REPR_RECOVERED);
 
-  cons_t *heap = (cons_t *)malloc(num_cells * sizeof(cons_t));
+  cons_t *heap = (cons_t *)mem_malloc(MEM_HEAP, num_cells * sizeof(cons_t));
+  UINT *gc_bits = (UINT *)mem_malloc(MEM_HEAP, GC_BITS_WORDS(num_cells) * sizeof(UINT));
 
-  if (!heap) return 0;
-  heap_init_state(heap, num_cells, true);
+  if (!heap || !gc_bits) {
+    if (heap) mem_free(heap);
+    if (gc_bits) mem_free(gc_bits);
+    return 0;
+  }
+  heap_init_state(heap, num_cells, gc_bits, true);
 
   return generate_freelist(num_cells); 
 }
   
 void heap_del(void) {
-  if (heap_state.heap && heap_state.malloced)
-    free(heap_state.heap);
+  heap_set_background_sweep(false);
+  if (heap_state.heap && heap_state.malloced) {
+    mem_free(heap_state.heap);
+  }
+  if (heap_state.gc_bits && heap_state.gc_bits_malloced) {
+    mem_free(heap_state.gc_bits);
+  }
+  if (heap_state.young) mem_free(heap_state.young);
+  if (heap_state.remembered) mem_free(heap_state.remembered);
+  if (heap_state.gc_inc_stack) mem_free(heap_state.gc_inc_stack);
+  if (heap_state.gc_fwd) mem_free(heap_state.gc_fwd);
+  if (heap_state.arena && heap_state.arena_malloced) mem_free(heap_state.arena);
+  if (heap_state.frozen_cards) mem_free(heap_state.frozen_cards);
+  if (heap_state.cdr_bits) mem_free(heap_state.cdr_bits);
+  heap_set_scope_size(0);
+  heap_set_gc_threads(0);
+  heap_state.young = NULL;
+  heap_state.remembered = NULL;
+  heap_state.nursery_size = 0;
+  heap_state.gc_inc_stack = NULL;
+  heap_state.gc_budget = 0;
+  heap_state.gc_inc_phase = GC_INC_IDLE;
+  heap_state.gc_fwd = NULL;
+  heap_state.compacting = false;
+  heap_state.arena = NULL;
+  heap_state.frozen = 0;
+  heap_state.frozen_cards = NULL;
+  heap_state.cdr_coding = false;
+  heap_state.cdr_bits = NULL;
 }
 
-unsigned int heap_num_free(void) {
-
-  unsigned int count = 0;
-  VALUE curr = heap_state.freelist;
-
-  while (type_of(curr) == PTR_TYPE_CONS) {
-    curr = read_cdr(ref_cell(curr));
-    count++;
+// Enable generational collection with a nursery of num_cells cells.
+// All cells currently in the heap are treated as old (and are only
+// reclaimed by the next major collection). A minor collection only
+// sweeps the young cells, but it still marks from all the roots,
+// the evaluation stack included, as well as the remembered set.
+// num_cells = 0 disables generational collection.
+int heap_set_nursery_size(unsigned int num_cells) {
+
+  if (!heap_state.heap || heap_state.gc_budget || heap_state.compacting) return 0;
+
+  if (!gc_lazy_sweep_finish()) return 0;
+
+  if (heap_state.young) mem_free(heap_state.young);
+  if (heap_state.remembered) mem_free(heap_state.remembered);
+  heap_state.young = NULL;
+  heap_state.remembered = NULL;
+  heap_state.nursery_size = 0;
+  heap_state.num_young = 0;
+  heap_state.young_overflow = 0;
+  heap_state.num_remembered = 0;
+  heap_state.remembered_size = 0;
+  heap_state.remembered_overflow = false;
+
+  if (num_cells == 0) {
+    gc_clear_marks();
+    return 1;
   }
-  // Prudence.
-  if (!(type_of(curr) == VAL_TYPE_SYMBOL) &&
-      curr == NIL){
+
+  unsigned int rem_size = num_cells / 2 + 1;
+  heap_state.young = (UINT*)mem_malloc(MEM_HEAP, num_cells * sizeof(UINT));
+  heap_state.remembered = (UINT*)mem_malloc(MEM_HEAP, rem_size * sizeof(UINT));
+  if (!heap_state.young || !heap_state.remembered) {
+    if (heap_state.young) mem_free(heap_state.young);
+    if (heap_state.remembered) mem_free(heap_state.remembered);
+    heap_state.young = NULL;
+    heap_state.remembered = NULL;
     return 0;
   }
-  return count;
+
+  memset(heap_state.gc_bits, 0xFF, heap_state.gc_bits_size * sizeof(UINT));
+
+  heap_state.remembered_size = rem_size;
+  heap_state.nursery_size = num_cells;
+  return 1;
+}
+
+bool heap_nursery_full(void) {
+  return (heap_state.nursery_size &&
+	  heap_state.num_young >= heap_state.nursery_size);
+}
+
+// Free cells, on the free list, above the bump pointer or not yet
+// swept.
+unsigned int heap_num_free(void) {
+  return heap_state.heap_size - heap_state.num_alloc;
 }
 
 
@@ -157,6 +493,25 @@ VALUE heap_allocate_cell(TYPE ptr_type) {
 
   VALUE res;
 
+  if (!is_ptr(heap_state.freelist) &&
+      heap_state.gc_lazy_sweep < heap_state.gc_bits_size) {
+    if (!gc_lazy_sweep()) return enc_sym(symrepr_fatal_error());
+  }
+
+  // Cells above a compacted heap are handed out in address order.
+  if (!is_ptr(heap_state.freelist) &&
+      heap_state.bump < heap_state.heap_size) {
+    res = enc_cons_ptr(heap_state.bump++);
+    heap_trace(HEAP_TRACE_ALLOC, 0, dec_ptr(res), 0);
+    heap_state.num_alloc++;
+    heap_stats.alloc_total++;
+    set_car_(ref_cell(res), NIL);
+    set_cdr_(ref_cell(res), NIL);
+    clr_cdr_coded(dec_ptr(res));
+    if (heap_state.scope_open) gc_scope_add(dec_ptr(res));
+    return res | ptr_type;
+  }
+
   if (!is_ptr(heap_state.freelist)) {
     // Free list not a ptr (should be Symbol NIL)
     if ((type_of(heap_state.freelist) == VAL_TYPE_SYMBOL) &&
@@ -176,9 +531,18 @@ VALUE heap_allocate_cell(TYPE ptr_type) {
     return enc_sym(symrepr_fatal_error());
   }
 
-  heap_state.freelist = cdr(heap_state.freelist);
+  heap_state.freelist = read_cdr(ref_cell(heap_state.freelist));
+  heap_state.freelist_length--;
 
+  // The part of the free list that the mark phase has not reached
+  // is consumed from the front.
+  if (res == heap_state.gc_inc_freelist) {
+    heap_state.gc_inc_freelist = heap_state.freelist;
+  }
+
+  heap_trace(HEAP_TRACE_ALLOC, 0, dec_ptr(res), 0);
   heap_state.num_alloc++;
+  heap_stats.alloc_total++;
 
   // set some ok initial values (nil . nil)
   set_car_(ref_cell(res), NIL);
@@ -186,11 +550,154 @@ VALUE heap_allocate_cell(TYPE ptr_type) {
 
   // clear GC bit on allocated cell
   clr_gc_mark(ref_cell(res));
+  clr_cdr_coded(dec_ptr(res));
+
+  // Cells allocated during an incremental cycle are black unless
+  // the sweep has already passed them.
+  if (heap_state.gc_inc_phase == GC_INC_MARK ||
+      (heap_state.gc_inc_phase == GC_INC_SWEEP &&
+       dec_ptr(res) >= heap_state.gc_inc_sweep)) {
+    set_gc_mark(ref_cell(res));
+  }
+
+  if (heap_state.nursery_size) {
+    if (heap_state.num_young < heap_state.nursery_size) {
+      heap_state.young[heap_state.num_young++] = dec_ptr(res);
+    } else {
+      // Not tracked by the nursery. Survives until a major collection
+      // unless it is reached (and promoted) by a minor collection.
+      heap_state.young_overflow++;
+    }
+  }
+
+  if (heap_state.scope_open) gc_scope_add(dec_ptr(res));
 
   res = res | ptr_type;
   return res;
 }
 
+// Allocate a list of num_cells (nil . nil) cells, linked through the
+// cdr, or nothing at all if there are not enough free cells. The cells
+// are taken in allocation order and are adjacent whenever the free
+// list (or the bump pointer) is.
+VALUE heap_allocate_cells(unsigned int num_cells) {
+
+  if (num_cells == 0) return NIL;
+  if (heap_state.heap_size - heap_state.num_alloc < num_cells) {
+    return enc_sym(symrepr_merror());
+  }
+
+  VALUE res = heap_allocate_cell(PTR_TYPE_CONS);
+  if (!is_ptr(res)) return res;
+
+  VALUE last = res;
+  for (unsigned int i = 1; i < num_cells; i ++) {
+    VALUE c = heap_allocate_cell(PTR_TYPE_CONS);
+    if (!is_ptr(c)) return enc_sym(symrepr_fatal_error());
+    set_cdr_(ref_cell(last), c);
+    last = c;
+  }
+  return res;
+}
+
+// Lists are built front to back. With CDR-coding a cell holds two
+// elements whenever the cell allocated after it is the next one in
+// memory, otherwise the list is made of ordinary cells. No
+// collection may take place while a list is built.
+void heap_list_init(heap_list_t *l) {
+  l->head = NIL;
+  l->last = NIL;
+  l->pending = false;
+}
+
+bool heap_list_append(heap_list_t *l, VALUE v) {
+
+  if (!is_ptr(l->last)) {
+    VALUE c = cons(v, NIL);
+    if (!is_ptr(c)) return false;
+    l->head = c;
+    l->last = c;
+    return true;
+  }
+
+  cons_t *last = ref_cell(l->last);
+
+  if (!l->pending) {
+    if (heap_state.cdr_coding) {
+      set_cdr_(last, v);
+      l->pending = true;
+      return true;
+    }
+    VALUE c = cons(v, NIL);
+    if (!is_ptr(c)) return false;
+    set_cdr_(last, c);
+    l->last = c;
+    return true;
+  }
+
+  VALUE c = heap_allocate_cell(PTR_TYPE_CONS);
+  if (!is_ptr(c)) return false;
+
+  if (dec_ptr(c) == dec_ptr(l->last) + 1) {
+    set_cdr_coded(dec_ptr(l->last));
+    set_car_(ref_cell(c), v);
+    l->pending = false;
+  } else {
+    // The pending element moves to the new cell.
+    set_car_(ref_cell(c), read_cdr(last));
+    set_cdr_(ref_cell(c), v);
+    set_cdr_(last, c);
+  }
+  l->last = c;
+  return true;
+}
+
+VALUE heap_list_finish(heap_list_t *l, VALUE tail) {
+
+  if (!is_ptr(l->last)) return tail;
+
+  cons_t *last = ref_cell(l->last);
+  if (l->pending) {
+    VALUE c = cons(read_cdr(last), tail);
+    if (!is_ptr(c)) return c;
+    set_cdr_(last, c);
+  } else {
+    set_cdr_(last, tail);
+  }
+  return l->head;
+}
+
+// A list of num_elts nils, to be filled in with set_car. At most
+// num_elts cells are used.
+VALUE heap_allocate_list(unsigned int num_elts) {
+
+  if (heap_state.heap_size - heap_state.num_alloc < num_elts) {
+    return enc_sym(symrepr_merror());
+  }
+
+  heap_list_t l;
+  heap_list_init(&l);
+  for (unsigned int i = 0; i < num_elts; i ++) {
+    if (!heap_list_append(&l, NIL)) return enc_sym(symrepr_fatal_error());
+  }
+  return heap_list_finish(&l, NIL);
+}
+
+// Build lists with cdr-coded cells. The bitmap that tells which
+// cells are cdr-coded is kept when CDR-coding is turned off.
+int heap_set_cdr_coding(bool on) {
+
+  if (!heap_state.heap) return 0;
+  if (!gc_bg_sweep_finish()) return 0;
+
+  if (on && !heap_state.cdr_bits) {
+    heap_state.cdr_bits = (UINT *)mem_calloc(MEM_HEAP, heap_state.gc_bits_size, sizeof(UINT));
+    if (!heap_state.cdr_bits) return 0;
+  }
+  heap_state.cdr_coding = on;
+  return 1;
+}
+
 unsigned int heap_num_allocated(void) {
   return heap_state.num_alloc;
 }
@@ -198,7 +705,7 @@ unsigned int heap_size(void) {
   return heap_state.heap_size;
 }
 
-unsigned int heap_size_bytes(void) {
+size_t heap_size_bytes(void) {
   return heap_state.heap_bytes;
 }
 
@@ -206,274 +713,2180 @@ void heap_get_state(heap_state_t *res) {
   res->heap                = heap_state.heap;
   res->malloced            = heap_state.malloced;
   res->freelist            = heap_state.freelist;
+  res->freelist_length     = heap_state.freelist_length;
   res->heap_size           = heap_state.heap_size;
   res->heap_bytes          = heap_state.heap_bytes;
+  res->gc_bits             = heap_state.gc_bits;
+  res->gc_bits_size        = heap_state.gc_bits_size;
+  res->gc_bits_malloced    = heap_state.gc_bits_malloced;
   res->num_alloc           = heap_state.num_alloc;
   res->num_alloc_arrays    = heap_state.num_alloc_arrays;
   res->gc_num              = heap_state.gc_num;
   res->gc_marked           = heap_state.gc_marked;
   res->gc_recovered        = heap_state.gc_recovered;
   res->gc_recovered_arrays = heap_state.gc_recovered_arrays;
+  res->nursery_size        = heap_state.nursery_size;
+  res->young               = heap_state.young;
+  res->num_young           = heap_state.num_young;
+  res->young_overflow      = heap_state.young_overflow;
+  res->remembered          = heap_state.remembered;
+  res->remembered_size     = heap_state.remembered_size;
+  res->num_remembered      = heap_state.num_remembered;
+  res->remembered_overflow = heap_state.remembered_overflow;
+  res->gc_num_minor        = heap_state.gc_num_minor;
+  res->gc_budget           = heap_state.gc_budget;
+  res->gc_inc_start        = heap_state.gc_inc_start;
+  res->gc_inc_phase        = heap_state.gc_inc_phase;
+  res->gc_inc_freelist     = heap_state.gc_inc_freelist;
+  res->gc_inc_stack        = heap_state.gc_inc_stack;
+  res->gc_inc_sp           = heap_state.gc_inc_sp;
+  res->gc_inc_overflow     = heap_state.gc_inc_overflow;
+  res->gc_inc_rescan       = heap_state.gc_inc_rescan;
+  res->gc_inc_sweep        = heap_state.gc_inc_sweep;
+  res->gc_inc_max_work     = heap_state.gc_inc_max_work;
+  res->lazy_sweep          = heap_state.lazy_sweep;
+  res->bg_sweep            = heap_state.bg_sweep;
+  res->gc_lazy_sweep       = heap_state.gc_lazy_sweep;
+  res->compacting          = heap_state.compacting;
+  res->bump                = heap_state.bump;
+  res->gc_fwd              = heap_state.gc_fwd;
+  res->arena               = heap_state.arena;
+  res->arena_size          = heap_state.arena_size;
+  res->arena_top           = heap_state.arena_top;
+  res->arena_free          = heap_state.arena_free;
+  res->arena_malloced      = heap_state.arena_malloced;
+  res->region_size         = heap_state.region_size;
+  res->min_size            = heap_state.min_size;
+  res->max_size            = heap_state.max_size;
+  res->num_regions         = heap_state.num_regions;
+  res->grow_threshold      = heap_state.grow_threshold;
+  res->release_regions     = heap_state.release_regions;
+  res->gc_threads          = heap_state.gc_threads;
+  res->gc_watermark        = heap_state.gc_watermark;
+  res->gc_watermark_skip   = heap_state.gc_watermark_skip;
+  res->cdr_coding          = heap_state.cdr_coding;
+  res->cdr_bits            = heap_state.cdr_bits;
+  res->scope_size          = heap_state.scope_size;
+  res->scope_log           = heap_state.scope_log;
+  res->scope_num           = heap_state.scope_num;
+  res->scope_bits          = heap_state.scope_bits;
+  res->scope_open          = heap_state.scope_open;
+  res->scope_keep          = heap_state.scope_keep;
+  res->scope_gc            = heap_state.scope_gc;
+  res->scope_young         = heap_state.scope_young;
+  res->frozen              = heap_state.frozen;
+  res->frozen_cards        = heap_state.frozen_cards;
 }
 
-int gc_mark_phase(VALUE env) {
+// Telemetry. Pauses are timed by the collection entry points, the
+// allocation rate is measured between the starts of two collections.
+// Boxed values and arrays are counted as they are marked.
 
-  VALUE stack_storage[1024];
-  stack s;
-  stack_create(&s, stack_storage, 1024);
-  
-  if (!is_ptr(env)) {
-      return 1; // Nothing to mark here
-  }
+typedef struct {
+  unsigned int boxed;
+  unsigned int arrays;
+  unsigned int array_bytes;
+} gc_leaves_t;
 
-  push_u32(&s, env);
+static uint32_t (*gc_timer)(void) = NULL;
+static unsigned int gc_stats_marked = 0;   // Marked cells already attributed to a root set.
+static gc_leaves_t gc_leaves;              // Leaves marked by the current collection.
 
-  while (!stack_is_empty(&s)) {
-    VALUE curr;
-    int res = 1;
-    pop_u32(&s, &curr);
+// usec returns a time in microseconds, it may wrap around.
+void heap_set_timer(uint32_t (*usec)(void)) {
+  gc_timer = usec;
+}
 
-    if (!is_ptr(curr)) {
-      continue;
-    }
-    
-    // Circular object on heap, or visited..
-    if (get_gc_mark(ref_cell(curr))) {
-      continue;
-    }
+static uint32_t gc_time(void) {
+  return gc_timer ? gc_timer() : 0;
+}
 
-    // There is at least a pointer to one cell here. Mark it and add children to stack
-    heap_state.gc_marked ++;
-    
-    set_gc_mark(ref_cell(curr));
-    
-    VALUE t_ptr = type_of(curr);
-    
-    if (t_ptr == PTR_TYPE_BOXED_I ||
-	t_ptr == PTR_TYPE_BOXED_U ||
-	t_ptr == PTR_TYPE_BOXED_F ||
-	t_ptr == PTR_TYPE_ARRAY) {
-      continue;
-    }  
-    res &= push_u32(&s, cdr(curr));
-    res &= push_u32(&s, car(curr));
+static uint32_t gc_pause_begin(uint16_t kind) {
+  heap_trace(HEAP_TRACE_GC_BEGIN, kind, heap_state.num_alloc, heap_state.gc_num + heap_state.gc_num_minor);
+  return gc_time();
+}
+
+static void gc_pause_end(uint32_t start, uint16_t kind) {
+  heap_trace(HEAP_TRACE_GC_END, kind, heap_state.gc_marked, heap_state.gc_recovered);
+  uint32_t now = gc_time();
+  uint32_t us = now - start;
+
+  unsigned int b = 0;
+  while (b < HEAP_PAUSE_BUCKETS - 1 && (us >> b)) b ++;
+  heap_stats.pause_hist[b] ++;
+  heap_stats.num_pauses ++;
+  heap_stats.pause_total += us;
+  if (us > heap_stats.pause_max) heap_stats.pause_max = us;
+}
 
-    if (!res) return 0;
+// A collection starts marking, gc_marked has just been reset. A minor
+// collection followed by a major one is a single collection as far as
+// the allocation rate goes.
+static void gc_stats_cycle(void) {
+  uint32_t now = gc_time();
+  uint64_t n = heap_stats.alloc_total - gc_cycle_alloc;
+  if (!gc_cycle_timed || (n && now != gc_cycle_time)) {
+    if (gc_cycle_timed) {
+      heap_stats.alloc_rate = (unsigned int)(n * 1000000 / (uint32_t)(now - gc_cycle_time));
+    }
+    gc_cycle_timed = true;
+    gc_cycle_time = now;
+    gc_cycle_alloc = heap_stats.alloc_total;
   }
 
-  return 1;
+  memset(heap_stats.marked, 0, sizeof(heap_stats.marked));
+  memset(&gc_leaves, 0, sizeof(gc_leaves_t));
+  gc_stats_marked = 0;
 }
 
-// The free list should be a "proper list"
-// Using a while loop to traverse over the cdrs
-int gc_mark_freelist() {
-
-  VALUE curr;
-  cons_t *t;
-  VALUE fl = heap_state.freelist;
+// Cells marked since the last call were reached from the given roots.
+static void gc_stats_roots(unsigned int set) {
+  heap_stats.marked[set] += heap_state.gc_marked - gc_stats_marked;
+  gc_stats_marked = heap_state.gc_marked;
+}
 
-  if (!is_ptr(fl)) {
-    if (val_type(fl) == VAL_TYPE_SYMBOL &&
-	fl == NIL){
-      return 1; // Nothing to mark here
-    } else {
-      return 0;
-    }
+static void gc_count_leaf(gc_leaves_t *l, VALUE v) {
+  if (type_of(v) == PTR_TYPE_ARRAY) {
+    array_t *arr = (array_t *)ref_cell(v)->car;
+    l->arrays ++;
+    l->array_bytes += (unsigned int)ARENA_DATA_OFFSET + arr->size * heap_array_elt_size(arr->elt_type);
+  } else {
+    l->boxed ++;
   }
+}
 
-  curr = fl;
-  while (is_ptr(curr)){
-     t = ref_cell(curr);
-     set_gc_mark(t);
-     curr = read_cdr(t);
+// A major collection is done and num_alloc is the number of live cells.
+static void gc_stats_live(void) {
+  unsigned int leaves = heap_state.frozen + gc_leaves.boxed + gc_leaves.arrays;
+  heap_stats.live_cons = heap_state.num_alloc > leaves ? heap_state.num_alloc - leaves : 0;
+  heap_stats.live_boxed = gc_leaves.boxed;
+  heap_stats.live_arrays = gc_leaves.arrays;
+  heap_stats.live_array_bytes = gc_leaves.array_bytes;
+}
 
-     heap_state.gc_marked ++;
-  }
+void heap_get_stats(heap_stats_t *res) {
+  *res = heap_stats;
+  res->num_free        = heap_num_free();
+  res->freelist_length = heap_state.freelist_length;
+  res->num_frozen      = heap_state.frozen;
+  res->num_gc          = heap_state.gc_num + heap_state.gc_num_minor;
+  res->num_minor       = heap_state.gc_num_minor;
+}
 
-  return 1;
+// Boxed values and arrays keep raw data in the car.
+static bool gc_raw_car(UINT ix, VALUE cdr) {
+  if (type_of(cdr) != VAL_TYPE_SYMBOL || gc_cdr_coded(ix)) return false;
+  UINT s = dec_sym(cdr);
+  return (s == DEF_REPR_BOXED_I_TYPE ||
+	  s == DEF_REPR_BOXED_U_TYPE ||
+	  s == DEF_REPR_BOXED_F_TYPE ||
+	  s == DEF_REPR_ARRAY_TYPE);
 }
 
-int gc_mark_aux(UINT *aux_data, unsigned int aux_size) {
+// Mark a cell and push it so that its children are marked. If the
+// mark stack is full the children are found by a rescan of the heap.
+static void gc_mark_push(stack *s, VALUE v, bool *overflow) {
+
+  if (!is_ptr(v) || dec_ptr(v) >= heap_state.heap_size) return;
 
-  for (unsigned int i = 0; i < aux_size; i ++) {
-    if (is_ptr(aux_data[i])) {
+  cons_t *cell = ref_cell(v);
+  // Circular object on heap, or visited..
+  if (get_gc_mark(cell)) return;
 
-      TYPE pt_t = ptr_type(aux_data[i]);
-      UINT pt_v = dec_ptr(aux_data[i]);
+  heap_state.gc_marked ++;
+  set_gc_mark(cell);
+
+  TYPE t_ptr = type_of(v);
+  if (t_ptr == PTR_TYPE_BOXED_I ||
+      t_ptr == PTR_TYPE_BOXED_U ||
+      t_ptr == PTR_TYPE_BOXED_F ||
+      t_ptr == PTR_TYPE_ARRAY) {
+    gc_count_leaf(&gc_leaves, v);
+    return;
+  }
+
+  if (!push_u32(s, v)) *overflow = true;
+}
 
-      if ( (pt_t == PTR_TYPE_CONS ||
-	    pt_t == PTR_TYPE_BOXED_I ||
-	    pt_t == PTR_TYPE_BOXED_U ||
-	    pt_t == PTR_TYPE_BOXED_F ||
-	    pt_t == PTR_TYPE_ARRAY ||
-	    pt_t == PTR_TYPE_REF ||
-	    pt_t == PTR_TYPE_STREAM) &&
-	   pt_v < heap_state.heap_size) {
+static void gc_mark_drain(stack *s, bool *overflow) {
+  while (!stack_is_empty(s)) {
+    VALUE curr;
+    pop_u32(s, &curr);
+    cons_t *cell = ref_cell(curr);
+    gc_mark_push(s, gc_cdr_link(dec_ptr(curr)), overflow);
+    gc_mark_push(s, read_cdr(cell), overflow);
+    gc_mark_push(s, read_car(cell), overflow);
+  }
+}
 
-	gc_mark_phase(aux_data[i]);
+static void gc_mark_rescan(stack *s, bool overflow) {
+  while (overflow) {
+    overflow = false;
+    for (unsigned int w = GC_FROZEN_WORDS; w < heap_state.gc_bits_size; w ++) {
+      UINT word = heap_state.gc_bits[w];
+      unsigned int base = w * GC_BITS_PER_WORD;
+      for (unsigned int b = 0; word && b < GC_BITS_PER_WORD; b ++, word >>= 1) {
+	if (!(word & 1) || base + b >= heap_state.heap_size) continue;
+	cons_t *cell = &heap_state.heap[base + b];
+	VALUE cdr = read_cdr(cell);
+	gc_mark_push(s, gc_cdr_link(base + b), &overflow);
+	gc_mark_push(s, cdr, &overflow);
+	if (!gc_raw_car(base + b, cdr)) gc_mark_push(s, read_car(cell), &overflow);
+	gc_mark_drain(s, &overflow);
       }
     }
   }
+}
+
+// Marking uses a fixed size stack. When it overflows, marked cells are
+// missing their children and the heap is rescanned for such cells
+// until a pass completes without overflow. Memory use is bounded no
+// matter the shape of the data, deep structures cost extra passes.
+int gc_mark_phase(VALUE env) {
+
+  VALUE stack_storage[GC_MARK_STACK_SIZE];
+  stack s;
+  stack_create(&s, stack_storage, GC_MARK_STACK_SIZE);
+  bool overflow = false;
+
+  gc_mark_push(&s, env, &overflow);
+  gc_mark_drain(&s, &overflow);
+  gc_mark_rescan(&s, overflow);
 
   return 1;
 }
 
+static bool gc_aux_is_root(VALUE v) {
+  if (!is_ptr(v)) return false;
 
-// Sweep moves non-marked heap objects to the free list.
-int gc_sweep_phase(void) {
+  TYPE pt_t = ptr_type(v);
+  UINT pt_v = dec_ptr(v);
 
-  unsigned int i = 0;
-  cons_t *heap = (cons_t *)heap_state.heap;
+  return ((pt_t == PTR_TYPE_CONS ||
+	   pt_t == PTR_TYPE_BOXED_I ||
+	   pt_t == PTR_TYPE_BOXED_U ||
+	   pt_t == PTR_TYPE_BOXED_F ||
+	   pt_t == PTR_TYPE_ARRAY ||
+	   pt_t == PTR_TYPE_REF ||
+	   pt_t == PTR_TYPE_STREAM) &&
+	  pt_v < heap_state.heap_size);
+}
 
-  for (i = 0; i < heap_state.heap_size; i ++) {
-    if ( !get_gc_mark(&heap[i])){
-
-      // Check if this cell is a pointer to an array
-      // and free it.
-      if (type_of(heap[i].cdr) == VAL_TYPE_SYMBOL &&
-	  dec_sym(heap[i].cdr) == DEF_REPR_ARRAY_TYPE) {
-	array_t *arr = (array_t*)heap[i].car;
-	switch(arr->elt_type) {
-	case VAL_TYPE_CHAR:
-	  if (arr->data.c) free(arr->data.c);
-	  break;
-	case VAL_TYPE_I:
-	case PTR_TYPE_BOXED_I:
-	  if (arr->data.i) free(arr->data.i);
-	  break;
-	case VAL_TYPE_U:
-	case PTR_TYPE_BOXED_U:
-	case VAL_TYPE_SYMBOL:
-	  if (arr->data.u) free(arr->data.u);
-	  break;
-	case PTR_TYPE_BOXED_F:
-	  if (arr->data.f) free(arr->data.f);
-	  break;
-	default:
-	  return 0; // Error case: unrecognized element type.
-	}
-	free(arr);
-	heap_state.gc_recovered_arrays++;
-      }
+// The owner of the aux data, the evaluator, can tell which of its
+// words are values. The scanner visits those and returns how many
+// words at the bottom it could not account for, these are scanned
+// conservatively.
+static unsigned int (*gc_aux_scanner)(UINT *aux_data, unsigned int aux_size,
+				      void (*slot)(VALUE *v, void *arg), void *arg) = NULL;
 
-      // create pointer to use as new freelist
-      UINT addr = enc_cons_ptr(i);
+void heap_set_aux_scanner(unsigned int (*scan)(UINT *aux_data, unsigned int aux_size,
+					       void (*slot)(VALUE *v, void *arg), void *arg)) {
+  gc_aux_scanner = scan;
+}
 
-      // Clear the "freed" cell.
-      heap[i].car = RECOVERED;
-      heap[i].cdr = heap_state.freelist;
-      heap_state.freelist = addr;
+static void gc_aux_roots(UINT *aux_data, unsigned int aux_size, void (*slot)(VALUE *v, void *arg), void *arg) {
 
-      heap_state.num_alloc --;
-      heap_state.gc_recovered ++;
+  unsigned int n = aux_size;
+  if (gc_aux_scanner) {
+    n = gc_aux_scanner(aux_data, aux_size, slot, arg);
+  }
+  for (unsigned int i = 0; i < n; i ++) {
+    if (gc_aux_is_root(aux_data[i])) {
+      slot(&aux_data[i], arg);
     }
-    clr_gc_mark(&heap[i]);
   }
-  return 1;
 }
 
-int heap_perform_gc(VALUE env) {
-  heap_state.gc_num ++;
-  heap_state.gc_recovered = 0;
-  heap_state.gc_marked = 0;
-
-  gc_mark_freelist();
-  gc_mark_phase(env);
-  return gc_sweep_phase();
+static void gc_mark_slot(VALUE *v, void *arg) {
+  (void) arg;
+  gc_mark_phase(*v);
 }
 
-int heap_perform_gc_extra(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE list) {
-  heap_state.gc_num ++;
-  heap_state.gc_recovered = 0;
-  heap_state.gc_marked = 0;
-
-  gc_mark_freelist();
-  gc_mark_phase(exp);
-  gc_mark_phase(exp2);
-  gc_mark_phase(env);
-  gc_mark_phase(env2);
-  gc_mark_phase(list);
-
-#ifdef VISUALIZE_HEAP
-  heap_vis_gen_image();
-#endif
+int gc_mark_aux(UINT *aux_data, unsigned int aux_size) {
 
-  return gc_sweep_phase();
+  gc_aux_roots(aux_data, aux_size, gc_mark_slot, NULL);
+  return 1;
 }
 
-int heap_perform_gc_aux(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size) {
-  heap_state.gc_num ++;
-  heap_state.gc_recovered = 0;
-  heap_state.gc_marked = 0;
+// C code, extensions for example, can register the address of a
+// VALUE that must survive a collection. Roots are pushed and popped
+// in stack order, an address is pushed at most once. The registered
+// values are updated when the collector moves cells.
+static VALUE *gc_root_stack[HEAP_ROOT_STACK_SIZE];
+static unsigned int gc_num_roots = 0;
+
+bool heap_push_root(VALUE *root) {
+  if (gc_num_roots >= HEAP_ROOT_STACK_SIZE) return false;
+  gc_root_stack[gc_num_roots++] = root;
+  return true;
+}
 
-  gc_mark_freelist();
-  gc_mark_phase(exp);
-  gc_mark_phase(exp2);
-  gc_mark_phase(exp3);
-  gc_mark_phase(env);
-  gc_mark_phase(env2);
-  gc_mark_aux(aux_data, aux_size);
+void heap_pop_roots(unsigned int n) {
+  gc_num_roots = n < gc_num_roots ? gc_num_roots - n : 0;
+}
 
-#ifdef VISUALIZE_HEAP
-  heap_vis_gen_image();
-#endif
+// Roots besides the ones given by the evaluator: registered roots and
+// the children of the frozen cells in written cards. A minor
+// collection also finds the latter in the remembered set.
+static void gc_extra_roots(void (*mark)(VALUE v, void *arg), void *arg) {
 
-  return gc_sweep_phase();
+  for (unsigned int i = 0; i < gc_num_roots; i ++) {
+    mark(*gc_root_stack[i], arg);
+  }
+  gc_stats_roots(HEAP_ROOTS_EXTERN);
+
+  unsigned int fw = GC_FROZEN_WORDS;
+
+  for (unsigned int w = 0; w < fw; w ++) {
+    if (!gc_card_dirty(w)) continue;
+    for (unsigned int i = w * GC_BITS_PER_WORD; i < (w + 1) * GC_BITS_PER_WORD; i ++) {
+      cons_t *cell = &heap_state.heap[i];
+      VALUE cdr = read_cdr(cell);
+      if (!gc_raw_car(i, cdr)) mark(read_car(cell), arg);
+      mark(cdr, arg);
+      mark(gc_cdr_link(i), arg);
+    }
+  }
+  gc_stats_roots(HEAP_ROOTS_FROZEN);
 }
 
+static void gc_mark_child(VALUE v, void *arg) {
+  (void) arg;
+  gc_mark_phase(v);
+}
 
-// construct, alter and break apart
-VALUE cons(VALUE car, VALUE cdr) {
-  VALUE addr = heap_allocate_cell(PTR_TYPE_CONS);
-  if ( is_ptr(addr)) {
-    set_car_(ref_cell(addr), car);
-    set_cdr_(ref_cell(addr), cdr);
+#ifdef GC_PARALLEL_MARK
+// Parallel marking. Each worker marks from a private stack and, when
+// its deque is empty and the stack holds plenty of work, moves half
+// of the stack to the deque. Idle workers steal half of the work in
+// another worker's deque. Mark bits are set with an atomic or so
+// every cell is claimed by exactly one worker. Marking is complete
+// when all workers are idle at the same time.
+
+#define GC_PAR_SHARE         64
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  VALUE deque[GC_MARK_STACK_SIZE];
+  unsigned int top;              // Thieves take from the top,
+  unsigned int count;            // the owner takes everything.
+  VALUE stack_storage[GC_MARK_STACK_SIZE];
+  stack s;
+  unsigned int marked;
+  gc_leaves_t leaves;
+} gc_worker_t;
+
+static gc_worker_t *gc_workers = NULL;
+static unsigned int gc_par_threads;
+static unsigned int gc_par_idle;
+static bool gc_par_overflow;
+
+// The workers other than the collecting thread are started by
+// heap_set_gc_threads and wait on gc_pool_wake between collections.
+static pthread_mutex_t gc_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gc_pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned int gc_pool_size = 0;     // Workers, counting the collecting thread
+static unsigned int gc_pool_round = 0;
+static unsigned int gc_pool_busy = 0;
+static bool gc_pool_quit = false;
+
+static void gc_par_push(gc_worker_t *w, VALUE v) {
+
+  if (!is_ptr(v) || dec_ptr(v) >= heap_state.heap_size) return;
+
+  UINT ix = dec_ptr(v);
+  UINT bit = (UINT)1 << (ix % GC_BITS_PER_WORD);
+  UINT *word = &heap_state.gc_bits[ix / GC_BITS_PER_WORD];
+  if (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) return;
+  w->marked ++;
+
+  TYPE t_ptr = type_of(v);
+  if (t_ptr == PTR_TYPE_BOXED_I ||
+      t_ptr == PTR_TYPE_BOXED_U ||
+      t_ptr == PTR_TYPE_BOXED_F ||
+      t_ptr == PTR_TYPE_ARRAY) {
+    gc_count_leaf(&w->leaves, v);
+    return;
   }
 
-  // heap_allocate_cell returns MERROR if out of heap.
-  return addr;
+  if (!push_u32(&w->s, v)) {
+    __atomic_store_n(&gc_par_overflow, true, __ATOMIC_RELAXED);
+  }
 }
 
-VALUE car(VALUE c){
+static void gc_par_share(gc_worker_t *w) {
+  if (w->s.sp < GC_PAR_SHARE ||
+      __atomic_load_n(&w->count, __ATOMIC_RELAXED) > 0) return;
 
-  if (type_of(c) == VAL_TYPE_SYMBOL &&
-      c == NIL) {
-    return c; // if nil, return nil.
+  pthread_mutex_lock(&w->lock);
+  if (w->count == 0) {
+    unsigned int n = w->s.sp / 2;
+    for (unsigned int i = 0; i < n; i ++) {
+      pop_u32(&w->s, &w->deque[i]);
+    }
+    w->top = 0;
+    __atomic_store_n(&w->count, n, __ATOMIC_RELAXED);
   }
+  pthread_mutex_unlock(&w->lock);
+}
 
-  if (is_ptr(c) ){
-    cons_t *cell = ref_cell(c);
-    return read_car(cell);
+static void gc_par_drain(gc_worker_t *w) {
+  while (!stack_is_empty(&w->s)) {
+    VALUE curr;
+    pop_u32(&w->s, &curr);
+    cons_t *cell = ref_cell(curr);
+    gc_par_push(w, gc_cdr_link(dec_ptr(curr)));
+    gc_par_push(w, read_cdr(cell));
+    gc_par_push(w, read_car(cell));
+    gc_par_share(w);
   }
-  return enc_sym(symrepr_terror());
 }
 
-VALUE cdr(VALUE c){
+// Move work from a deque to the, empty, stack of w.
+static bool gc_par_take(gc_worker_t *w, gc_worker_t *from) {
+  if (__atomic_load_n(&from->count, __ATOMIC_RELAXED) == 0) return false;
 
-  if (type_of(c) == VAL_TYPE_SYMBOL &&
-      c == NIL) {
-    return c; // if nil, return nil.
+  pthread_mutex_lock(&from->lock);
+  unsigned int n = from->count;
+  if (from != w) n = (n + 1) / 2;
+  for (unsigned int i = 0; i < n; i ++) {
+    push_u32(&w->s, from->deque[from->top++]);
   }
+  __atomic_store_n(&from->count, from->count - n, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&from->lock);
+  return n > 0;
+}
 
-  if (type_of(c) == PTR_TYPE_CONS) {
-    cons_t *cell = ref_cell(c);
-    return read_cdr(cell);
+static bool gc_par_find_work(gc_worker_t *w) {
+  unsigned int n = __atomic_load_n(&gc_par_threads, __ATOMIC_SEQ_CST);
+  unsigned int id = (unsigned int)(w - gc_workers);
+
+  if (gc_par_take(w, w)) return true;
+  for (unsigned int i = 1; i < n; i ++) {
+    if (gc_par_take(w, &gc_workers[(id + i) % n])) return true;
   }
-  return enc_sym(symrepr_terror());
+  return false;
 }
 
-void set_car(VALUE c, VALUE v) {
-  if (is_ptr(c) && ptr_type(c) == PTR_TYPE_CONS) {
-    cons_t *cell = ref_cell(c);
-    set_car_(cell,v);
+static bool gc_par_work_available(void) {
+  unsigned int n = __atomic_load_n(&gc_par_threads, __ATOMIC_SEQ_CST);
+  for (unsigned int i = 0; i < n; i ++) {
+    if (__atomic_load_n(&gc_workers[i].count, __ATOMIC_RELAXED) > 0) return true;
   }
+  return false;
 }
 
-void set_cdr(VALUE c, VALUE v) {
-  if (type_of(c) == PTR_TYPE_CONS){
+static void gc_par_work(gc_worker_t *w) {
+  for (;;) {
+    gc_par_drain(w);
+    if (gc_par_find_work(w)) continue;
+
+    __atomic_add_fetch(&gc_par_idle, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+      if (__atomic_load_n(&gc_par_idle, __ATOMIC_SEQ_CST) ==
+	  __atomic_load_n(&gc_par_threads, __ATOMIC_SEQ_CST)) return;
+      if (gc_par_work_available()) {
+	__atomic_sub_fetch(&gc_par_idle, 1, __ATOMIC_SEQ_CST);
+	break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+static void *gc_par_thread(void *arg) {
+  gc_worker_t *w = (gc_worker_t *)arg;
+  unsigned int round = 0;
+
+  pthread_mutex_lock(&gc_pool_lock);
+  for (;;) {
+    while (!gc_pool_quit && gc_pool_round == round) {
+      pthread_cond_wait(&gc_pool_wake, &gc_pool_lock);
+    }
+    if (gc_pool_quit) break;
+    round = gc_pool_round;
+    pthread_mutex_unlock(&gc_pool_lock);
+
+    gc_par_work(w);
+
+    pthread_mutex_lock(&gc_pool_lock);
+    if (--gc_pool_busy == 0) pthread_cond_signal(&gc_pool_done);
+  }
+  pthread_mutex_unlock(&gc_pool_lock);
+  return NULL;
+}
+
+static void gc_pool_stop(void) {
+  pthread_mutex_lock(&gc_pool_lock);
+  gc_pool_quit = true;
+  pthread_cond_broadcast(&gc_pool_wake);
+  pthread_mutex_unlock(&gc_pool_lock);
+  for (unsigned int i = 1; i < gc_pool_size; i ++) {
+    pthread_join(gc_workers[i].thread, NULL);
+  }
+  gc_pool_quit = false;
+  gc_pool_round = 0;
+  gc_pool_size = 0;
+}
+
+// The calling thread is worker 0, it marks the roots and the other
+// workers steal from it. Stack overflow in any worker is handled by
+// a rescan of the heap once all workers are done.
+static void gc_par_child(VALUE v, void *arg) {
+  gc_worker_t *w = (gc_worker_t *)arg;
+  gc_par_push(w, v);
+  gc_par_drain(w);
+}
+
+static void gc_par_slot(VALUE *v, void *arg) {
+  gc_par_child(*v, arg);
+}
+
+static void gc_par_mark(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+
+  unsigned int n = gc_pool_size;
+
+  for (unsigned int i = 0; i < n; i ++) {
+    gc_workers[i].top = 0;
+    gc_workers[i].count = 0;
+    gc_workers[i].marked = 0;
+    memset(&gc_workers[i].leaves, 0, sizeof(gc_leaves_t));
+    stack_create(&gc_workers[i].s, gc_workers[i].stack_storage, GC_MARK_STACK_SIZE);
+  }
+  gc_par_idle = 0;
+  gc_par_overflow = false;
+  gc_par_threads = n;
+
+  pthread_mutex_lock(&gc_pool_lock);
+  gc_pool_busy = n - 1;
+  gc_pool_round ++;
+  pthread_cond_broadcast(&gc_pool_wake);
+  pthread_mutex_unlock(&gc_pool_lock);
+
+  gc_worker_t *w = &gc_workers[0];
+  gc_extra_roots(gc_par_child, w);
+  for (unsigned int i = 0; i < num_roots; i ++) {
+    gc_par_push(w, *roots[i]);
+    gc_par_drain(w);
+  }
+  gc_aux_roots(aux_data, aux_size, gc_par_slot, w);
+  gc_par_work(w);
+
+  pthread_mutex_lock(&gc_pool_lock);
+  while (gc_pool_busy > 0) {
+    pthread_cond_wait(&gc_pool_done, &gc_pool_lock);
+  }
+  pthread_mutex_unlock(&gc_pool_lock);
+  for (unsigned int i = 0; i < n; i ++) {
+    heap_state.gc_marked += gc_workers[i].marked;
+    gc_leaves.boxed += gc_workers[i].leaves.boxed;
+    gc_leaves.arrays += gc_workers[i].leaves.arrays;
+    gc_leaves.array_bytes += gc_workers[i].leaves.array_bytes;
+  }
+
+  if (gc_par_overflow) {
+    stack_create(&w->s, w->stack_storage, GC_MARK_STACK_SIZE);
+    gc_mark_rescan(&w->s, true);
+  }
+  // Workers steal from each other, the cells are not split by roots.
+  gc_stats_roots(HEAP_ROOTS_EVAL);
+}
+#endif
+
+static void gc_mark_roots(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+#ifdef GC_PARALLEL_MARK
+  if (gc_pool_size > 1) {
+    gc_par_mark(roots, num_roots, aux_data, aux_size);
+    return;
+  }
+#endif
+  gc_extra_roots(gc_mark_child, NULL);
+  for (unsigned int i = 0; i < num_roots; i ++) {
+    gc_mark_phase(*roots[i]);
+  }
+  gc_stats_roots(HEAP_ROOTS_EVAL);
+  gc_mark_aux(aux_data, aux_size);
+  gc_stats_roots(HEAP_ROOTS_STACK);
+}
+
+// Mark with num_threads threads, the thread performing the collection
+// being one of them. 0 or 1 marks on that thread only. The other
+// threads are started here and wait for collections until the number
+// is changed again. If a thread cannot be started marking uses fewer.
+// Parallel marking needs a build with GC_PARALLEL_MARK defined.
+int heap_set_gc_threads(unsigned int num_threads) {
+#ifdef GC_PARALLEL_MARK
+  if (num_threads > GC_MAX_THREADS) return 0;
+
+  if (gc_workers) {
+    unsigned int n = gc_pool_size;
+    gc_pool_stop();
+    for (unsigned int i = 0; i < n; i ++) {
+      pthread_mutex_destroy(&gc_workers[i].lock);
+    }
+    mem_free(gc_workers);
+    gc_workers = NULL;
+  }
+  heap_state.gc_threads = 0;
+  if (num_threads <= 1) return 1;
+
+  gc_workers = (gc_worker_t *)mem_malloc(MEM_HEAP, num_threads * sizeof(gc_worker_t));
+  if (!gc_workers) return 0;
+  for (unsigned int i = 0; i < num_threads; i ++) {
+    pthread_mutex_init(&gc_workers[i].lock, NULL);
+  }
+  gc_pool_size = 1;
+  while (gc_pool_size < num_threads &&
+	 pthread_create(&gc_workers[gc_pool_size].thread, NULL,
+			gc_par_thread, &gc_workers[gc_pool_size]) == 0) {
+    gc_pool_size ++;
+  }
+  heap_state.gc_threads = gc_pool_size;
+  return 1;
+#else
+  return num_threads <= 1;
+#endif
+}
+
+// The arena block of an array, NULL if the array is not in the arena.
+static arena_block_t *gc_arena_block(array_t *arr) {
+  unsigned char *a = (unsigned char *)arr;
+  if (!heap_state.arena ||
+      a < heap_state.arena ||
+      a >= heap_state.arena + heap_state.arena_top) return NULL;
+  return (arena_block_t *)(a - ARENA_ARRAY_OFFSET);
+}
+
+static void gc_trace_array_free(cons_t *cell, array_t *arr) {
+  heap_trace(HEAP_TRACE_ARRAY_FREE, 0, (uint32_t)(cell - heap_state.heap),
+	     arr->size * heap_array_elt_size(arr->elt_type));
+}
+
+// If the cell refers to an array, the array is freed.
+static int gc_free_array(cons_t *cell) {
+
+  if (type_of(cell->cdr) == VAL_TYPE_SYMBOL &&
+      dec_sym(cell->cdr) == DEF_REPR_ARRAY_TYPE &&
+      !gc_cdr_coded((UINT)(cell - heap_state.heap))) {
+    array_t *arr = (array_t*)cell->car;
+    gc_trace_array_free(cell, arr);
+    arena_block_t *block = gc_arena_block(arr);
+    if (block) {
+      if (block->owner == ARENA_FREE) return 0; // Error case: freed twice.
+      block->owner = ARENA_FREE;
+      heap_state.arena_free += block->size;
+    } else {
+      mem_free(arr);
+    }
+    heap_state.gc_recovered_arrays++;
+  }
+  return 1;
+}
+
+// Slide the live arrays to the bottom of the arena. The car of the
+// owning cell and the data pointer of a moved array are updated.
+static void gc_arena_compact(void) {
+
+  if (!heap_state.arena_free) return;
+
+  unsigned int from = 0;
+  unsigned int to = 0;
+
+  while (from < heap_state.arena_top) {
+    arena_block_t *block = (arena_block_t *)(heap_state.arena + from);
+    UINT size = block->size;
+    if (block->owner != ARENA_FREE) {
+      if (to != from) {
+	memmove(heap_state.arena + to, block, size);
+	block = (arena_block_t *)(heap_state.arena + to);
+	array_t *arr = (array_t *)((unsigned char *)block + ARENA_ARRAY_OFFSET);
+	arr->data.c = (char *)arr + ARENA_DATA_OFFSET;
+	heap_state.heap[block->owner].car = (UINT)arr;
+      }
+      to += size;
+    }
+    from += size;
+  }
+  heap_state.arena_top = to;
+  heap_state.arena_free = 0;
+}
+
+// Arrays owned by unmarked cells are freed, the cell is left as an
+// ordinary cons cell for the sweep.
+static int gc_arena_release_unmarked(void) {
+
+  unsigned int pos = 0;
+
+  while (pos < heap_state.arena_top) {
+    arena_block_t *block = (arena_block_t *)(heap_state.arena + pos);
+    pos += block->size;
+    if (block->owner == ARENA_FREE) continue;
+    cons_t *cell = &heap_state.heap[block->owner];
+    if (!get_gc_mark(cell)) {
+      if (!gc_free_array(cell)) return 0;
+      set_car_(cell, NIL);
+      set_cdr_(cell, NIL);
+    }
+  }
+  return 1;
+}
+
+static int gc_release_cell(cons_t *heap, unsigned int i) {
+
+  if (!gc_free_array(&heap[i])) return 0;
+
+  // create pointer to use as new freelist
+  UINT addr = enc_cons_ptr(i);
+
+  // Clear the "freed" cell.
+  heap[i].car = RECOVERED;
+  heap[i].cdr = heap_state.freelist;
+  heap_state.freelist = addr;
+  heap_state.freelist_length ++;
+  return 1;
+}
+
+// Free a single unmarked, allocated, cell.
+static int gc_free_cell(cons_t *heap, unsigned int i) {
+  if (!gc_release_cell(heap, i)) return 0;
+  heap_state.num_alloc --;
+  heap_state.gc_recovered ++;
+  return 1;
+}
+
+// Put the unmarked cells covered by word w of the mark bitmap on the
+// free list. Words where all cells are marked are skipped.
+// In generational mode marks are left in place, all surviving cells
+// are old after a major collection. Otherwise the word is cleared.
+static int gc_sweep_word(unsigned int w, unsigned int *num_free) {
+
+  cons_t *heap = (cons_t *)heap_state.heap;
+  UINT word = heap_state.gc_bits[w];
+
+  if (!heap_state.nursery_size) heap_state.gc_bits[w] = 0;
+  if (word == GC_BITS_ALL) return 1;
+
+  unsigned int base = w * GC_BITS_PER_WORD;
+  unsigned int n = heap_state.heap_size - base;
+  if (n > GC_BITS_PER_WORD) n = GC_BITS_PER_WORD;
+
+  while (n > 0) {
+    n --;
+    if (!(word & ((UINT)1 << n))) {
+      if (!gc_release_cell(heap, base + n)) return 0;
+      (*num_free) ++;
+    }
+  }
+  return 1;
+}
+
+// Sweep rebuilds the free list from all unmarked cells, cells that
+// were already free are not marked. The heap is swept from the top
+// so that the free list is in address order.
+int gc_sweep_phase(void) {
+
+  unsigned int num_free = 0;
+  unsigned int w = heap_state.gc_bits_size;
+
+  heap_state.freelist = NIL;
+  heap_state.freelist_length = 0;
+
+  while (w > GC_FROZEN_WORDS) {
+    w --;
+    if (!gc_sweep_word(w, &num_free)) return 0;
+  }
+  heap_state.bump = heap_state.heap_size;
+  gc_arena_compact();
+
+  unsigned int num_alloc = heap_state.heap_size - num_free;
+  heap_state.gc_recovered = heap_state.num_alloc - num_alloc;
+  heap_state.num_alloc = num_alloc;
+  return 1;
+}
+
+// Background sweep. After marking the bitmap is split into chunks
+// that a sweeper thread turns into free lists, in address order. The
+// allocator takes the chunks in the same order as its free list runs
+// dry. A chunk is claimed with a compare and swap on its state, so
+// when the allocator gets ahead of the sweeper it sweeps the next
+// unclaimed chunk itself. A chunk is published by a release store of
+// its state. Anything that marks, or moves the heap, first finishes
+// the sweep. The sweeper thread is started by
+// heap_set_background_sweep and waits on gc_bg_wake between sweeps.
+
+#define GC_SWEEP_CHUNK_WORDS 32
+
+#define GC_CHUNK_UNSWEPT     0
+#define GC_CHUNK_CLAIMED     1
+#define GC_CHUNK_READY       2
+
+#ifdef GC_BACKGROUND_SWEEP
+typedef struct {
+  VALUE head;                    // Free cells of the chunk, in address order.
+  VALUE tail;
+  unsigned int cells;            // Free cells in the chunk.
+  unsigned int arrays;           // Arrays freed by the sweep of the chunk.
+  unsigned int state;
+} gc_chunk_t;
+
+static gc_chunk_t *gc_chunks = NULL;
+static unsigned int gc_chunks_size = 0;
+static unsigned int gc_num_chunks = 0;
+static unsigned int gc_next_chunk = 0;
+static bool gc_bg_active = false;
+static bool gc_bg_thread_started = false;
+static pthread_t gc_bg_thread;
+static pthread_mutex_t gc_bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_bg_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gc_bg_idle = PTHREAD_COND_INITIALIZER;
+static unsigned int gc_bg_round = 0;
+static bool gc_bg_busy = false;   // The sweeper has a sweep that is not done
+static bool gc_bg_quit = false;
+
+static void gc_bg_sweep_chunk(unsigned int c) {
+
+  cons_t *heap = heap_state.heap;
+  gc_chunk_t *chunk = &gc_chunks[c];
+  unsigned int w0 = GC_FROZEN_WORDS + c * GC_SWEEP_CHUNK_WORDS;
+  unsigned int w = w0 + GC_SWEEP_CHUNK_WORDS;
+  if (w > heap_state.gc_bits_size) w = heap_state.gc_bits_size;
+
+  chunk->head = NIL;
+  chunk->tail = NIL;
+  chunk->cells = 0;
+  chunk->arrays = 0;
+
+  while (w > w0) {
+    w --;
+    UINT word = heap_state.gc_bits[w];
+    if (!heap_state.nursery_size) heap_state.gc_bits[w] = 0;
+    if (word == GC_BITS_ALL) continue;
+
+    unsigned int base = w * GC_BITS_PER_WORD;
+    unsigned int n = heap_state.heap_size - base;
+    if (n > GC_BITS_PER_WORD) n = GC_BITS_PER_WORD;
+
+    while (n > 0) {
+      n --;
+      if (word & ((UINT)1 << n)) continue;
+      cons_t *cell = &heap[base + n];
+      // Arrays in the arena are released before the sweep starts.
+      if (type_of(cell->cdr) == VAL_TYPE_SYMBOL &&
+	  dec_sym(cell->cdr) == DEF_REPR_ARRAY_TYPE) {
+	gc_trace_array_free(cell, (array_t*)cell->car);
+	mem_free((array_t*)cell->car);
+	chunk->arrays ++;
+      }
+      VALUE addr = enc_cons_ptr(base + n);
+      cell->car = RECOVERED;
+      cell->cdr = chunk->head;
+      if (chunk->head == NIL) chunk->tail = addr;
+      chunk->head = addr;
+      chunk->cells ++;
+    }
+  }
+  __atomic_store_n(&chunk->state, GC_CHUNK_READY, __ATOMIC_RELEASE);
+}
+
+static bool gc_bg_claim(unsigned int c) {
+  unsigned int expected = GC_CHUNK_UNSWEPT;
+  return __atomic_compare_exchange_n(&gc_chunks[c].state, &expected, GC_CHUNK_CLAIMED,
+				     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void *gc_bg_sweeper(void *arg) {
+  (void) arg;
+  unsigned int round = 0;
+
+  pthread_mutex_lock(&gc_bg_lock);
+  for (;;) {
+    while (!gc_bg_quit && gc_bg_round == round) {
+      pthread_cond_wait(&gc_bg_wake, &gc_bg_lock);
+    }
+    if (gc_bg_quit) break;
+    round = gc_bg_round;
+    unsigned int n = gc_num_chunks;
+    pthread_mutex_unlock(&gc_bg_lock);
+
+    for (unsigned int c = 0; c < n; c ++) {
+      if (gc_bg_claim(c)) gc_bg_sweep_chunk(c);
+    }
+
+    pthread_mutex_lock(&gc_bg_lock);
+    gc_bg_busy = false;
+    pthread_cond_signal(&gc_bg_idle);
+  }
+  pthread_mutex_unlock(&gc_bg_lock);
+  return NULL;
+}
+
+static void gc_bg_thread_stop(void) {
+  if (!gc_bg_thread_started) return;
+  pthread_mutex_lock(&gc_bg_lock);
+  gc_bg_quit = true;
+  pthread_cond_signal(&gc_bg_wake);
+  pthread_mutex_unlock(&gc_bg_lock);
+  pthread_join(gc_bg_thread, NULL);
+  gc_bg_thread_started = false;
+  gc_bg_quit = false;
+  gc_bg_round = 0;
+}
+
+static bool gc_bg_sweep_active(void) {
+  return gc_bg_active;
+}
+
+// The next chunk, swept by the allocator if the sweeper has not
+// claimed it yet.
+static gc_chunk_t *gc_bg_next(void) {
+  unsigned int c = gc_next_chunk++;
+  if (gc_bg_claim(c)) {
+    gc_bg_sweep_chunk(c);
+  } else {
+    while (__atomic_load_n(&gc_chunks[c].state, __ATOMIC_ACQUIRE) != GC_CHUNK_READY) {
+      sched_yield();
+    }
+  }
+  heap_state.gc_recovered_arrays += gc_chunks[c].arrays;
+  return &gc_chunks[c];
+}
+
+// All chunks are taken, wait until the sweeper lets go of them.
+static void gc_bg_done(void) {
+  pthread_mutex_lock(&gc_bg_lock);
+  while (gc_bg_busy) {
+    pthread_cond_wait(&gc_bg_idle, &gc_bg_lock);
+  }
+  pthread_mutex_unlock(&gc_bg_lock);
+  gc_bg_active = false;
+  heap_state.gc_lazy_sweep = heap_state.gc_bits_size;
+}
+
+static int gc_bg_sweep_take(void) {
+  while (!is_ptr(heap_state.freelist) && gc_next_chunk < gc_num_chunks) {
+    gc_chunk_t *chunk = gc_bg_next();
+    heap_state.freelist = chunk->head;
+    heap_state.freelist_length = chunk->cells;
+  }
+  if (gc_next_chunk == gc_num_chunks) gc_bg_done();
+  return 1;
+}
+
+static int gc_bg_sweep_finish(void) {
+  if (!gc_bg_active) return 1;
+
+  VALUE last = heap_state.freelist;
+  if (is_ptr(last)) {
+    while (is_ptr(read_cdr(ref_cell(last)))) last = read_cdr(ref_cell(last));
+  }
+  while (gc_next_chunk < gc_num_chunks) {
+    gc_chunk_t *chunk = gc_bg_next();
+    if (!is_ptr(chunk->head)) continue;
+    if (is_ptr(last)) {
+      set_cdr_(ref_cell(last), chunk->head);
+    } else {
+      heap_state.freelist = chunk->head;
+    }
+    last = chunk->tail;
+    heap_state.freelist_length += chunk->cells;
+  }
+  gc_bg_done();
+  return 1;
+}
+
+// Start sweeping the marked heap. If there is no memory for the
+// chunks the sweep is left to the allocator, if there is no sweeper
+// thread the allocator sweeps all chunks itself.
+static void gc_bg_sweep_begin(void) {
+
+  unsigned int n = (heap_state.gc_bits_size - GC_FROZEN_WORDS + GC_SWEEP_CHUNK_WORDS - 1) / GC_SWEEP_CHUNK_WORDS;
+
+  if (n > gc_chunks_size) {
+    gc_chunk_t *chunks = (gc_chunk_t *)mem_realloc(MEM_HEAP, gc_chunks, n * sizeof(gc_chunk_t));
+    if (!chunks) return;
+    gc_chunks = chunks;
+    gc_chunks_size = n;
+  }
+  for (unsigned int c = 0; c < n; c ++) {
+    gc_chunks[c].state = GC_CHUNK_UNSWEPT;
+  }
+  gc_num_chunks = n;
+  gc_next_chunk = 0;
+  gc_bg_active = true;
+  if (gc_bg_thread_started) {
+    pthread_mutex_lock(&gc_bg_lock);
+    gc_bg_busy = true;
+    gc_bg_round ++;
+    pthread_cond_signal(&gc_bg_wake);
+    pthread_mutex_unlock(&gc_bg_lock);
+  }
+}
+#else
+static bool gc_bg_sweep_active(void) { return false; }
+static int gc_bg_sweep_take(void) { return 1; }
+static int gc_bg_sweep_finish(void) { return 1; }
+static void gc_bg_sweep_begin(void) { }
+#endif
+
+// Sweep in a background thread after marking. The thread is started
+// here and stopped when the background sweep is turned off again. Like
+// lazy sweep it is not combined with incremental or compacting
+// collection. Needs a build with GC_BACKGROUND_SWEEP defined.
+int heap_set_background_sweep(bool on) {
+#ifdef GC_BACKGROUND_SWEEP
+  if (!on) {
+    if (!gc_bg_sweep_finish()) return 0;
+    gc_bg_thread_stop();
+    heap_state.bg_sweep = false;
+    mem_free(gc_chunks);
+    gc_chunks = NULL;
+    gc_chunks_size = 0;
+    return 1;
+  }
+  if (!heap_state.heap ||
+      heap_state.gc_budget ||
+      heap_state.compacting ||
+      heap_state.lazy_sweep) return 0;
+  if (!gc_bg_thread_started) {
+    gc_bg_thread_started =
+      (pthread_create(&gc_bg_thread, NULL, gc_bg_sweeper, NULL) == 0);
+  }
+  heap_state.bg_sweep = true;
+  return 1;
+#else
+  return !on;
+#endif
+}
+
+// A lazy sweep leaves the heap unswept after marking. All marked cells
+// are live, so the number of allocated cells is known up front and the
+// free list is refilled by heap_allocate_cell, a word of the mark
+// bitmap at a time, as it runs dry.
+static void gc_lazy_sweep_begin(void) {
+  unsigned int live = heap_state.frozen + heap_state.gc_marked;
+  heap_state.gc_recovered = heap_state.num_alloc - live;
+  heap_state.num_alloc = live;
+  heap_state.freelist = NIL;
+  heap_state.freelist_length = 0;
+  heap_state.gc_lazy_sweep = GC_FROZEN_WORDS;
+}
+
+static int gc_lazy_sweep(void) {
+  if (gc_bg_sweep_active()) return gc_bg_sweep_take();
+
+  unsigned int num_free = 0;
+  while (num_free == 0 &&
+	 heap_state.gc_lazy_sweep < heap_state.gc_bits_size) {
+    if (!gc_sweep_word(heap_state.gc_lazy_sweep++, &num_free)) return 0;
+  }
+  return 1;
+}
+
+static int gc_lazy_sweep_finish(void) {
+  if (!gc_bg_sweep_finish()) return 0;
+  while (heap_state.gc_lazy_sweep < heap_state.gc_bits_size) {
+    if (!gc_lazy_sweep()) return 0;
+  }
+  return 1;
+}
+
+// Abandon a lazy sweep in progress. The unswept cells are
+// recovered by the collection that follows.
+static void gc_lazy_sweep_abandon(void) {
+  gc_bg_sweep_finish();
+  unsigned int w = heap_state.gc_lazy_sweep;
+  if (w < heap_state.gc_bits_size && !heap_state.nursery_size) {
+    memset(&heap_state.gc_bits[w], 0, (heap_state.gc_bits_size - w) * sizeof(UINT));
+  }
+  heap_state.gc_lazy_sweep = heap_state.gc_bits_size;
+}
+
+// Sweep on allocation. Not combined with incremental collection
+// which has a sweep phase of its own.
+int heap_set_lazy_sweep(bool on) {
+
+  if (!heap_state.heap ||
+      heap_state.gc_budget ||
+      heap_state.compacting ||
+      heap_state.bg_sweep) return 0;
+
+  if (!on && !gc_lazy_sweep_finish()) return 0;
+  heap_state.lazy_sweep = on;
+  return 1;
+}
+
+// Sweep of the nursery. Only cells allocated since the last
+// collection are visited. Marked young cells are promoted.
+static int gc_sweep_young(void) {
+
+  cons_t *heap = (cons_t *)heap_state.heap;
+
+  for (unsigned int i = 0; i < heap_state.num_young; i ++) {
+    UINT ix = heap_state.young[i];
+    if (!get_gc_mark(&heap[ix])) {
+      if (!gc_free_cell(heap, ix)) return 0;
+    }
+  }
+  gc_arena_compact();
+  return 1;
+}
+
+// Children of remembered (old) cells are roots in a minor collection.
+static void gc_mark_remembered(void) {
+  for (unsigned int i = 0; i < heap_state.num_remembered; i ++) {
+    cons_t *cell = &heap_state.heap[heap_state.remembered[i]];
+    gc_mark_phase(read_car(cell));
+    gc_mark_phase(read_cdr(cell));
+    gc_mark_phase(gc_cdr_link(heap_state.remembered[i]));
+  }
+}
+
+static void gc_reset_nursery(void) {
+  heap_state.num_young = 0;
+  heap_state.num_remembered = 0;
+  heap_state.remembered_overflow = false;
+}
+
+// Marking is done snapshot-at-the-beginning style. The roots are
+// shaded when a cycle starts, set_car and set_cdr shade the value
+// they overwrite and cells allocated during the cycle are black.
+// A marked cell is grey while it is on the grey stack and black
+// after its children have been shaded.
+
+static void gc_inc_shade(VALUE v) {
+
+  if (!is_ptr(v) || dec_ptr(v) >= heap_state.heap_size) return;
+
+  cons_t *cell = ref_cell(v);
+  if (get_gc_mark(cell)) return;
+
+  set_gc_mark(cell);
+  heap_state.gc_marked ++;
+
+  TYPE t = type_of(v);
+  if (t == PTR_TYPE_BOXED_I ||
+      t == PTR_TYPE_BOXED_U ||
+      t == PTR_TYPE_BOXED_F ||
+      t == PTR_TYPE_ARRAY) {
+    gc_count_leaf(&gc_leaves, v);
+    return;
+  }
+
+  if (heap_state.gc_inc_sp < GC_INC_STACK_SIZE) {
+    heap_state.gc_inc_stack[heap_state.gc_inc_sp++] = v;
+  } else {
+    // The children of this cell are found by a rescan of the heap.
+    heap_state.gc_inc_overflow = true;
+  }
+}
+
+static void gc_inc_shade_child(VALUE v, void *arg) {
+  (void) arg;
+  gc_inc_shade(v);
+}
+
+static void gc_inc_shade_slot(VALUE *v, void *arg) {
+  (void) arg;
+  gc_inc_shade(*v);
+}
+
+static unsigned int gc_inc_begin(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size) {
+
+  heap_state.gc_num ++;
+  heap_state.gc_recovered = 0;
+  heap_state.gc_marked = 0;
+  gc_stats_cycle();
+
+  heap_state.gc_inc_phase = GC_INC_MARK;
+  heap_state.gc_inc_freelist = heap_state.freelist;
+  heap_state.gc_inc_sp = 0;
+  heap_state.gc_inc_overflow = false;
+  heap_state.gc_inc_rescan = heap_state.heap_size;
+  heap_state.gc_inc_sweep = heap_state.frozen;
+
+  gc_extra_roots(gc_inc_shade_child, NULL);
+  gc_inc_shade(env);
+  gc_inc_shade(env2);
+  gc_inc_shade(exp);
+  gc_inc_shade(exp2);
+  gc_inc_shade(exp3);
+  gc_stats_roots(HEAP_ROOTS_EVAL);
+  gc_aux_roots(aux_data, aux_size, gc_inc_shade_slot, NULL);
+  gc_stats_roots(HEAP_ROOTS_STACK);
+  return aux_size + 5;
+}
+
+static unsigned int gc_inc_mark(unsigned int budget) {
+
+  unsigned int work = 0;
+
+  while (work < budget) {
+    if (is_ptr(heap_state.gc_inc_freelist)) {
+      cons_t *t = ref_cell(heap_state.gc_inc_freelist);
+      set_gc_mark(t);
+      heap_state.gc_inc_freelist = read_cdr(t);
+    } else if (heap_state.gc_inc_sp > 0) {
+      VALUE curr = heap_state.gc_inc_stack[--heap_state.gc_inc_sp];
+      cons_t *cell = ref_cell(curr);
+      gc_inc_shade(read_car(cell));
+      gc_inc_shade(read_cdr(cell));
+      gc_inc_shade(gc_cdr_link(dec_ptr(curr)));
+    } else if (heap_state.gc_inc_rescan < heap_state.heap_size) {
+      UINT ix = heap_state.gc_inc_rescan++;
+      cons_t *cell = &heap_state.heap[ix];
+      if (get_gc_mark(cell)) {
+	VALUE cdr = read_cdr(cell);
+	if (!gc_raw_car(ix, cdr)) gc_inc_shade(read_car(cell));
+	gc_inc_shade(cdr);
+	gc_inc_shade(gc_cdr_link(ix));
+      }
+    } else if (heap_state.gc_inc_overflow) {
+      heap_state.gc_inc_overflow = false;
+      heap_state.gc_inc_rescan = heap_state.frozen;
+      continue;
+    } else {
+      // Marking is spread over many steps, the rest of the cells
+      // count as reached from the evaluator.
+      gc_stats_roots(HEAP_ROOTS_EVAL);
+      heap_state.gc_inc_phase = GC_INC_SWEEP;
+      break;
+    }
+    work ++;
+  }
+  return work;
+}
+
+static int gc_inc_sweep(unsigned int budget, unsigned int *work) {
+
+  cons_t *heap = (cons_t *)heap_state.heap;
+  unsigned int n = 0;
+
+  while (n < budget && heap_state.gc_inc_sweep < heap_state.heap_size) {
+    unsigned int i = heap_state.gc_inc_sweep++;
+    if (!get_gc_mark(&heap[i])) {
+      if (!gc_free_cell(heap, i)) return 0;
+    } else {
+      clr_gc_mark(&heap[i]);
+    }
+    n ++;
+  }
+
+  if (heap_state.gc_inc_sweep == heap_state.heap_size) {
+    heap_state.gc_inc_phase = GC_INC_IDLE;
+    gc_arena_compact();
+    gc_stats_live();
+    gc_grow_policy();
+  }
+  *work += n;
+  return 1;
+}
+
+static int gc_inc_work(unsigned int budget, unsigned int *work) {
+  switch (heap_state.gc_inc_phase) {
+  case GC_INC_MARK:
+    *work = gc_inc_mark(budget);
+    return 1;
+  case GC_INC_SWEEP:
+    *work = 0;
+    return gc_inc_sweep(budget, work);
+  default:
+    *work = 0;
+    return 1;
+  }
+}
+
+// Run the current cycle, if any, to completion.
+static int gc_inc_finish(void) {
+  unsigned int work;
+  while (heap_state.gc_inc_phase != GC_INC_IDLE) {
+    if (!gc_inc_work(heap_state.heap_size, &work)) return 0;
+  }
+  return 1;
+}
+
+// Enable incremental collection where each step marks or sweeps at
+// most num_cells cells. A cycle starts when half of the heap is in use,
+// the step that starts it only shades the roots but takes time in
+// proportion to the evaluation stack.
+// num_cells = 0 disables incremental collection.
+int heap_set_gc_budget(unsigned int num_cells) {
+
+  if (!heap_state.heap ||
+      heap_state.nursery_size ||
+      heap_state.lazy_sweep ||
+      heap_state.bg_sweep ||
+      heap_state.compacting) return 0;
+
+  if (!gc_inc_finish()) return 0;
+
+  if (num_cells == 0) {
+    if (heap_state.gc_inc_stack) mem_free(heap_state.gc_inc_stack);
+    heap_state.gc_inc_stack = NULL;
+    heap_state.gc_budget = 0;
+    return 1;
+  }
+
+  if (!heap_state.gc_inc_stack) {
+    heap_state.gc_inc_stack = (VALUE*)mem_malloc(MEM_HEAP, GC_INC_STACK_SIZE * sizeof(VALUE));
+    if (!heap_state.gc_inc_stack) return 0;
+  }
+
+  heap_state.gc_budget = num_cells;
+  heap_state.gc_inc_start = heap_state.heap_size / 2;
+  return 1;
+}
+
+bool heap_gc_incremental(void) {
+  return heap_state.gc_budget > 0;
+}
+
+// One bounded step of incremental collection. The roots are only
+// used when the step starts a new cycle.
+int heap_perform_gc_step(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size) {
+
+  unsigned int work;
+
+  if (!heap_state.gc_budget) return 1;
+
+  if (heap_state.gc_inc_phase == GC_INC_IDLE) {
+    if (heap_state.num_alloc < heap_state.gc_inc_start) return 1;
+    uint32_t t = gc_pause_begin(HEAP_TRACE_STEP);
+    work = gc_inc_begin(env, env2, exp, exp2, exp3, aux_data, aux_size);
+    gc_pause_end(t, HEAP_TRACE_STEP);
+  } else {
+    uint32_t t = gc_pause_begin(HEAP_TRACE_STEP);
+    int r = gc_inc_work(heap_state.gc_budget, &work);
+    gc_pause_end(t, HEAP_TRACE_STEP);
+    if (!r) return 0;
+  }
+
+  if (work > heap_state.gc_inc_max_work) {
+    heap_state.gc_inc_max_work = work;
+  }
+  return 1;
+}
+
+// The heap grows by adding regions of region_size cells at the top
+// of the cell index space. Cells are addressed by index, so the cells
+// and the mark bitmap can be moved by realloc when a region is added
+// or released. This is only done between collections, or at their
+// end, when no cons_t pointers are held.
+
+static int gc_resize(unsigned int num_cells) {
+
+  cons_t *heap = (cons_t *)mem_realloc(MEM_HEAP, heap_state.heap, num_cells * sizeof(cons_t));
+  if (!heap) return 0;
+  heap_state.heap = heap;
+
+  unsigned int words = (unsigned int)GC_BITS_WORDS(num_cells);
+  UINT *bits = (UINT *)mem_realloc(MEM_HEAP, heap_state.gc_bits, words * sizeof(UINT));
+  if (!bits) return 0;
+  heap_state.gc_bits = bits;
+
+  if (heap_state.gc_fwd) {
+    UINT *fwd = (UINT *)mem_realloc(MEM_HEAP, heap_state.gc_fwd, words * sizeof(UINT));
+    if (!fwd) return 0;
+    heap_state.gc_fwd = fwd;
+  }
+  if (heap_state.cdr_bits) {
+    UINT *cdr_bits = (UINT *)mem_realloc(MEM_HEAP, heap_state.cdr_bits, words * sizeof(UINT));
+    if (!cdr_bits) return 0;
+    heap_state.cdr_bits = cdr_bits;
+  }
+  if (heap_state.scope_bits) {
+    UINT *scope_bits = (UINT *)mem_realloc(MEM_HEAP, heap_state.scope_bits, words * sizeof(UINT));
+    if (!scope_bits) return 0;
+    heap_state.scope_bits = scope_bits;
+  }
+  return 1;
+}
+
+static void gc_set_size(unsigned int num_cells) {
+  heap_trace(HEAP_TRACE_RESIZE, 0, num_cells, 0);
+  bool lazy = heap_state.gc_lazy_sweep < heap_state.gc_bits_size;
+  heap_state.heap_size    = num_cells;
+  heap_state.heap_bytes   = num_cells * sizeof(cons_t);
+  heap_state.gc_bits_size = (unsigned int)GC_BITS_WORDS(num_cells);
+  if (!lazy) {
+    heap_state.gc_lazy_sweep = heap_state.gc_bits_size;
+  }
+  if (heap_state.gc_budget) {
+    heap_state.gc_inc_start = num_cells / 2;
+  }
+}
+
+static int gc_add_region(void) {
+
+  unsigned int old_size = heap_state.heap_size;
+  unsigned int new_size = old_size + heap_state.region_size;
+
+  if (!heap_state.region_size || new_size > heap_state.max_size) return 0;
+
+  // The new cells are left to a lazy sweep that has not yet passed
+  // them, otherwise they go on the free list.
+  if (!gc_inc_finish()) return 0;
+  if (!gc_bg_sweep_finish()) return 0;
+  if (heap_state.gc_lazy_sweep > old_size / GC_BITS_PER_WORD &&
+      heap_state.gc_lazy_sweep < heap_state.gc_bits_size) {
+    if (!gc_lazy_sweep_finish()) return 0;
+  }
+  bool lazy = heap_state.gc_lazy_sweep < heap_state.gc_bits_size;
+
+  if (!gc_resize(new_size)) return 0;
+
+  for (unsigned int i = old_size; i < new_size; i ++) {
+    clr_gc_mark(&heap_state.heap[i]);
+  }
+  unsigned int old_words = heap_state.gc_bits_size;
+  unsigned int new_words = (unsigned int)GC_BITS_WORDS(new_size);
+  memset(&heap_state.gc_bits[old_words], 0, (new_words - old_words) * sizeof(UINT));
+  if (heap_state.cdr_bits) {
+    memset(&heap_state.cdr_bits[old_words], 0, (new_words - old_words) * sizeof(UINT));
+  }
+  if (heap_state.scope_bits) {
+    memset(&heap_state.scope_bits[old_words], 0, (new_words - old_words) * sizeof(UINT));
+  }
+
+  for (unsigned int i = old_size; i < new_size; i ++) {
+    set_car_(&heap_state.heap[i], RECOVERED);
+    set_cdr_(&heap_state.heap[i], i + 1 < new_size ? enc_cons_ptr(i + 1) : NIL);
+  }
+
+  gc_set_size(new_size);
+  heap_state.num_regions ++;
+
+  // A compacted heap hands out the new cells from the bump pointer.
+  if (heap_state.compacting) return 1;
+
+  heap_state.bump = new_size;
+  if (!lazy) {
+    heap_state.freelist_length += heap_state.region_size;
+    VALUE last = heap_state.freelist;
+    if (!is_ptr(last)) {
+      heap_state.freelist = enc_cons_ptr(old_size);
+    } else {
+      while (is_ptr(read_cdr(ref_cell(last)))) last = read_cdr(ref_cell(last));
+      set_cdr_(ref_cell(last), enc_cons_ptr(old_size));
+    }
+  }
+  return 1;
+}
+
+// Release the top region if none of its cells are marked. Called
+// before the sweep, which then rebuilds the free list without it.
+static void gc_release_region(unsigned int live) {
+
+  unsigned int new_size = heap_state.heap_size - heap_state.region_size;
+
+  if (!heap_state.release_regions ||
+      heap_state.num_regions <= 1 ||
+      (heap_state.compacting && heap_state.bump > new_size) ||
+      (unsigned long)live * 200 >= (unsigned long)heap_state.grow_threshold * new_size) return;
+
+  for (unsigned int i = new_size; i < heap_state.heap_size; i ++) {
+    if (get_gc_mark(&heap_state.heap[i])) return;
+  }
+  for (unsigned int i = new_size; i < heap_state.heap_size; i ++) {
+    if (!gc_free_array(&heap_state.heap[i])) return;
+  }
+
+  gc_set_size(new_size);
+  heap_state.num_regions --;
+  if (heap_state.bump > new_size) heap_state.bump = new_size;
+  gc_resize(new_size);
+}
+
+static void gc_grow_policy(void) {
+  if ((unsigned long)heap_state.num_alloc * 100 >
+      (unsigned long)heap_state.grow_threshold * heap_state.heap_size) {
+    gc_add_region();
+  }
+}
+
+// Let the heap grow by regions of region_size cells, up to max_size
+// cells, when more than grow_threshold percent of the heap survives a
+// collection. Regions that end up empty can be released again.
+// Only for a heap allocated by heap_init.
+int heap_set_growth(unsigned int region_size, unsigned int max_size, unsigned int grow_threshold, bool release_regions) {
+
+  if (!heap_state.heap || !heap_state.malloced) return 0;
+
+  if (max_size == 0 || max_size > HEAP_MAX_CELLS) max_size = HEAP_MAX_CELLS;
+  if (max_size < heap_state.heap_size) max_size = heap_state.heap_size;
+
+  heap_state.region_size     = region_size;
+  heap_state.max_size        = max_size;
+  heap_state.grow_threshold  = grow_threshold;
+  heap_state.release_regions = release_regions;
+  return 1;
+}
+
+// True if num_cells cells can be allocated without a collection. A
+// step of the evaluator checks this before it allocates anything so
+// that running out of memory never leaves work to be redone.
+bool heap_reserve(unsigned int num_cells) {
+  return heap_state.heap_size - heap_state.num_alloc >= num_cells;
+}
+
+// Collections, major and minor, performed so far.
+static unsigned int gc_count(void) {
+  return heap_state.gc_num + heap_state.gc_num_minor;
+}
+
+// Let the evaluator collect at a safe point when fewer than num_cells
+// cells are free, instead of when an allocation fails.
+// num_cells = 0 disables collection at the watermark.
+int heap_set_gc_watermark(unsigned int num_cells) {
+  if (!heap_state.heap || num_cells > heap_state.heap_size) return 0;
+  heap_state.gc_watermark = num_cells;
+  heap_state.gc_watermark_skip = gc_count() - 1;
+  return 1;
+}
+
+bool heap_gc_due(void) {
+  return (!heap_reserve(heap_state.gc_watermark) &&
+	  heap_state.gc_watermark_skip != gc_count());
+}
+
+// After a collection at the watermark. If it did not free enough the
+// heap grows, when it can. Otherwise the watermark is ignored until
+// the next collection so that live data above the watermark does not
+// cause a collection at every step.
+void heap_gc_watermark_done(void) {
+  if (heap_reserve(heap_state.gc_watermark)) return;
+  if (heap_grow() && heap_reserve(heap_state.gc_watermark)) return;
+  heap_state.gc_watermark_skip = gc_count();
+}
+
+// Complete an incremental cycle or a pending sweep, after this every
+// cell is either in use or free.
+int heap_finish_gc(void) {
+  if (!gc_inc_finish()) return 0;
+  return gc_lazy_sweep_finish();
+}
+
+// Add a region when a collection did not free enough.
+int heap_grow(void) {
+  return gc_add_region();
+}
+
+// Scoped allocation, for short lived evaluations. The cells allocated
+// while a scope is open are logged. When it is closed the logged
+// cells that cannot be reached from the roots go back on the free
+// list at once. That is only safe if nothing else can reach them, so
+// if a collection has started in the meantime, a cell outside the
+// scope was made to point into it or the log overflowed, the cells
+// of the scope are left to the collector.
+// num_cells = 0 disables scoped allocation.
+static stack gc_scope_stack;
+
+int heap_set_scope_size(unsigned int num_cells) {
+
+  if (heap_state.scope_open) return 0;
+
+  if (heap_state.scope_log) mem_free(heap_state.scope_log);
+  if (heap_state.scope_bits) mem_free(heap_state.scope_bits);
+  if (heap_state.scope_size) stack_free(&gc_scope_stack);
+  heap_state.scope_log = NULL;
+  heap_state.scope_bits = NULL;
+  heap_state.scope_size = 0;
+
+  if (num_cells == 0) return 1;
+  if (!heap_state.heap) return 0;
+
+  heap_state.scope_log = (UINT *)mem_malloc(MEM_HEAP, num_cells * sizeof(UINT));
+  heap_state.scope_bits = (UINT *)mem_calloc(MEM_HEAP, heap_state.gc_bits_size, sizeof(UINT));
+  if (!heap_state.scope_log ||
+      !heap_state.scope_bits ||
+      !stack_allocate(&gc_scope_stack, GC_MARK_STACK_SIZE, true)) {
+    if (heap_state.scope_log) mem_free(heap_state.scope_log);
+    if (heap_state.scope_bits) mem_free(heap_state.scope_bits);
+    heap_state.scope_log = NULL;
+    heap_state.scope_bits = NULL;
+    return 0;
+  }
+  heap_state.scope_size = num_cells;
+  return 1;
+}
+
+// Scopes do not nest and are not opened during an incremental cycle.
+bool heap_scope_open(void) {
+
+  if (!heap_state.scope_size ||
+      heap_state.scope_open ||
+      heap_state.gc_inc_phase != GC_INC_IDLE) return false;
+
+  heap_state.scope_open  = true;
+  heap_state.scope_keep  = false;
+  heap_state.scope_num   = 0;
+  heap_state.scope_gc    = gc_count();
+  heap_state.scope_young = heap_state.num_young;
+  return true;
+}
+
+// The scope bit of a reached cell is cleared, the cells that still
+// have it when the roots are traced are garbage.
+static bool gc_scope_reach(VALUE v) {
+  if (!is_heap_ptr(v)) return true;
+  UINT ix = dec_ptr(v);
+  if (ix >= heap_state.heap_size || !gc_in_scope(ix)) return true;
+  gc_scope_clr(ix);
+  return push_u32(&gc_scope_stack, ix);
+}
+
+static bool gc_scope_trace(VALUE *roots, unsigned int num_roots) {
+
+  bool ok = true;
+  stack_clear(&gc_scope_stack);
+
+  for (unsigned int i = 0; i < num_roots; i ++) {
+    ok = ok && gc_scope_reach(roots[i]);
+  }
+  for (unsigned int i = 0; i < gc_num_roots; i ++) {
+    ok = ok && gc_scope_reach(*gc_root_stack[i]);
+  }
+
+  while (ok && !stack_is_empty(&gc_scope_stack)) {
+    UINT ix;
+    pop_u32(&gc_scope_stack, &ix);
+    cons_t *cell = &heap_state.heap[ix];
+    if (!gc_raw_car(ix, read_cdr(cell))) {
+      ok = gc_scope_reach(read_car(cell));
+    }
+    ok = ok && gc_scope_reach(read_cdr(cell));
+    ok = ok && gc_scope_reach(gc_cdr_link(ix));
+  }
+  return ok;
+}
+
+// Close the open scope. The roots are all values, besides those
+// registered with heap_push_root, that may refer to cells of the
+// scope.
+int heap_scope_close(VALUE *roots, unsigned int num_roots) {
+
+  if (!heap_state.scope_open) return 0;
+  heap_state.scope_open = false;
+
+  bool keep = (heap_state.scope_keep ||
+	       heap_state.scope_gc != gc_count() ||
+	       heap_state.gc_inc_phase != GC_INC_IDLE ||
+	       !gc_scope_trace(roots, num_roots));
+
+  unsigned int n = heap_state.scope_num;
+  heap_state.scope_num = 0;
+
+  if (keep) {
+    for (unsigned int i = 0; i < n; i ++) {
+      UINT ix = heap_state.scope_log[i];
+      if (ix < heap_state.heap_size) gc_scope_clr(ix);
+    }
+    heap_stats.scope_kept += n;
+    heap_trace(HEAP_TRACE_SCOPE, 0, 0, n);
+    return 1;
+  }
+
+  // The freed cells are young cells that are no longer tracked,
+  // those that did not fit in the young list included.
+  unsigned int untracked = 0;
+  if (heap_state.nursery_size) {
+    unsigned int j = heap_state.scope_young;
+    for (unsigned int i = heap_state.scope_young; i < heap_state.num_young; i ++) {
+      if (gc_in_scope(heap_state.young[i])) {
+	untracked ++;
+      } else {
+	heap_state.young[j++] = heap_state.young[i];
+      }
+    }
+    heap_state.num_young = j;
+  }
+
+  // Freed in reverse so that the free list is in allocation order.
+  unsigned int freed = 0;
+  for (unsigned int i = n; i > 0; i --) {
+    UINT ix = heap_state.scope_log[i - 1];
+    if (!gc_in_scope(ix)) continue;
+    gc_scope_clr(ix);
+    if (!gc_release_cell(heap_state.heap, ix)) return 0;
+    heap_state.num_alloc --;
+    freed ++;
+  }
+
+  if (heap_state.nursery_size) {
+    heap_state.young_overflow -= freed - untracked;
+  }
+  heap_stats.scope_freed += freed;
+  heap_stats.scope_kept += n - freed;
+  heap_trace(HEAP_TRACE_SCOPE, 0, freed, n - freed);
+  return 1;
+}
+
+static void gc_begin(void) {
+  // A cycle in progress is completed, it leaves all marks cleared.
+  gc_inc_finish();
+  gc_lazy_sweep_abandon();
+
+  heap_state.gc_num ++;
+  heap_state.gc_recovered = 0;
+  heap_state.gc_marked = 0;
+  gc_stats_cycle();
+
+  // A major collection starts from a clean slate.
+  if (heap_state.nursery_size) {
+    gc_clear_marks();
+  }
+}
+
+static int gc_end(void) {
+  int r = 1;
+  gc_release_region(heap_state.frozen + heap_state.gc_marked);
+  if (heap_state.lazy_sweep || heap_state.bg_sweep) {
+    // Arrays are not left for the lazy sweep, the arena is
+    // compacted right away.
+    r = gc_arena_release_unmarked();
+    gc_arena_compact();
+    gc_lazy_sweep_begin();
+    if (heap_state.bg_sweep) gc_bg_sweep_begin();
+  } else {
+    r = gc_sweep_phase();
+  }
+  if (heap_state.nursery_size) {
+    gc_reset_nursery();
+    heap_state.young_overflow = 0;
+  }
+  gc_stats_live();
+  if (r) gc_grow_policy();
+  return r;
+}
+
+// A minor collection is possible when all old-to-young pointers have
+// been recorded. Young cells that did not fit in the young list are
+// only reclaimed by a major collection, so too many of those also
+// forces a major collection.
+static bool gc_minor_possible(void) {
+  return (heap_state.nursery_size &&
+	  heap_state.young_overflow < heap_state.nursery_size &&
+	  !heap_state.remembered_overflow);
+}
+
+static bool gc_minor_sufficient(void) {
+  return ((heap_state.heap_size - heap_state.num_alloc) >= heap_state.nursery_size);
+}
+
+// Compacting collection slides all live cells, in address order, to
+// the bottom of the heap and allocation continues with a bump pointer
+// above them. The new index of a live cell is the number of marked
+// cells below it, found from gc_fwd and the mark bitmap. The caller
+// must hand over the address of every root as they are updated.
+
+static unsigned int gc_popcount(UINT w) {
+  return (unsigned int)__builtin_popcountll((unsigned long long)w);
+}
+
+static VALUE gc_forward(VALUE v) {
+
+  if (!is_ptr(v) || dec_ptr(v) >= heap_state.heap_size) return v;
+
+  UINT ix = dec_ptr(v);
+  UINT w = ix / GC_BITS_PER_WORD;
+  UINT below = heap_state.gc_bits[w] & (((UINT)1 << (ix % GC_BITS_PER_WORD)) - 1);
+  UINT new_ix = heap_state.gc_fwd[w] + gc_popcount(below);
+
+  return (v & ~PTR_VAL_MASK) | ((new_ix << ADDRESS_SHIFT) & PTR_VAL_MASK);
+}
+
+static void gc_forward_slot(VALUE *v, void *arg) {
+  (void) arg;
+  *v = gc_forward(*v);
+}
+
+static int gc_compact(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+
+  cons_t *heap = (cons_t *)heap_state.heap;
+  unsigned int live = 0;
+  unsigned int top = heap_state.bump;
+
+  for (unsigned int w = 0; w < heap_state.gc_bits_size; w ++) {
+    heap_state.gc_fwd[w] = live;
+    live += gc_popcount(heap_state.gc_bits[w]);
+  }
+
+  for (unsigned int i = 0; i < num_roots; i ++) {
+    *roots[i] = gc_forward(*roots[i]);
+  }
+  for (unsigned int i = 0; i < gc_num_roots; i ++) {
+    *gc_root_stack[i] = gc_forward(*gc_root_stack[i]);
+  }
+  gc_aux_roots(aux_data, aux_size, gc_forward_slot, NULL);
+
+  // Frozen cells stay where they are, only those in written cards
+  // can refer to cells that move.
+  for (unsigned int w = 0; w < GC_FROZEN_WORDS; w ++) {
+    if (!gc_card_dirty(w)) continue;
+    for (unsigned int i = w * GC_BITS_PER_WORD; i < (w + 1) * GC_BITS_PER_WORD; i ++) {
+      VALUE cdr = read_cdr(&heap[i]);
+      if (!gc_raw_car(i, cdr)) set_car_(&heap[i], gc_forward(read_car(&heap[i])));
+      set_cdr_(&heap[i], gc_forward(cdr));
+    }
+  }
+
+  // A live cell only moves to a lower index, to a cell that has
+  // already been visited. The cell after a live cdr-coded cell is
+  // live, the two stay next to each other.
+  unsigned int to = heap_state.frozen;
+  for (unsigned int i = heap_state.frozen; i < top; i ++) {
+    cons_t *cell = &heap[i];
+    if (get_gc_mark(cell)) {
+      VALUE car = read_car(cell);
+      VALUE cdr = read_cdr(cell);
+      if (gc_cdr_coded(i)) {
+	clr_cdr_coded(i);
+	set_cdr_coded(to);
+      } else {
+	clr_cdr_coded(to);
+      }
+      if (!gc_raw_car(to, cdr)) {
+	car = gc_forward(car);
+      } else if (dec_sym(cdr) == DEF_REPR_ARRAY_TYPE) {
+	arena_block_t *block = gc_arena_block((array_t*)car);
+	if (block) block->owner = to;
+      }
+      set_car_(&heap[to], car);
+      set_cdr_(&heap[to], gc_forward(cdr));
+      to ++;
+    } else if (!gc_free_array(cell)) {
+      return 0;
+    }
+  }
+
+  for (unsigned int i = live; i < top; i ++) {
+    set_car_(&heap[i], RECOVERED);
+    set_cdr_(&heap[i], NIL);
+    clr_cdr_coded(i);
+  }
+
+  gc_clear_marks();
+  gc_arena_compact();
+  heap_state.freelist = NIL;
+  heap_state.freelist_length = 0;
+  heap_state.bump = live;
+  heap_state.gc_recovered = heap_state.num_alloc - live;
+  heap_state.num_alloc = live;
+  return 1;
+}
+
+int heap_set_compacting(bool on) {
+
+  if (!heap_state.heap ||
+      heap_state.nursery_size ||
+      heap_state.gc_budget ||
+      heap_state.lazy_sweep ||
+      heap_state.bg_sweep) return 0;
+
+  if (on && !heap_state.gc_fwd) {
+    heap_state.gc_fwd = (UINT*)mem_malloc(MEM_HEAP, heap_state.gc_bits_size * sizeof(UINT));
+    if (!heap_state.gc_fwd) return 0;
+  }
+  heap_state.compacting = on;
+  return 1;
+}
+
+bool heap_compacting(void) {
+  return heap_state.compacting;
+}
+
+static int gc_freeze(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+
+  bool fwd = heap_state.gc_fwd != NULL;
+  if (!fwd) {
+    heap_state.gc_fwd = (UINT*)mem_malloc(MEM_HEAP, heap_state.gc_bits_size * sizeof(UINT));
+    if (!heap_state.gc_fwd) return 0;
+  }
+
+  gc_begin();
+  gc_mark_roots(roots, num_roots, aux_data, aux_size);
+  int r = gc_compact(roots, num_roots, aux_data, aux_size);
+
+  if (!fwd) {
+    mem_free(heap_state.gc_fwd);
+    heap_state.gc_fwd = NULL;
+  }
+  if (!r) return 0;
+
+  // The segment ends at a word of the mark bitmap, the unused cells
+  // up to there are frozen as well.
+  unsigned int frozen = heap_state.bump;
+  if (frozen % GC_BITS_PER_WORD) {
+    frozen += GC_BITS_PER_WORD - frozen % GC_BITS_PER_WORD;
+    if (frozen > heap_state.heap_size) frozen -= GC_BITS_PER_WORD;
+  }
+  if (frozen > heap_state.bump) {
+    heap_state.num_alloc += frozen - heap_state.bump;
+    heap_state.bump = frozen;
+  }
+  if (!gc_set_frozen(frozen)) return 0;
+
+  // Only the compacting collector allocates above a bump pointer.
+  if (!heap_state.compacting) {
+    heap_state.freelist = NIL;
+    for (unsigned int i = heap_state.heap_size; i > heap_state.bump; i --) {
+      set_car_(&heap_state.heap[i-1], RECOVERED);
+      set_cdr_(&heap_state.heap[i-1], heap_state.freelist);
+      heap_state.freelist = enc_cons_ptr(i-1);
+    }
+    heap_state.freelist_length = heap_state.heap_size - heap_state.bump;
+    heap_state.bump = heap_state.heap_size;
+  }
+
+  // Everything that was marked is now frozen.
+  memset(&gc_leaves, 0, sizeof(gc_leaves_t));
+  gc_stats_live();
+
+  if (heap_state.nursery_size) {
+    gc_reset_nursery();
+    heap_state.young_overflow = 0;
+  }
+  return 1;
+}
+
+// Move everything reachable from the roots to the bottom of the heap
+// and freeze it. Later collections neither mark nor sweep the frozen
+// cells. Like for heap_perform_gc_compact the caller must hand over
+// the address of every root. Cells frozen by an earlier call stay
+// frozen. A frozen cell that is written is scanned by every full
+// collection, so the frozen segment can only be placed in read-only
+// memory if it is never written.
+int heap_freeze(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+
+  if (!heap_state.heap) return 0;
+
+  uint32_t t = gc_pause_begin(HEAP_TRACE_FREEZE);
+  int r = gc_freeze(roots, num_roots, aux_data, aux_size);
+  gc_pause_end(t, HEAP_TRACE_FREEZE);
+  return r;
+}
+
+unsigned int heap_num_frozen(void) {
+  return heap_state.frozen;
+}
+
+int heap_perform_gc(VALUE env) {
+  uint32_t t = gc_pause_begin(HEAP_TRACE_COLLECT);
+  gc_begin();
+
+  gc_extra_roots(gc_mark_child, NULL);
+  gc_mark_phase(env);
+  gc_stats_roots(HEAP_ROOTS_EVAL);
+  int r = gc_end();
+  gc_pause_end(t, HEAP_TRACE_COLLECT);
+  return r;
+}
+
+int heap_perform_gc_extra(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE list) {
+  uint32_t t = gc_pause_begin(HEAP_TRACE_COLLECT);
+  gc_begin();
+
+  gc_extra_roots(gc_mark_child, NULL);
+  gc_mark_phase(exp);
+  gc_mark_phase(exp2);
+  gc_mark_phase(env);
+  gc_mark_phase(env2);
+  gc_mark_phase(list);
+  gc_stats_roots(HEAP_ROOTS_EVAL);
+
+  int r = gc_end();
+  gc_pause_end(t, HEAP_TRACE_COLLECT);
+  return r;
+}
+
+static int gc_collect(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size) {
+
+  // Out of memory during an incremental cycle. Cells allocated during
+  // the cycle survive it, so a full collection may still be needed.
+  if (heap_state.gc_inc_phase != GC_INC_IDLE) {
+    int r = gc_inc_finish();
+    if (!r || heap_state.num_alloc < heap_state.gc_inc_start) return r;
+  }
+
+  if (gc_minor_possible()) {
+    if (!gc_bg_sweep_finish()) return 0;
+    heap_state.gc_num_minor ++;
+    heap_trace(HEAP_TRACE_GC_MINOR, 0, heap_state.num_young, 0);
+    heap_state.gc_recovered = 0;
+    heap_state.gc_marked = 0;
+    gc_stats_cycle();
+
+    // Marks are sticky, marking stops at old cells.
+    gc_mark_remembered();
+    gc_stats_roots(HEAP_ROOTS_REMEMBERED);
+    gc_extra_roots(gc_mark_child, NULL);
+    gc_mark_phase(exp);
+    gc_mark_phase(exp2);
+    gc_mark_phase(exp3);
+    gc_mark_phase(env);
+    gc_mark_phase(env2);
+    gc_stats_roots(HEAP_ROOTS_EVAL);
+    gc_mark_aux(aux_data, aux_size);
+    gc_stats_roots(HEAP_ROOTS_STACK);
+
+    int r = gc_sweep_young();
+    gc_reset_nursery();
+    if (!r) return r;
+
+    if (gc_minor_sufficient()) return r;
+  }
+
+  gc_begin();
+
+  VALUE *roots[] = { &exp, &exp2, &exp3, &env, &env2 };
+  gc_mark_roots(roots, 5, aux_data, aux_size);
+
+  return gc_end();
+}
+
+int heap_perform_gc_aux(VALUE env, VALUE env2, VALUE exp, VALUE exp2, VALUE exp3, UINT *aux_data, unsigned int aux_size) {
+  uint32_t t = gc_pause_begin(HEAP_TRACE_COLLECT);
+  int r = gc_collect(env, env2, exp, exp2, exp3, aux_data, aux_size);
+  gc_pause_end(t, HEAP_TRACE_COLLECT);
+  return r;
+}
+
+static int gc_collect_compact(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+
+  gc_begin();
+
+  gc_mark_roots(roots, num_roots, aux_data, aux_size);
+
+  if (!gc_compact(roots, num_roots, aux_data, aux_size)) return 0;
+  gc_stats_live();
+  gc_release_region(heap_state.num_alloc);
+  gc_grow_policy();
+  return 1;
+}
+
+int heap_perform_gc_compact(VALUE **roots, unsigned int num_roots, UINT *aux_data, unsigned int aux_size) {
+
+  if (!heap_state.compacting) return 0;
+
+  uint32_t t = gc_pause_begin(HEAP_TRACE_COMPACT);
+  int r = gc_collect_compact(roots, num_roots, aux_data, aux_size);
+  gc_pause_end(t, HEAP_TRACE_COMPACT);
+  return r;
+}
+
+
+// construct, alter and break apart
+VALUE cons(VALUE car, VALUE cdr) {
+  VALUE addr = heap_allocate_cell(PTR_TYPE_CONS);
+  if ( is_ptr(addr)) {
+    set_car_(ref_cell(addr), car);
+    set_cdr_(ref_cell(addr), cdr);
+  }
+
+  // heap_allocate_cell returns MERROR if out of heap.
+  return addr;
+}
+
+VALUE car(VALUE c){
+
+  if (type_of(c) == VAL_TYPE_SYMBOL &&
+      c == NIL) {
+    return c; // if nil, return nil.
+  }
+
+  if (is_ptr(c) ){
+    cons_t *cell = ref_cell(c);
+    if (ptr_type(c) != PTR_TYPE_CONS) return read_car(cell);
+    VALUE v = (c & PTR_CDR_WORD) ? read_cdr(cell) : read_car(cell);
+    return is_invisible(v) ? read_car(ref_cell(v)) : v;
+  }
+  return enc_sym(symrepr_terror());
+}
+
+VALUE cdr(VALUE c){
+
+  if (type_of(c) == VAL_TYPE_SYMBOL &&
+      c == NIL) {
+    return c; // if nil, return nil.
+  }
+
+  if (type_of(c) == PTR_TYPE_CONS) {
+    cons_t *cell = ref_cell(c);
+    if (c & PTR_CDR_WORD) {
+      VALUE v = read_cdr(cell);
+      return is_invisible(v) ? read_cdr(ref_cell(v)) : enc_cons_ptr(dec_ptr(c) + 1);
+    }
+    if (gc_cdr_coded(dec_ptr(c))) {
+      VALUE v = read_car(cell);
+      return is_invisible(v) ? read_cdr(ref_cell(v)) : c | PTR_CDR_WORD;
+    }
+    return read_cdr(cell);
+  }
+  return enc_sym(symrepr_terror());
+}
+
+void set_car(VALUE c, VALUE v) {
+  if (is_ptr(c) && ptr_type(c) == PTR_TYPE_CONS) {
+    cons_t *cell = ref_cell(c);
+    if ((c & PTR_CDR_WORD) || gc_cdr_coded(dec_ptr(c))) {
+      VALUE w = (c & PTR_CDR_WORD) ? read_cdr(cell) : read_car(cell);
+      if (is_invisible(w)) {
+	set_car(set_ptr_type(w, PTR_TYPE_CONS), v);
+	return;
+      }
+      if (c & PTR_CDR_WORD) {
+	gc_write_barrier(c, cell, v);
+	if (heap_state.gc_inc_phase == GC_INC_MARK) {
+	  gc_inc_shade(w);
+	}
+	set_cdr_(cell, v);
+	return;
+      }
+    }
+    gc_write_barrier(c, cell, v);
+    if (heap_state.gc_inc_phase == GC_INC_MARK) {
+      gc_inc_shade(read_car(cell));
+    }
+    set_car_(cell,v);
+  }
+}
+
+// The cdr of an element of a cdr-coded cell is implied by its place.
+// The element is moved to a new cell, with the new cdr, and is
+// replaced by an invisible pointer to it. Returns false if there is
+// no free cell for that.
+bool set_cdr(VALUE c, VALUE v) {
+  if (type_of(c) == PTR_TYPE_CONS){
     cons_t *cell = ref_cell(c);
+    if ((c & PTR_CDR_WORD) || gc_cdr_coded(dec_ptr(c))) {
+      VALUE w = (c & PTR_CDR_WORD) ? read_cdr(cell) : read_car(cell);
+      if (is_invisible(w)) {
+	return set_cdr(set_ptr_type(w, PTR_TYPE_CONS), v);
+      }
+      VALUE n = cons(w, v);
+      if (!is_ptr(n)) return false;
+      VALUE inv = set_ptr_type(n, PTR_TYPE_INVISIBLE);
+      gc_write_barrier(c, cell, inv);
+      if (heap_state.gc_inc_phase == GC_INC_MARK) {
+	gc_inc_shade(w);
+	if (c & PTR_CDR_WORD) gc_inc_shade(gc_cdr_link(dec_ptr(c)));
+      }
+      if (c & PTR_CDR_WORD) {
+	set_cdr_(cell, inv);
+      } else {
+	set_car_(cell, inv);
+      }
+      return true;
+    }
+    gc_write_barrier(c, cell, v);
+    if (heap_state.gc_inc_phase == GC_INC_MARK) {
+      gc_inc_shade(read_cdr(cell));
+    }
     set_cdr_(cell,v);
+    return true;
   }
+  return false;
 }
 
 /* calculate length of a proper list */
@@ -496,34 +2909,40 @@ VALUE reverse(VALUE list) {
 
   VALUE curr = list;
 
+  VALUE cells = heap_allocate_cells(length(list));
+  if (type_of(cells) == VAL_TYPE_SYMBOL) {
+    return enc_sym(symrepr_merror());
+  }
+
   VALUE new_list = NIL;
   while (type_of(curr) == PTR_TYPE_CONS) {
-
-    new_list = cons(car(curr), new_list);
-    if (type_of(new_list) == VAL_TYPE_SYMBOL) {
-      return enc_sym(symrepr_merror());
-    }
+    VALUE c = cells;
+    cells = read_cdr(ref_cell(c));
+    set_car_(ref_cell(c), car(curr));
+    set_cdr_(ref_cell(c), new_list);
+    new_list = c;
     curr = cdr(curr);
   }
   return new_list;
 }
 
 VALUE copy(VALUE list) {
-  // TODO: a more efficient approach
-  VALUE res = NIL;
-
-  VALUE curr = list;
+  if (type_of(list) == VAL_TYPE_SYMBOL &&
+      list == NIL) {
+    return list;
+  }
 
-  while (type_of(curr) == PTR_TYPE_CONS) {
-    VALUE c = cons (car(curr), res);
-    if (type_of(c) == VAL_TYPE_SYMBOL) {
-      return enc_sym(symrepr_merror());
-    }
-    res = c;
-    curr = cdr(curr);
+  if (heap_state.heap_size - heap_state.num_alloc < length(list)) {
+    return enc_sym(symrepr_merror());
   }
 
-  return reverse(res); 
+  heap_list_t l;
+  heap_list_init(&l);
+
+  for (VALUE curr = list; type_of(curr) == PTR_TYPE_CONS; curr = cdr(curr)) {
+    if (!heap_list_append(&l, car(curr))) return enc_sym(symrepr_merror());
+  }
+  return heap_list_finish(&l, NIL);
 }
 
 
@@ -535,50 +2954,83 @@ VALUE copy(VALUE list) {
 
 // Arrays are part of the heap module because their lifespan is managed
 // by the garbage collector. The data in the array is not stored
-// in the "heap of cons cells".
-int heap_allocate_array(VALUE *res, unsigned int size, TYPE type){
-
-  array_t *array = malloc(sizeof(array_t));
-  // allocating a cell that will, to start with, be a cons cell.
-  VALUE cell  = heap_allocate_cell(PTR_TYPE_CONS);
+// in the "heap of cons cells". An array is allocated as one block,
+// from the arena if there is one.
 
+unsigned int heap_array_elt_size(TYPE type) {
   switch(type) {
-  case PTR_TYPE_BOXED_I: // array of I
-    array->data.i = (INT*)malloc(size * sizeof(INT));
-    if (array->data.i == NULL) return 0;
-    break;
-  case PTR_TYPE_BOXED_U: // array of U
-    array->data.u = (UINT*)malloc(size * sizeof(UINT));
-    if (array->data.u == NULL) return 0;
-    break;
-  case PTR_TYPE_BOXED_F: // array of Float
-    array->data.f = (float*)malloc(size * sizeof(float));
-    if (array->data.f == NULL) return 0;
-    break;
-  case VAL_TYPE_CHAR: // Array of Char
-    array->data.c = (char*)malloc(size * sizeof(char));
-    if (array->data.c == NULL) return 0;
-    break;
+  case PTR_TYPE_BOXED_I:
   case VAL_TYPE_I:
-    array->data.i = (INT*)malloc(size * sizeof(INT));
-    break;
+    return sizeof(INT);
+  case PTR_TYPE_BOXED_U:
   case VAL_TYPE_U:
-    array->data.u = (UINT*)malloc(size * sizeof(UINT));
-    break;
   case VAL_TYPE_SYMBOL:
-    array->data.u = (UINT*)malloc(size * sizeof(UINT));
-    break;
+    return sizeof(UINT);
+  case PTR_TYPE_BOXED_F:
+    return sizeof(FLOAT);
+  case VAL_TYPE_CHAR:
+    return sizeof(char);
   default:
-    *res = NIL;
     return 0;
   }
+}
+
+static array_t *arena_allocate(unsigned int num_bytes, UINT owner) {
+
+  unsigned int size = (unsigned int)ARENA_ALIGN(ARENA_ARRAY_OFFSET + num_bytes);
+
+  if (size > heap_state.arena_size - heap_state.arena_top) return NULL;
+
+  arena_block_t *block = (arena_block_t *)(heap_state.arena + heap_state.arena_top);
+  heap_state.arena_top += size;
+  block->owner = owner;
+  block->size = size;
+  return (array_t *)((unsigned char *)block + ARENA_ARRAY_OFFSET);
+}
+
+static array_t *array_block(UINT owner, unsigned int size, TYPE type) {
+
+  unsigned int num_bytes = (unsigned int)ARENA_DATA_OFFSET + size * heap_array_elt_size(type);
+
+  array_t *array;
+  if (heap_state.arena) {
+    array = arena_allocate(num_bytes, owner);
+  } else {
+    array = (array_t *)mem_malloc(MEM_HEAP, num_bytes);
+  }
+  if (array == NULL) return NULL;
 
   array->elt_type = type;
   array->size = size;
+  array->data.c = (char *)array + ARENA_DATA_OFFSET;
+  return array;
+}
+
+int heap_allocate_array(VALUE *res, unsigned int size, TYPE type){
+
+  if (heap_array_elt_size(type) == 0) {
+    *res = NIL;
+    return 0;
+  }
+
+  // allocating a cell that will, to start with, be a cons cell.
+  VALUE cell  = heap_allocate_cell(PTR_TYPE_CONS);
+  if (type_of(cell) == VAL_TYPE_SYMBOL) {
+    *res = cell;
+    return 0;
+  }
+
+  array_t *array = array_block(dec_ptr(cell), size, type);
+  if (array == NULL) {
+    *res = enc_sym(symrepr_merror());
+    return 0;
+  }
 
   set_car(cell, (UINT)array);
   set_cdr(cell, enc_sym(DEF_REPR_ARRAY_TYPE));
 
+  heap_trace(HEAP_TRACE_ARRAY_ALLOC, 0, dec_ptr(cell), size * heap_array_elt_size(type));
+
   cell = cell | PTR_TYPE_ARRAY;
 
   *res = cell;
@@ -587,3 +3039,50 @@ int heap_allocate_array(VALUE *res, unsigned int size, TYPE type){
 
   return 1;
 }
+
+// Place arrays in an arena of num_bytes bytes. Only possible before
+// any array has been allocated.
+int heap_set_array_arena_addr(unsigned char *addr, unsigned int num_bytes) {
+
+  if (!heap_state.heap ||
+      heap_state.arena ||
+      heap_state.num_alloc_arrays) return 0;
+
+  unsigned int skip = (unsigned int)(ARENA_ALIGN((uintptr_t)addr) - (uintptr_t)addr);
+  if (skip >= num_bytes) return 0;
+
+  heap_state.arena = addr + skip;
+  heap_state.arena_size = num_bytes - skip;
+  heap_state.arena_top = 0;
+  heap_state.arena_free = 0;
+  heap_state.arena_malloced = false;
+  return 1;
+}
+
+int heap_set_array_arena(unsigned int num_bytes) {
+
+  unsigned char *arena = (unsigned char *)mem_malloc(MEM_HEAP, num_bytes);
+  if (!arena) return 0;
+
+  if (!heap_set_array_arena_addr(arena, num_bytes)) {
+    mem_free(arena);
+    return 0;
+  }
+  heap_state.arena_malloced = true;
+  return 1;
+}
+
+// Give the array cell at index ix a new copy of the array data, the
+// car of the cell is the address of the array in a heap image.
+int heap_restore_array(unsigned int ix, unsigned int size, TYPE type, void *data) {
+
+  if (ix >= heap_state.heap_size || heap_array_elt_size(type) == 0) return 0;
+
+  array_t *array = array_block(ix, size, type);
+  if (array == NULL) return 0;
+
+  memcpy(array->data.c, data, size * heap_array_elt_size(type));
+  heap_state.heap[ix].car = (UINT)array;
+  heap_state.num_alloc_arrays ++;
+  return 1;
+}
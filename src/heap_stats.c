@@ -0,0 +1,124 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "symrepr.h"
+#include "heap.h"
+#include "heap_stats.h"
+#include "mem.h"
+
+static char *root_set_names[HEAP_NUM_ROOT_SETS] = {
+  "eval", "stack", "extern", "frozen", "remembered"
+};
+
+// Nothing is allocated after the first failure, the caller returns
+// MERROR and the evaluator collects and calls the extension again.
+static VALUE stats_cons(VALUE car, VALUE cdr, bool *ok) {
+  if (!*ok) return enc_sym(symrepr_nil());
+  VALUE c = cons(car, cdr);
+  if (!is_ptr(c)) *ok = false;
+  return c;
+}
+
+static VALUE stats_entry(char *name, VALUE v, VALUE rest, bool *ok) {
+  UINT sym;
+  if (!symrepr_lookup(name, &sym) &&
+      !symrepr_addsym(name, &sym)) {
+    *ok = false;
+    return rest;
+  }
+  return stats_cons(stats_cons(enc_sym(sym), v, ok), rest, ok);
+}
+
+static VALUE stats_total(uint64_t x, bool *ok) {
+  if (!*ok) return enc_sym(symrepr_nil());
+  VALUE v = enc_U((UINT)x);
+  if (!is_ptr(v)) *ok = false;
+  return v;
+}
+
+VALUE ext_heap_stats(VALUE *args, int argn) {
+  (void) args;
+  (void) argn;
+
+  heap_stats_t s;
+  heap_get_stats(&s);
+
+  bool ok = true;
+  VALUE nil = enc_sym(symrepr_nil());
+
+  VALUE hist = nil;
+  for (int i = HEAP_PAUSE_BUCKETS - 1; i >= 0; i --) {
+    hist = stats_cons(enc_u(s.pause_hist[i]), hist, &ok);
+  }
+
+  VALUE marked = nil;
+  for (int i = HEAP_NUM_ROOT_SETS - 1; i >= 0; i --) {
+    marked = stats_entry(root_set_names[i], enc_u(s.marked[i]), marked, &ok);
+  }
+
+  VALUE res = nil;
+  res = stats_entry("scope-kept", enc_u(s.scope_kept), res, &ok);
+  res = stats_entry("scope-freed", enc_u(s.scope_freed), res, &ok);
+  res = stats_entry("array-bytes", enc_u(s.live_array_bytes), res, &ok);
+  res = stats_entry("live-arrays", enc_u(s.live_arrays), res, &ok);
+  res = stats_entry("live-boxed", enc_u(s.live_boxed), res, &ok);
+  res = stats_entry("live-cons", enc_u(s.live_cons), res, &ok);
+  res = stats_entry("alloc-rate", enc_u(s.alloc_rate), res, &ok);
+  res = stats_entry("alloc-total", stats_total(s.alloc_total, &ok), res, &ok);
+  res = stats_entry("marked", marked, res, &ok);
+  res = stats_entry("pause-hist", hist, res, &ok);
+  res = stats_entry("pause-total", stats_total(s.pause_total, &ok), res, &ok);
+  res = stats_entry("pause-max", enc_u(s.pause_max), res, &ok);
+  res = stats_entry("pauses", enc_u(s.num_pauses), res, &ok);
+  res = stats_entry("minor", enc_u(s.num_minor), res, &ok);
+  res = stats_entry("gc", enc_u(s.num_gc), res, &ok);
+  res = stats_entry("frozen", enc_u(s.num_frozen), res, &ok);
+  res = stats_entry("freelist", enc_u(s.freelist_length), res, &ok);
+  res = stats_entry("free", enc_u(s.num_free), res, &ok);
+
+  return ok ? res : enc_sym(symrepr_merror());
+}
+
+VALUE ext_mem_stats(VALUE *args, int argn) {
+  (void) args;
+  (void) argn;
+
+  mem_stats_t s;
+  mem_get_stats(&s);
+
+  bool ok = true;
+  VALUE nil = enc_sym(symrepr_nil());
+
+  VALUE pool = nil;
+  pool = stats_cons(enc_u((UINT)s.pool_largest), pool, &ok);
+  pool = stats_cons(enc_u((UINT)s.pool_free), pool, &ok);
+  pool = stats_cons(enc_u((UINT)s.pool_size), pool, &ok);
+
+  VALUE res = stats_entry("pool", pool, nil, &ok);
+  for (int i = MEM_NUM_MODULES - 1; i >= 0; i --) {
+    mem_module_stats_t *m = &s.module[i];
+    VALUE v = nil;
+    v = stats_cons(enc_u(m->num_failed), v, &ok);
+    v = stats_cons(enc_u(m->num_alloc), v, &ok);
+    v = stats_cons(enc_u((UINT)m->peak_bytes), v, &ok);
+    v = stats_cons(enc_u(m->blocks), v, &ok);
+    v = stats_cons(enc_u((UINT)m->bytes), v, &ok);
+    res = stats_entry((char *)mem_module_name((mem_module_t)i), v, res, &ok);
+  }
+
+  return ok ? res : enc_sym(symrepr_merror());
+}
@@ -0,0 +1,135 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "heap_trace.h"
+
+// The background sweep and the mark threads write events too. A
+// writer claims a slot by incrementing head and publishes the event
+// by writing its seq last, the reader checks seq before and after
+// copying the event.
+#if defined(GC_PARALLEL_MARK) || defined(GC_BACKGROUND_SWEEP)
+#define TRACE_CLAIM(p)       __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#define TRACE_LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define TRACE_STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define TRACE_FENCE()        __atomic_thread_fence(__ATOMIC_ACQ_REL)
+#else
+#define TRACE_CLAIM(p)       ((*(p))++)
+#define TRACE_LOAD(p)        (*(p))
+#define TRACE_STORE(p, v)    (*(p) = (v))
+#define TRACE_FENCE()
+#endif
+
+typedef struct {
+  heap_trace_event_t *events;
+  uint32_t mask;           // Number of events - 1, a power of two
+  uint32_t head;           // Events written
+  uint32_t tail;           // Events read or lost
+  uint32_t lost;
+} trace_ring_t;
+
+uint32_t heap_trace_mask = 0;
+
+static trace_ring_t trace;
+static uint64_t (*trace_clock)(void) = NULL;
+
+// Events are written to the num_bytes bytes at addr, the events in
+// mask (HEAP_TRACE_BIT) are traced.
+int heap_trace_init(unsigned char *addr, unsigned int num_bytes, uint32_t mask) {
+
+  heap_trace_mask = 0;
+
+  unsigned int skip = (unsigned int)(-(uintptr_t)addr & (sizeof(uint64_t) - 1));
+  if (!addr || num_bytes < skip) return 0;
+  uint32_t n = (num_bytes - skip) / sizeof(heap_trace_event_t);
+  if (n < 2) return 0;
+  while (n & (n - 1)) n &= n - 1;
+
+  trace.events = (heap_trace_event_t *)(addr + skip);
+  memset(trace.events, 0, n * sizeof(heap_trace_event_t));
+  trace.mask = n - 1;
+  trace.head = 0;
+  trace.tail = 0;
+  trace.lost = 0;
+  TRACE_STORE(&heap_trace_mask, mask);
+  return 1;
+}
+
+// Events are no longer written, the ones in the buffer can still be
+// read.
+void heap_trace_stop(void) {
+  TRACE_STORE(&heap_trace_mask, 0);
+}
+
+void heap_trace_set_clock(uint64_t (*nsec)(void)) {
+  trace_clock = nsec;
+}
+
+void heap_trace_emit(uint16_t type, uint16_t sub, uint32_t a, uint32_t b) {
+  if (!trace.events) return;
+  uint32_t i = TRACE_CLAIM(&trace.head);
+  heap_trace_event_t *e = &trace.events[i & trace.mask];
+  TRACE_STORE(&e->seq, 0);
+  TRACE_FENCE();
+  e->time = trace_clock ? trace_clock() : 0;
+  e->a = a;
+  e->b = b;
+  e->type = type;
+  e->sub = sub;
+  TRACE_STORE(&e->seq, i + 1);
+}
+
+// Copy up to max events, oldest first, out of the buffer. Events that
+// were overwritten before they were read are counted as lost.
+unsigned int heap_trace_read(heap_trace_event_t *events, unsigned int max) {
+
+  if (!trace.events) return 0;
+
+  uint32_t head = TRACE_LOAD(&trace.head);
+  if (head - trace.tail > trace.mask + 1) {
+    trace.lost += head - trace.tail - (trace.mask + 1);
+    trace.tail = head - (trace.mask + 1);
+  }
+
+  unsigned int n = 0;
+  while (n < max && trace.tail != head) {
+    heap_trace_event_t *e = &trace.events[trace.tail & trace.mask];
+    uint32_t seq = TRACE_LOAD(&e->seq);
+    if (seq != trace.tail + 1) {
+      // Still being written, or already overwritten by a newer event.
+      if (seq == 0 || (int32_t)(seq - (trace.tail + 1)) < 0) break;
+      trace.lost ++;
+      trace.tail ++;
+      continue;
+    }
+    events[n] = *e;
+    TRACE_FENCE();
+    if (TRACE_LOAD(&e->seq) != seq) {
+      trace.lost ++;
+    } else {
+      n ++;
+    }
+    trace.tail ++;
+  }
+  return n;
+}
+
+uint32_t heap_trace_lost(void) {
+  return trace.lost;
+}
@@ -0,0 +1,304 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "heap.h"
+#include "symrepr.h"
+#include "mem.h"
+
+#ifdef HEAP_IMAGE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+   Layout, every part starts at a multiple of the size of a cons cell:
+
+   header | cards | cdr bits | symbols | arrays | cells
+
+   A symbol is an image_symbol_t followed by the name. An array is an
+   image_array_t followed by the data. In the cells the car of an
+   array cell is the address the array had when the image was saved,
+   it is replaced by a fresh copy of the array on load. The cards
+   record the written cells of the frozen segment, if there is one.
+   The cdr bits are the bitmap of cdr-coded cells, if the heap has one.
+*/
+
+#define IMAGE_MAGIC          0x494D424Cu
+#define IMAGE_VERSION        3
+#define IMAGE_ALIGN(n)       (((n) + sizeof(cons_t) - 1) & ~(sizeof(cons_t) - 1))
+#define IMAGE_WORD_BITS      (sizeof(UINT) * 8)
+#define IMAGE_CARD_WORDS(f)  (((f) / IMAGE_WORD_BITS + IMAGE_WORD_BITS - 1) / IMAGE_WORD_BITS)
+
+typedef struct {
+  UINT magic;
+  UINT version;
+  UINT cell_size;
+  UINT heap_size;
+  UINT num_alloc;
+  UINT bump;
+  UINT frozen;
+  UINT num_cards;
+  UINT num_cdr_words;
+  VALUE freelist;
+  VALUE env;
+  UINT num_symbols;
+  UINT num_arrays;
+  UINT cells_offset;
+  UINT size;
+} image_header_t;
+
+typedef struct {
+  UINT id;
+  UINT len;                 // Length of the name including the terminating 0
+} image_symbol_t;
+
+typedef struct {
+  UINT ix;                  // Index of the array cell
+  UINT elt_type;
+  UINT size;
+  UINT num_bytes;
+} image_array_t;
+
+static unsigned char *image = NULL;
+static size_t image_size = 0;
+static UINT *image_gc_bits = NULL;
+
+static bool write_aligned(FILE *fp, const void *data, size_t n) {
+  static const unsigned char pad[sizeof(cons_t)] = {0};
+  size_t p = IMAGE_ALIGN(n) - n;
+  return (fwrite(data, 1, n, fp) == n &&
+	  fwrite(pad, 1, p, fp) == p);
+}
+
+typedef struct {
+  FILE *fp;
+  UINT num_symbols;
+} symbol_writer_t;
+
+static bool write_symbol(UINT id, char *name, void *arg) {
+  symbol_writer_t *w = (symbol_writer_t *)arg;
+  image_symbol_t sym;
+  sym.id = id;
+  sym.len = (UINT)strlen(name) + 1;
+  w->num_symbols ++;
+  return (write_aligned(w->fp, &sym, sizeof(sym)) &&
+	  write_aligned(w->fp, name, sym.len));
+}
+
+static bool write_arrays(FILE *fp, heap_state_t *hs, UINT *num_arrays) {
+  for (unsigned int i = 0; i < hs->heap_size; i ++) {
+    VALUE cdr = hs->heap[i].cdr;
+    if (type_of(cdr) != VAL_TYPE_SYMBOL || dec_sym(cdr) != DEF_REPR_ARRAY_TYPE) continue;
+    if (hs->cdr_bits &&
+	(hs->cdr_bits[i / IMAGE_WORD_BITS] & ((UINT)1 << (i % IMAGE_WORD_BITS)))) continue;
+
+    array_t *array = (array_t *)hs->heap[i].car;
+    image_array_t arr;
+    arr.ix = i;
+    arr.elt_type = array->elt_type;
+    arr.size = array->size;
+    arr.num_bytes = array->size * heap_array_elt_size(array->elt_type);
+    if (!write_aligned(fp, &arr, sizeof(arr)) ||
+	!write_aligned(fp, array->data.c, arr.num_bytes)) return false;
+    (*num_arrays) ++;
+  }
+  return true;
+}
+
+// Save the heap, with env as the global environment, and the symbol
+// table. The heap is collected first, with env and the roots pushed
+// by heap_push_root as the only roots, so that no dead arrays are
+// saved. Nothing else may be live, so it is not called during an
+// evaluation.
+int image_save(char *filename, VALUE env) {
+
+  if (!heap_perform_gc(env) ||
+      !heap_finish_gc()) return 0;
+
+  heap_state_t hs;
+  heap_get_state(&hs);
+
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) return 0;
+
+  image_header_t h;
+  memset(&h, 0, sizeof(h));
+  bool ok = write_aligned(fp, &h, sizeof(h));
+
+  h.num_cards = IMAGE_CARD_WORDS(hs.frozen);
+  if (h.num_cards > 0) {
+    ok = ok && write_aligned(fp, hs.frozen_cards, h.num_cards * sizeof(UINT));
+  }
+
+  h.num_cdr_words = hs.cdr_bits ? hs.gc_bits_size : 0;
+  if (h.num_cdr_words > 0) {
+    ok = ok && write_aligned(fp, hs.cdr_bits, h.num_cdr_words * sizeof(UINT));
+  }
+
+  symbol_writer_t w;
+  w.fp = fp;
+  w.num_symbols = 0;
+  ok = ok && symrepr_each(write_symbol, &w);
+
+  h.num_arrays = 0;
+  ok = ok && write_arrays(fp, &hs, &h.num_arrays);
+
+  long cells_offset = ftell(fp);
+  ok = ok && cells_offset > 0;
+  ok = ok && fwrite(hs.heap, sizeof(cons_t), hs.heap_size, fp) == hs.heap_size;
+
+  h.magic = IMAGE_MAGIC;
+  h.version = IMAGE_VERSION;
+  h.cell_size = sizeof(cons_t);
+  h.heap_size = hs.heap_size;
+  h.num_alloc = hs.num_alloc;
+  h.bump = hs.bump;
+  h.frozen = hs.frozen;
+  h.freelist = hs.freelist;
+  h.env = env;
+  h.num_symbols = w.num_symbols;
+  h.cells_offset = (UINT)cells_offset;
+  h.size = (UINT)(cells_offset + (long)(hs.heap_size * sizeof(cons_t)));
+
+  ok = ok && fseek(fp, 0, SEEK_SET) == 0;
+  ok = ok && fwrite(&h, sizeof(h), 1, fp) == 1;
+  if (fclose(fp) != 0) ok = false;
+  return ok;
+}
+
+static bool load_parts(image_header_t *h) {
+
+  size_t pos = (IMAGE_ALIGN(sizeof(image_header_t)) +
+		IMAGE_ALIGN(h->num_cards * sizeof(UINT)) +
+		IMAGE_ALIGN(h->num_cdr_words * sizeof(UINT)));
+
+  for (UINT i = 0; i < h->num_symbols; i ++) {
+    image_symbol_t *sym = (image_symbol_t *)(image + pos);
+    pos += IMAGE_ALIGN(sizeof(image_symbol_t));
+    if (pos > h->cells_offset ||
+	sym->len == 0 ||
+	sym->len > h->cells_offset - pos) return false;
+    char *name = (char *)(image + pos);
+    if (name[sym->len - 1] != 0 ||
+	!symrepr_restore(name, sym->id)) return false;
+    pos += IMAGE_ALIGN(sym->len);
+  }
+
+  for (UINT i = 0; i < h->num_arrays; i ++) {
+    image_array_t *arr = (image_array_t *)(image + pos);
+    pos += IMAGE_ALIGN(sizeof(image_array_t));
+    if (pos > h->cells_offset ||
+	arr->num_bytes > h->cells_offset - pos ||
+	arr->num_bytes != arr->size * heap_array_elt_size(arr->elt_type) ||
+	!heap_restore_array(arr->ix, arr->size, arr->elt_type, image + pos)) return false;
+    pos += IMAGE_ALIGN(arr->num_bytes);
+  }
+  return true;
+}
+
+// Map an image saved by image_save. Returns 0 if the file is not an
+// image for this build, the heap is then left uninitialized.
+int image_load(char *filename, VALUE *env) {
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(image_header_t)) {
+    close(fd);
+    return 0;
+  }
+
+  image_size = (size_t)st.st_size;
+  void *m = mmap(NULL, image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) return 0;
+  image = (unsigned char *)m;
+
+  image_header_t *h = (image_header_t *)image;
+  size_t bits_words = (h->heap_size + IMAGE_WORD_BITS - 1) / IMAGE_WORD_BITS;
+
+  if (h->magic != IMAGE_MAGIC ||
+      h->version != IMAGE_VERSION ||
+      h->cell_size != sizeof(cons_t) ||
+      h->size != image_size ||
+      h->cells_offset % sizeof(cons_t) != 0 ||
+      h->num_cards != IMAGE_CARD_WORDS(h->frozen) ||
+      (h->num_cdr_words != 0 && h->num_cdr_words != bits_words) ||
+      (IMAGE_ALIGN(sizeof(image_header_t)) +
+       IMAGE_ALIGN(h->num_cards * sizeof(UINT)) +
+       h->num_cdr_words * sizeof(UINT)) > h->cells_offset ||
+      h->cells_offset > image_size ||
+      (image_size - h->cells_offset) / sizeof(cons_t) != h->heap_size) {
+    image_del();
+    return 0;
+  }
+
+  unsigned char *cards = image + IMAGE_ALIGN(sizeof(image_header_t));
+  unsigned char *cdr_bits = cards + IMAGE_ALIGN(h->num_cards * sizeof(UINT));
+
+  image_gc_bits = (UINT *)mem_malloc(MEM_IMAGE, bits_words * sizeof(UINT));
+  if (!image_gc_bits ||
+      !heap_init_image((cons_t *)(image + h->cells_offset), h->heap_size, image_gc_bits,
+		       h->freelist, h->num_alloc, h->bump, h->frozen,
+		       (UINT *)cards,
+		       h->num_cdr_words ? (UINT *)cdr_bits : NULL) ||
+      !load_parts(h)) {
+    image_del();
+    return 0;
+  }
+
+  *env = h->env;
+  return 1;
+}
+
+// Unmap the image, after heap_del.
+void image_del(void) {
+  if (image) munmap(image, image_size);
+  mem_free(image_gc_bits);
+  image = NULL;
+  image_size = 0;
+  image_gc_bits = NULL;
+}
+
+#else
+
+int image_save(char *filename, VALUE env) {
+  (void) filename;
+  (void) env;
+  return 0;
+}
+
+int image_load(char *filename, VALUE *env) {
+  (void) filename;
+  (void) env;
+  return 0;
+}
+
+void image_del(void) {
+}
+
+#endif
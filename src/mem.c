@@ -0,0 +1,396 @@
+/*
+    Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mem.h"
+#if defined(GC_PARALLEL_MARK) || defined(GC_BACKGROUND_SWEEP)
+#include <pthread.h>
+#endif
+
+// The background sweep frees arrays from a thread of its own.
+#if defined(GC_PARALLEL_MARK) || defined(GC_BACKGROUND_SWEEP)
+static pthread_mutex_t mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define MEM_LOCK()   pthread_mutex_lock(&mem_mutex)
+#define MEM_UNLOCK() pthread_mutex_unlock(&mem_mutex)
+#else
+#define MEM_LOCK()
+#define MEM_UNLOCK()
+#endif
+
+static char *module_names[MEM_NUM_MODULES] = {
+  "heap", "stack", "eval", "symrepr", "extensions",
+  "tokpar", "bytecode", "image", "compression"
+};
+
+// Every block starts with the size the caller asked for and the
+// module, the union keeps the data that follows aligned.
+typedef union {
+  struct {
+    size_t size;
+    unsigned int module;
+  } h;
+  double d;
+  void *p;
+} mem_header_t;
+
+static void *libc_malloc(size_t size, void *arg) {
+  (void) arg;
+  return malloc(size);
+}
+
+static void libc_free(void *ptr, void *arg) {
+  (void) arg;
+  free(ptr);
+}
+
+static mem_allocator_t mem_allocator = { libc_malloc, libc_free, NULL };
+static mem_stats_t mem_stats;
+static bool mem_use_libc = true;   // realloc can be used
+
+/* ------------------------------------------------------------
+   TLSF pool
+
+   Free blocks are kept in lists by size class. The first level
+   class is the position of the highest set bit of the size, the
+   second level splits that range in POOL_SL_COUNT parts. Sizes
+   below 1 << POOL_FL_SHIFT all go in first level class 0. Two
+   bitmaps tell which lists are non-empty, so a list with blocks
+   large enough is found with a couple of bit scans. A freed block
+   is merged with its free neighbours right away.
+   ------------------------------------------------------------ */
+
+typedef struct pool_block_s {
+  struct pool_block_s *prev_phys;  // Block before this one in memory
+  size_t size;                     // Bytes of data, bit 0 is set while free
+  struct pool_block_s *next_free;  // Free list links, only while free
+  struct pool_block_s *prev_free;
+} pool_block_t;
+
+#define POOL_ALIGN_LOG   (sizeof(void *) == 8 ? 4 : 3)
+#define POOL_ALIGN       ((size_t)1 << POOL_ALIGN_LOG)
+#define POOL_OVERHEAD    offsetof(pool_block_t, next_free)
+#define POOL_MIN_SIZE    (sizeof(pool_block_t) - POOL_OVERHEAD)
+#define POOL_SL_LOG      4
+#define POOL_SL_COUNT    (1 << POOL_SL_LOG)
+#define POOL_FL_SHIFT    (POOL_SL_LOG + POOL_ALIGN_LOG)
+#define POOL_FL_COUNT    (31 - POOL_FL_SHIFT)
+#define POOL_MAX_BYTES   ((size_t)1 << 30)
+#define POOL_FREE        ((size_t)1)
+
+#define POOL_ROUND(n)    (((n) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+typedef struct {
+  uint32_t fl_bitmap;
+  uint32_t sl_bitmap[POOL_FL_COUNT];
+  pool_block_t *heads[POOL_FL_COUNT][POOL_SL_COUNT];
+  size_t size;
+  size_t free_bytes;
+} pool_t;
+
+static pool_t pool;
+
+static inline int pool_fls(size_t n) {
+  return 31 - __builtin_clz((unsigned int)n);
+}
+
+static inline size_t pool_size_of(pool_block_t *b) {
+  return b->size & ~POOL_FREE;
+}
+
+static inline pool_block_t *pool_next(pool_block_t *b) {
+  return (pool_block_t *)((unsigned char *)b + POOL_OVERHEAD + pool_size_of(b));
+}
+
+static void pool_mapping(size_t size, unsigned int *fl, unsigned int *sl) {
+  if (size < ((size_t)1 << POOL_FL_SHIFT)) {
+    *fl = 0;
+    *sl = (unsigned int)(size >> POOL_ALIGN_LOG);
+  } else {
+    int b = pool_fls(size);
+    *fl = (unsigned int)(b - POOL_FL_SHIFT + 1);
+    *sl = (unsigned int)(size >> (b - POOL_SL_LOG)) - POOL_SL_COUNT;
+  }
+}
+
+static void pool_insert(pool_block_t *b) {
+  unsigned int fl, sl;
+  pool_mapping(pool_size_of(b), &fl, &sl);
+  b->size |= POOL_FREE;
+  b->prev_free = NULL;
+  b->next_free = pool.heads[fl][sl];
+  if (b->next_free) b->next_free->prev_free = b;
+  pool.heads[fl][sl] = b;
+  pool.fl_bitmap |= (uint32_t)1 << fl;
+  pool.sl_bitmap[fl] |= (uint32_t)1 << sl;
+}
+
+static void pool_remove(pool_block_t *b) {
+  unsigned int fl, sl;
+  pool_mapping(pool_size_of(b), &fl, &sl);
+  if (b->next_free) b->next_free->prev_free = b->prev_free;
+  if (b->prev_free) {
+    b->prev_free->next_free = b->next_free;
+  } else {
+    pool.heads[fl][sl] = b->next_free;
+    if (!b->next_free) {
+      pool.sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+      if (!pool.sl_bitmap[fl]) pool.fl_bitmap &= ~((uint32_t)1 << fl);
+    }
+  }
+  b->size &= ~POOL_FREE;
+}
+
+// Take a free block of at least size bytes out of the lists. The size
+// is rounded up to the next class so that any block in the list found
+// is large enough.
+static pool_block_t *pool_find(size_t size) {
+  if (size >= ((size_t)1 << POOL_FL_SHIFT)) {
+    size += ((size_t)1 << (pool_fls(size) - POOL_SL_LOG)) - 1;
+  }
+  unsigned int fl, sl;
+  pool_mapping(size, &fl, &sl);
+  if (fl >= POOL_FL_COUNT) return NULL;
+
+  uint32_t sl_map = pool.sl_bitmap[fl] & (~(uint32_t)0 << sl);
+  if (!sl_map) {
+    uint32_t fl_map = pool.fl_bitmap & (~(uint32_t)0 << (fl + 1));
+    if (!fl_map) return NULL;
+    fl = (unsigned int)__builtin_ctz(fl_map);
+    sl_map = pool.sl_bitmap[fl];
+  }
+  sl = (unsigned int)__builtin_ctz(sl_map);
+  pool_block_t *b = pool.heads[fl][sl];
+  pool_remove(b);
+  return b;
+}
+
+static void *pool_malloc(size_t size, void *arg) {
+  (void) arg;
+  if (size > POOL_MAX_BYTES) return NULL;
+  size_t need = POOL_ROUND(size);
+  if (need < POOL_MIN_SIZE) need = POOL_MIN_SIZE;
+
+  pool_block_t *b = pool_find(need);
+  if (!b) return NULL;
+
+  size_t b_size = pool_size_of(b);
+  if (b_size >= need + POOL_OVERHEAD + POOL_MIN_SIZE) {
+    pool_block_t *rest = (pool_block_t *)((unsigned char *)b + POOL_OVERHEAD + need);
+    rest->prev_phys = b;
+    rest->size = b_size - need - POOL_OVERHEAD;
+    pool_next(rest)->prev_phys = rest;
+    b->size = need;
+    pool_insert(rest);
+    pool.free_bytes -= POOL_OVERHEAD;
+  }
+  pool.free_bytes -= pool_size_of(b);
+  return (unsigned char *)b + POOL_OVERHEAD;
+}
+
+static void pool_free(void *ptr, void *arg) {
+  (void) arg;
+  pool_block_t *b = (pool_block_t *)((unsigned char *)ptr - POOL_OVERHEAD);
+  pool.free_bytes += pool_size_of(b);
+
+  pool_block_t *next = pool_next(b);
+  if (next->size & POOL_FREE) {
+    pool_remove(next);
+    b->size += POOL_OVERHEAD + next->size;
+    pool_next(b)->prev_phys = b;
+    pool.free_bytes += POOL_OVERHEAD;
+  }
+  pool_block_t *prev = b->prev_phys;
+  if (prev && (prev->size & POOL_FREE)) {
+    pool_remove(prev);
+    prev->size += POOL_OVERHEAD + b->size;
+    pool_next(prev)->prev_phys = prev;
+    pool.free_bytes += POOL_OVERHEAD;
+    b = prev;
+  }
+  pool_insert(b);
+}
+
+static size_t pool_largest(void) {
+  if (!pool.fl_bitmap) return 0;
+  unsigned int fl = (unsigned int)pool_fls(pool.fl_bitmap);
+  unsigned int sl = (unsigned int)pool_fls(pool.sl_bitmap[fl]);
+  size_t largest = 0;
+  for (pool_block_t *b = pool.heads[fl][sl]; b; b = b->next_free) {
+    if (pool_size_of(b) > largest) largest = pool_size_of(b);
+  }
+  return largest;
+}
+
+static bool mem_in_use(void) {
+  for (int i = 0; i < MEM_NUM_MODULES; i ++) {
+    if (mem_stats.module[i].blocks) return true;
+  }
+  return false;
+}
+
+// Blocks are allocated with allocator, NULL restores malloc. Only
+// possible while no block is in use.
+int mem_set_allocator(mem_allocator_t *allocator) {
+  int res = 0;
+  MEM_LOCK();
+  if (!mem_in_use()) {
+    if (allocator) {
+      mem_allocator = *allocator;
+      mem_use_libc = false;
+    } else {
+      mem_allocator.malloc = libc_malloc;
+      mem_allocator.free = libc_free;
+      mem_allocator.arg = NULL;
+      mem_use_libc = true;
+    }
+    pool.size = 0;
+    res = 1;
+  }
+  MEM_UNLOCK();
+  return res;
+}
+
+// Allocate all blocks in the num_bytes bytes at addr. Only possible
+// while no block is in use.
+int mem_pool_init(unsigned char *addr, size_t num_bytes) {
+
+  uintptr_t start = ((uintptr_t)addr + POOL_ALIGN - 1) & ~(uintptr_t)(POOL_ALIGN - 1);
+  if (num_bytes < start - (uintptr_t)addr) return 0;
+  size_t size = (num_bytes - (start - (uintptr_t)addr)) & ~(POOL_ALIGN - 1);
+  if (size > POOL_MAX_BYTES) size = POOL_MAX_BYTES;
+  if (size < 2 * POOL_OVERHEAD + POOL_MIN_SIZE) return 0;
+
+  mem_allocator_t allocator = { pool_malloc, pool_free, NULL };
+  if (!mem_set_allocator(&allocator)) return 0;
+
+  MEM_LOCK();
+  memset(&pool, 0, sizeof(pool_t));
+  // The last block is an empty block that is never free, so that
+  // every free block has a block after it.
+  pool_block_t *first = (pool_block_t *)start;
+  first->prev_phys = NULL;
+  first->size = size - 2 * POOL_OVERHEAD;
+  pool_block_t *last = pool_next(first);
+  last->prev_phys = first;
+  last->size = 0;
+  pool_insert(first);
+  pool.size = size;
+  pool.free_bytes = pool_size_of(first);
+  MEM_UNLOCK();
+  return 1;
+}
+
+void *mem_malloc(mem_module_t module, size_t size) {
+  if (module >= MEM_NUM_MODULES ||
+      size > SIZE_MAX - sizeof(mem_header_t)) return NULL;
+
+  MEM_LOCK();
+  mem_module_stats_t *m = &mem_stats.module[module];
+  mem_header_t *h = mem_allocator.malloc(sizeof(mem_header_t) + size, mem_allocator.arg);
+  if (!h) {
+    m->num_failed ++;
+    MEM_UNLOCK();
+    return NULL;
+  }
+  h->h.size = size;
+  h->h.module = module;
+  m->bytes += size;
+  if (m->bytes > m->peak_bytes) m->peak_bytes = m->bytes;
+  m->blocks ++;
+  m->num_alloc ++;
+  MEM_UNLOCK();
+  return h + 1;
+}
+
+void *mem_calloc(mem_module_t module, size_t num, size_t size) {
+  if (size && num > SIZE_MAX / size) return NULL;
+  void *ptr = mem_malloc(module, num * size);
+  if (ptr) memset(ptr, 0, num * size);
+  return ptr;
+}
+
+// The block is freed, and accounted, as part of the module that
+// allocated it.
+void mem_free(void *ptr) {
+  if (!ptr) return;
+  mem_header_t *h = (mem_header_t *)ptr - 1;
+
+  MEM_LOCK();
+  mem_module_stats_t *m = &mem_stats.module[h->h.module];
+  m->bytes -= h->h.size;
+  m->blocks --;
+  mem_allocator.free(h, mem_allocator.arg);
+  MEM_UNLOCK();
+}
+
+// A block that has grown keeps its module, ptr NULL allocates for
+// module.
+void *mem_realloc(mem_module_t module, void *ptr, size_t size) {
+  if (!ptr) return mem_malloc(module, size);
+  if (size > SIZE_MAX - sizeof(mem_header_t)) return NULL;
+  mem_header_t *h = (mem_header_t *)ptr - 1;
+
+  MEM_LOCK();
+  if (mem_use_libc) {
+    mem_module_stats_t *m = &mem_stats.module[h->h.module];
+    size_t old_size = h->h.size;
+    mem_header_t *n = realloc(h, sizeof(mem_header_t) + size);
+    if (!n) {
+      m->num_failed ++;
+      MEM_UNLOCK();
+      return NULL;
+    }
+    n->h.size = size;
+    m->bytes = m->bytes - old_size + size;
+    if (m->bytes > m->peak_bytes) m->peak_bytes = m->bytes;
+    m->num_alloc ++;
+    MEM_UNLOCK();
+    return n + 1;
+  }
+  mem_module_t m = (mem_module_t)h->h.module;
+  size_t old_size = h->h.size;
+  MEM_UNLOCK();
+
+  void *n = mem_malloc(m, size);
+  if (!n) return NULL;
+  memcpy(n, ptr, old_size < size ? old_size : size);
+  mem_free(ptr);
+  return n;
+}
+
+void mem_get_stats(mem_stats_t *stats) {
+  MEM_LOCK();
+  *stats = mem_stats;
+  if (pool.size) {
+    stats->pool_size = pool.size;
+    stats->pool_free = pool.free_bytes;
+    stats->pool_largest = pool_largest();
+  } else {
+    stats->pool_size = 0;
+    stats->pool_free = 0;
+    stats->pool_largest = 0;
+  }
+  MEM_UNLOCK();
+}
+
+const char *mem_module_name(mem_module_t module) {
+  if (module >= MEM_NUM_MODULES) return NULL;
+  return module_names[module];
+}
@@ -156,10 +156,7 @@ int print_value(char *buf,int len, char *error, int len_error, VALUE t) {
 	break;
 
       case PTR_TYPE_BOXED_F: {
-	VALUE uv = car(curr);
-	float v;
-	memcpy(&v, &uv, sizeof(float)); // = *(float*)(&uv);
-	n = snprintf(buf + offset, len - offset, "{%"PRI_FLOAT"}", v);
+	n = snprintf(buf + offset, len - offset, "{%"PRI_FLOAT"}", dec_f(curr));
 	offset += n;
 	break;
       }
@@ -172,7 +169,7 @@ int print_value(char *buf,int len, char *error, int len_error, VALUE t) {
       }
 	
       case PTR_TYPE_BOXED_I: {
-	int32_t v = (int32_t)car(curr);
+	INT v = (INT)car(curr);
 	return snprintf(buf + offset, len - offset, "{%"PRI_INT"}", v);
 	offset += n;
 	break;
@@ -218,9 +215,14 @@ int print_value(char *buf,int len, char *error, int len_error, VALUE t) {
 	n = snprintf(buf + offset, len - offset, "\\#%c", dec_char(curr));
 	offset += n;
 	break;
+
+      case VAL_TYPE_FLOAT:
+	n = snprintf(buf + offset, len - offset, "%"PRI_FLOAT"", dec_f(curr));
+	offset += n;
+	break;
 	
       default:
-	snprintf(error, len_error, "Error: print does not recognize type of value: %"PRIx32"", curr);
+	snprintf(error, len_error, "Error: print does not recognize type of value: %"PRI_HEX"", curr);
 	return -1;
 	break;
       } // Switch type of curr
@@ -22,6 +22,7 @@
 #include <inttypes.h>
 
 #include "symrepr.h"
+#include "mem.h"
 
 /*
    Name -> 28bit integer mapping that is (I hope) somewhat
@@ -140,6 +141,15 @@ bool add_default_symbols() {
   res = res && symrepr_addspecial("sym_recovered"    , DEF_REPR_RECOVERED);
   res = res && symrepr_addspecial("sym_bytecode"     , DEF_REPR_BYTECODE_TYPE);
   res = res && symrepr_addspecial("sym_nonsense"     , DEF_REPR_NONSENSE);
+  res = res && symrepr_addspecial("node_quote"       , DEF_REPR_NODE_QUOTE);
+  res = res && symrepr_addspecial("node_define"      , DEF_REPR_NODE_DEFINE);
+  res = res && symrepr_addspecial("node_progn"       , DEF_REPR_NODE_PROGN);
+  res = res && symrepr_addspecial("node_lambda"      , DEF_REPR_NODE_LAMBDA);
+  res = res && symrepr_addspecial("node_if"          , DEF_REPR_NODE_IF);
+  res = res && symrepr_addspecial("node_let"         , DEF_REPR_NODE_LET);
+  res = res && symrepr_addspecial("node_app"         , DEF_REPR_NODE_APP);
+  res = res && symrepr_addspecial("node_local"       , DEF_REPR_NODE_LOCAL);
+  res = res && symrepr_addspecial("node_global"      , DEF_REPR_NODE_GLOBAL);
 
   // special symbols with parseable names
   res = res && symrepr_addspecial("type-list"        , DEF_REPR_TYPE_LIST);
@@ -183,7 +193,7 @@ bool symrepr_init(void) {
 #ifdef TINY_SYMTAB
   name_list = NULL; /* empty list of symbol names */
 #else
-  name_table = (name_mapping_t**)malloc(HASHTAB_MALLOC_SIZE * sizeof(name_mapping_t*));
+  name_table = (name_mapping_t**)mem_malloc(MEM_SYMREPR, HASHTAB_MALLOC_SIZE * sizeof(name_mapping_t*));
   if (!name_table) return false;
   memset(name_table, 0, HASHTAB_MALLOC_SIZE * sizeof(name_mapping_t*));
 #endif
@@ -202,15 +212,15 @@ bool symrepr_addspecial(char *name, UINT spec_id) {
 
 #ifdef TINY_SYMTAB
   if (name_list == NULL) {
-    name_list = (name_list_t*)malloc(sizeof(name_list_t));
+    name_list = (name_list_t*)mem_malloc(MEM_SYMREPR, sizeof(name_list_t));
     if (name_list == NULL) return false;
     name_list->next = NULL;
     name_list->key = hash;
-    name_list->map = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+    name_list->map = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
     if (name_list->map == NULL) return false;
     name_list->map->key = key;
     name_list->map->next = NULL;
-    name_list->map->name = (char*)malloc(n);
+    name_list->map->name = (char*)mem_malloc(MEM_SYMREPR, n);
     if (name_list->map->name == NULL) return false;
     strncpy(name_list->map->name, name, n);
   } else {
@@ -221,15 +231,15 @@ bool symrepr_addspecial(char *name, UINT spec_id) {
     
     name_mapping_t *head = name_list_get_mappings(name_list,hash);
     if (head == NULL) {
-      name_list_t *new_entry = (name_list_t*)malloc(sizeof(name_list_t));
+      name_list_t *new_entry = (name_list_t*)mem_malloc(MEM_SYMREPR, sizeof(name_list_t));
       if (new_entry == NULL) return 0;
       new_entry->next = NULL;
       new_entry->key = hash;
-      new_entry->map = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+      new_entry->map = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
       if (new_entry->map == NULL) return 0;
       new_entry->map->key = key;
       new_entry->map->next = NULL;
-      new_entry->map->name = (char*)malloc(n);
+      new_entry->map->name = (char*)mem_malloc(MEM_SYMREPR, n);
       if (new_entry->map->name == NULL) return 0;
       strncpy(new_entry->map->name, name, n);
 
@@ -237,10 +247,10 @@ bool symrepr_addspecial(char *name, UINT spec_id) {
       new_entry->next = name_list;
       name_list = new_entry;
     } else {
-      name_mapping_t *new_mapping = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+      name_mapping_t *new_mapping = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
       new_mapping->next = NULL;
       new_mapping->key  = key;
-      new_mapping->name = (char*)malloc(n);
+      new_mapping->name = (char*)mem_malloc(MEM_SYMREPR, n);
       if (new_mapping->name == NULL) return false;
       strncpy(new_mapping->name, name, n);
       while (head->next != NULL) head = head->next;
@@ -251,9 +261,9 @@ bool symrepr_addspecial(char *name, UINT spec_id) {
       
 #else
   if (name_table[hash] == NULL){
-    name_table[hash] = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+    name_table[hash] = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
     name_table[hash]->key = key;
-    name_table[hash]->name = (char*)malloc(n);
+    name_table[hash]->name = (char*)mem_malloc(MEM_SYMREPR, n);
     strncpy(name_table[hash]->name, name, n);
     name_table[hash]->next = NULL;
   } else {
@@ -264,9 +274,9 @@ bool symrepr_addspecial(char *name, UINT spec_id) {
     /* collision */
     name_mapping_t *head = name_table[hash];
 
-    name_table[hash] = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+    name_table[hash] = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
     name_table[hash]->key = key;
-    name_table[hash]->name = (char*)malloc(n);
+    name_table[hash]->name = (char*)mem_malloc(MEM_SYMREPR, n);
     strncpy(name_table[hash]->name, name, n);
     name_table[hash]->next = head;
   }
@@ -287,15 +297,15 @@ int symrepr_addsym(char *name, UINT* id) {
 #ifdef TINY_SYMTAB
   /* If the symbol name_list is empty */
   if (name_list == NULL) {
-    name_list = (name_list_t*)malloc(sizeof(name_list_t));
+    name_list = (name_list_t*)mem_malloc(MEM_SYMREPR, sizeof(name_list_t));
     if (name_list == NULL) return 0;
     name_list->next = NULL;
     name_list->key = hash;
-    name_list->map = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+    name_list->map = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
     if (name_list->map == NULL) return 0;
     name_list->map->key = hash;
     name_list->map->next = NULL;
-    name_list->map->name = (char*)malloc(n);
+    name_list->map->name = (char*)mem_malloc(MEM_SYMREPR, n);
     if (name_list->map->name == NULL) return 0;
     strcpy(name_list->map->name, name);
 
@@ -306,15 +316,15 @@ int symrepr_addsym(char *name, UINT* id) {
 
     if (tmp == NULL) {
       /* There is no entry for this hash, just append it to name_list */
-      name_list_t *new_entry = (name_list_t*)malloc(sizeof(name_list_t));
+      name_list_t *new_entry = (name_list_t*)mem_malloc(MEM_SYMREPR, sizeof(name_list_t));
       if (new_entry == NULL) return 0;
       new_entry->next = NULL;
       new_entry->key = hash;
-      new_entry->map = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+      new_entry->map = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
       if (new_entry->map == NULL) return 0;
       new_entry->map->key = hash;
       new_entry->map->next = NULL;
-      new_entry->map->name = (char*)malloc(n);
+      new_entry->map->name = (char*)mem_malloc(MEM_SYMREPR, n);
       if (new_entry->map->name == NULL) return 0;
       strcpy(new_entry->map->name, name);
 
@@ -336,14 +346,14 @@ int symrepr_addsym(char *name, UINT* id) {
       /* ready to add a new entry if there is room in the 12 bits */
       if (++max_12bit > 4095) return 0;
 
-      tmp->next = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+      tmp->next = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
       if (tmp->next == NULL) return 0;
 
       UINT new_key = hash | (max_12bit << 16);
 
       tmp->next->next = NULL;
       tmp->next->key  = new_key;
-      tmp->next->name = (char*)malloc(n);
+      tmp->next->name = (char*)mem_malloc(MEM_SYMREPR, n);
       if (tmp->next->name == NULL) return 0;
       strncpy(tmp->next->name, name, n);
 
@@ -356,11 +366,11 @@ int symrepr_addsym(char *name, UINT* id) {
 #else
 
   if (name_table[hash] == NULL){
-    name_table[hash] = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+    name_table[hash] = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
     name_table[hash]->key = hash;
     if (id != NULL) *id = hash;
     n = strlen(name) + 1;
-    name_table[hash]->name = (char*)malloc(n);
+    name_table[hash]->name = (char*)mem_malloc(MEM_SYMREPR, n);
     strncpy(name_table[hash]->name, name, n);
     name_table[hash]->next = NULL;
   } else {
@@ -383,11 +393,11 @@ int symrepr_addsym(char *name, UINT* id) {
     }
 
     /* problem if hkey_id = 0xFFFF0000 */
-    name_table[hash] = (name_mapping_t*)malloc(sizeof(name_mapping_t));
+    name_table[hash] = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
     name_table[hash]->key = hash + (hkey_id + (1 << 16));
     if (id != NULL) *id = hash + (hkey_id + (1 << 16));
     n = strlen(name) + 1;
-    name_table[hash]->name = (char*)malloc(n);
+    name_table[hash]->name = (char*)mem_malloc(MEM_SYMREPR, n);
     strncpy(name_table[hash]->name, name, n);
     name_table[hash]->next = head;
   }
@@ -456,6 +466,79 @@ char *symrepr_lookup_name(UINT id) {
   return NULL;
 }
 
+static name_mapping_t *new_mapping(char *name, UINT key) {
+  size_t n = strlen(name) + 1;
+  name_mapping_t *m = (name_mapping_t*)mem_malloc(MEM_SYMREPR, sizeof(name_mapping_t));
+  if (m == NULL) return NULL;
+  m->name = (char*)mem_malloc(MEM_SYMREPR, n);
+  if (m->name == NULL) {
+    mem_free(m);
+    return NULL;
+  }
+  strncpy(m->name, name, n);
+  m->key = key;
+  m->next = NULL;
+  return m;
+}
+
+/* Visit the mappings of a bucket oldest first, the order in which
+   symrepr_restore must see them. */
+static bool each_mapping(name_mapping_t *m, bool (*f)(UINT, char *, void *), void *arg) {
+  if (m == NULL) return true;
+#ifdef TINY_SYMTAB
+  return f(m->key, m->name, arg) && each_mapping(m->next, f, arg);
+#else
+  return each_mapping(m->next, f, arg) && f(m->key, m->name, arg);
+#endif
+}
+
+/* Apply f to every symbol that is not one of the default symbols */
+bool symrepr_each(bool (*f)(UINT id, char *name, void *arg), void *arg) {
+#ifdef TINY_SYMTAB
+  for (name_list_t *curr = name_list; curr; curr = curr->next) {
+    if (curr->key == 0xFFFF) continue;
+    if (!each_mapping(curr->map, f, arg)) return false;
+  }
+#else
+  for (UINT i = 0; i < HASHTAB_SIZE; i ++) {
+    if (!each_mapping(name_table[i], f, arg)) return false;
+  }
+#endif
+  return true;
+}
+
+/* Add a symbol with a known id, as given by symrepr_each. */
+bool symrepr_restore(char *name, UINT id) {
+  UINT hash = id & 0xFFFF;
+  if (hash >= HASHTAB_SIZE) return false;
+
+  name_mapping_t *m = new_mapping(name, id);
+  if (m == NULL) return false;
+
+#ifdef TINY_SYMTAB
+  name_mapping_t *head = name_list_get_mappings(name_list, hash);
+  if (head == NULL) {
+    name_list_t *new_entry = (name_list_t*)mem_malloc(MEM_SYMREPR, sizeof(name_list_t));
+    if (new_entry == NULL) {
+      mem_free(m->name);
+      mem_free(m);
+      return false;
+    }
+    new_entry->key = hash;
+    new_entry->map = m;
+    new_entry->next = name_list;
+    name_list = new_entry;
+  } else {
+    while (head->next != NULL) head = head->next;
+    head->next = m;
+  }
+#else
+  m->next = name_table[hash];
+  name_table[hash] = m;
+#endif
+  return true;
+}
+
 void symrepr_del(void) {
 #ifdef TINY_SYMTAB
   name_list_t *curr = name_list;
@@ -465,11 +548,11 @@ void symrepr_del(void) {
     name_list_t* t0 = curr->next;
     while (head) {
       name_mapping_t* t1 = head->next;
-      free(head->name);
-      free(head);
+      mem_free(head->name);
+      mem_free(head);
       head = t1;
     }
-    free(curr);
+    mem_free(curr);
     curr = t0;
   }
 #else
@@ -483,8 +566,8 @@ void symrepr_del(void) {
       name_mapping_t *next;
       while (head) {
 	next = head->next;
-	free(head->name);
-	free(head);
+	mem_free(head->name);
+	mem_free(head);
 	head = next;
       }
     }
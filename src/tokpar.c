@@ -27,6 +27,7 @@
 #include "typedefs.h"
 #include "compression.h"
 #include "qq_expand.h"
+#include "mem.h"
 
 #define TOKOPENPAR      0
 #define TOKCLOSEPAR     1
@@ -171,7 +172,7 @@ int tok_symbol(tokenizer_char_stream str, char** res) {
     len++;
   }
 
-  *res = malloc(len+1);
+  *res = mem_malloc(MEM_TOKPAR, len+1);
   memset(*res,0,len+1);
 
   for (i = 0; i < len; i ++) {
@@ -203,7 +204,7 @@ int tok_string(tokenizer_char_stream str, char **res) {
   }
 
   // allocate memory for result string
-  *res = malloc(len+1);
+  *res = mem_malloc(MEM_TOKPAR, len+1);
   memset(*res, 0, len+1);
 
   for (i = 0; i < len; i ++) {
@@ -536,15 +537,18 @@ VALUE parse_sexp(token tok, tokenizer_char_stream str) {
     } else {
       v = enc_sym(symrepr_rerror());
     }
-    free(tok.data.text);
+    mem_free(tok.data.text);
     return v;
   }
   case TOKSTRING: {
-    heap_allocate_array(&v, tok.text_len+1, VAL_TYPE_CHAR);
+    if (!heap_allocate_array(&v, tok.text_len+1, VAL_TYPE_CHAR)) {
+      mem_free(tok.data.text);
+      return enc_sym(symrepr_merror());
+    }
     array_t *arr = (array_t*)car(v);
     memset(arr->data.c, 0, (tok.text_len+1) * sizeof(char));
     memcpy(arr->data.c, tok.data.text, tok.text_len * sizeof(char));
-    free(tok.data.text);
+    mem_free(tok.data.text);
     return v;
   }
   case TOKINT:
@@ -558,7 +562,7 @@ VALUE parse_sexp(token tok, tokenizer_char_stream str) {
   case TOKBOXEDUINT:
     return set_ptr_type(cons(tok.data.u, enc_sym(DEF_REPR_BOXED_U_TYPE)), PTR_TYPE_BOXED_U);
   case TOKBOXEDFLOAT:
-    return set_ptr_type(cons(tok.data.u, enc_sym(DEF_REPR_BOXED_F_TYPE)), PTR_TYPE_BOXED_F);
+    return enc_f(tok.data.f);
   case TOKQUOTE: {
     t = next_token(str);
     VALUE quoted = parse_sexp(t, str);
@@ -594,31 +598,32 @@ VALUE parse_sexp(token tok, tokenizer_char_stream str) {
   return enc_sym(symrepr_rerror());
 }
 
+// The elements are appended as they are parsed, so that lists are
+// laid out front to back (and cdr-coded if that is enabled).
 VALUE parse_sexp_list(token tok, tokenizer_char_stream str) {
 
-  token t;
   VALUE head;
-  VALUE tail;
+  bool read_error = false;
+  bool mem_error = false;
+  heap_list_t l;
+  heap_list_init(&l);
+
+  while (tok.type != TOKCLOSEPAR) {
+    if (tok.type == TOKENIZER_END ||
+	tok.type == TOKENIZER_ERROR) return enc_sym(symrepr_rerror());
 
-  switch (tok.type) {
-  case TOKENIZER_END:
-    return enc_sym(symrepr_rerror());
-  case TOKENIZER_ERROR:
-    return enc_sym(symrepr_rerror());
-  case TOKCLOSEPAR:
-    return enc_sym(symrepr_nil());
-  default:
     head = parse_sexp(tok, str);
-    t = next_token(str);
-    tail = parse_sexp_list(t, str);
-    if ((type_of(head) == VAL_TYPE_SYMBOL &&
-	 dec_sym(head) == symrepr_rerror() ) ||
-	(type_of(tail) == VAL_TYPE_SYMBOL &&
-	 dec_sym(tail) == symrepr_rerror() )) return enc_sym(symrepr_rerror());
-    return cons(head, tail);
+    if (type_of(head) == VAL_TYPE_SYMBOL &&
+	dec_sym(head) == symrepr_rerror()) {
+      read_error = true;
+    } else if (!read_error && !mem_error) {
+      mem_error = !heap_list_append(&l, head);
+    }
+    tok = next_token(str);
   }
-
-  return enc_sym(symrepr_rerror());
+  if (read_error) return enc_sym(symrepr_rerror());
+  if (mem_error) return enc_sym(symrepr_merror());
+  return heap_list_finish(&l, enc_sym(symrepr_nil()));
 }
 
 bool more_string(tokenizer_char_stream str) {
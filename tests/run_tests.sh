@@ -35,107 +35,133 @@ for exe in *.exe; do
     echo "------------------------------------------------------------"
 done
 
-
-
-for lisp in *.lisp; do
-    ./test_lisp_code_cps -h 8388608 -g $lisp
-
-    result=$?
-
-    echo "------------------------------------------------------------"
-    echo HUGE_HEAP!
-    if [ $result -eq 1 ]
-    then
-	success_count=$((success_count+1))
-	echo $lisp SUCCESS
-    else
-	failing_tests="$failing_tests HUGE_HEAP: $lisp \n"
-	fail_count=$((fail_count+1))
-	echo $lisp FAILED
-    fi
-    echo "------------------------------------------------------------"
-done
-
-for lisp in *.lisp; do
-    ./test_lisp_code_cps -h 8388608 $lisp
-
-    result=$?
-
-    echo "------------------------------------------------------------"
-    echo HUGE_HEAP - FIXED STACK!
-    if [ $result -eq 1 ]
-    then
-	success_count=$((success_count+1))
-	echo $lisp SUCCESS
-    else
-	failing_tests="$failing_tests HUGE_HEAP: $lisp \n"
-	fail_count=$((fail_count+1))
-	echo $lisp FAILED
-    fi
-    echo "------------------------------------------------------------"
-done
-
-
-for lisp in *.lisp; do
-
-    ./test_lisp_code_cps -h 8192 -g $lisp
+# Run every lisp test with the flags given after the label.
+run_suite() {
+    label=$1
+    shift
+    for lisp in *.lisp; do
+	./test_lisp_code_cps "$@" $lisp
+
+	result=$?
+
+	echo "------------------------------------------------------------"
+	echo $label!
+	if [ $result -eq 1 ]
+	then
+	    success_count=$((success_count+1))
+	    echo $lisp SUCCESS
+	else
+	    failing_tests="$failing_tests $label: $lisp \n"
+	    fail_count=$((fail_count+1))
+	    echo $lisp FAILED
+	fi
+	echo "------------------------------------------------------------"
+    done
+}
+
+# Check that utils/heap_trace.py reads the trace written by the last
+# run_suite.
+check_trace() {
+    label=$1
+    python3 ../utils/heap_trace.py trace.bin | grep "^Events:" > /dev/null
 
     result=$?
 
     echo "------------------------------------------------------------"
-    echo MINI_HEAP!
-    if [ $result -eq 1 ]
+    echo $label!
+    if [ $result -eq 0 ]
     then
 	success_count=$((success_count+1))
-	echo $lisp SUCCESS
+	echo heap_trace.py SUCCESS
     else
-	failing_tests="$failing_tests MINI_HEAP: $lisp \n"
+	failing_tests="$failing_tests $label: heap_trace.py \n"
 	fail_count=$((fail_count+1))
-	echo $lisp FAILED
+	echo heap_trace.py FAILED
     fi
     echo "------------------------------------------------------------"
-done
-
-for lisp in *.lisp; do
-
-    ./test_lisp_code_cps -h 8192 $lisp
-
-    result=$?
-
-    echo "------------------------------------------------------------"
-    echo MINI_HEAP - FIXED STACK!
-    if [ $result -eq 1 ]
-    then
-	success_count=$((success_count+1))
-	echo $lisp SUCCESS
-    else
-	failing_tests="$failing_tests MINI_HEAP: $lisp \n"
-	fail_count=$((fail_count+1))
-	echo $lisp FAILED
+    rm -f trace.bin
+}
+
+run_suite "HUGE_HEAP" -h 8388608 -g
+run_suite "HUGE_HEAP - FIXED STACK" -h 8388608
+run_suite "MINI_HEAP" -h 8192 -g
+run_suite "MINI_HEAP - FIXED STACK" -h 8192
+run_suite "COMPRESSED CODE" -h 8388608 -g -c
+run_suite "GENERATIONAL" -h 8388608 -g -n 4096
+run_suite "MINI_HEAP - GENERATIONAL" -h 8192 -n 1024
+run_suite "INCREMENTAL" -h 8388608 -g -i 256
+run_suite "MINI_HEAP - INCREMENTAL" -h 8192 -i 32
+run_suite "LAZY_SWEEP" -h 8388608 -g -l
+run_suite "MINI_HEAP - LAZY_SWEEP" -h 8192 -l
+run_suite "MINI_HEAP - GENERATIONAL - LAZY_SWEEP" -h 8192 -n 1024 -l
+run_suite "COMPACTING" -h 8388608 -g -m
+run_suite "MINI_HEAP - COMPACTING" -h 8192 -m
+run_suite "ARRAY_ARENA" -h 8388608 -g -a 65536
+run_suite "MINI_HEAP - ARRAY_ARENA" -h 8192 -a 1024
+run_suite "MINI_HEAP - COMPACTING - ARRAY_ARENA" -h 8192 -m -a 1024
+run_suite "MINI_HEAP - LAZY_SWEEP - ARRAY_ARENA" -h 8192 -l -a 1024
+run_suite "GROWING_HEAP" -h 2048 -r 512
+run_suite "GROWING_HEAP - COMPACTING" -h 2048 -r 512 -m
+run_suite "GROWING_HEAP - LAZY_SWEEP" -h 2048 -r 512 -l
+run_suite "GROWING_HEAP - INCREMENTAL" -h 2048 -r 512 -i 32
+run_suite "GC_WATERMARK" -h 8192 -f 512
+run_suite "GC_WATERMARK - COMPACTING" -h 8192 -m -f 512
+run_suite "GC_WATERMARK - GENERATIONAL" -h 8192 -n 1024 -f 512
+run_suite "CDR_CODING" -h 8388608 -g -d
+run_suite "MINI_HEAP - CDR_CODING" -h 8192 -d
+run_suite "CDR_CODING - COMPACTING" -h 8192 -m -d
+run_suite "CDR_CODING - INCREMENTAL" -h 8192 -i 32 -d
+run_suite "CDR_CODING - GENERATIONAL" -h 8192 -n 1024 -d
+run_suite "HEAP_SCOPES" -h 8388608 -g -e 4096
+run_suite "MINI_HEAP - HEAP_SCOPES" -h 8192 -e 1024
+run_suite "HEAP_SCOPES - GENERATIONAL" -h 8192 -n 1024 -e 1024
+run_suite "HEAP_SCOPES - INCREMENTAL" -h 8192 -i 32 -e 1024
+run_suite "HEAP_SCOPES - CDR_CODING" -h 8192 -d -e 1024
+run_suite "MEMORY_POOL" -h 8192 -p 4194304
+run_suite "MEMORY_POOL - GENERATIONAL" -h 8192 -n 1024 -p 4194304
+run_suite "MEMORY_POOL - COMPACTING" -h 8192 -m -p 4194304
+run_suite "MEMORY_POOL - GROWTH" -h 2048 -r 512 -p 4194304
+run_suite "HEAP_TRACE" -h 8192 -k -y trace.bin
+check_trace "HEAP_TRACE"
+run_suite "FROZEN_PRELUDE" -h 8192 -z
+run_suite "FROZEN_PRELUDE - COMPACTING" -h 8192 -z -m
+run_suite "FROZEN_PRELUDE - GENERATIONAL" -h 8192 -n 1024 -z
+run_suite "FROZEN_PRELUDE - INCREMENTAL" -h 8192 -i 32 -z
+
+# The library and the tests are built with the same GC_THREADS and
+# HEAP_IMAGE settings, see the Makefile.
+if [ -n "$GC_THREADS" ]; then
+    run_suite "PARALLEL_MARK" -h 8388608 -g -t 4
+    run_suite "MINI_HEAP - PARALLEL_MARK" -h 8192 -t 4
+    run_suite "MINI_HEAP - COMPACTING - PARALLEL_MARK" -h 8192 -m -t 4
+    run_suite "BACKGROUND_SWEEP" -h 8388608 -g -s
+    run_suite "MINI_HEAP - BACKGROUND_SWEEP" -h 8192 -s
+    run_suite "MINI_HEAP - GENERATIONAL - BACKGROUND_SWEEP" -h 8192 -n 1024 -s
+    run_suite "MINI_HEAP - BACKGROUND_SWEEP - ARRAY_ARENA" -h 8192 -s -a 1024
+    run_suite "GROWING_HEAP - BACKGROUND_SWEEP" -h 2048 -r 512 -s
+    run_suite "MEMORY_POOL - BACKGROUND_SWEEP" -h 8192 -s -p 4194304
+    run_suite "HEAP_TRACE - GENERATIONAL - BACKGROUND_SWEEP - HEAP_SCOPES" -h 8192 -n 1024 -s -e 1024 -y trace.bin
+    check_trace "HEAP_TRACE - GENERATIONAL - BACKGROUND_SWEEP - HEAP_SCOPES"
+    run_suite "FROZEN_PRELUDE - BACKGROUND_SWEEP" -h 8192 -z -s
+fi
+
+if [ -n "$HEAP_IMAGE" ]; then
+    ./test_lisp_code_cps -h 8192 -w prelude.img test_arith_0.lisp > /dev/null
+
+    run_suite "HEAP_IMAGE" -x prelude.img
+    run_suite "HEAP_IMAGE - COMPACTING" -x prelude.img -m
+    if [ -n "$GC_THREADS" ]; then
+	run_suite "HEAP_IMAGE - BACKGROUND_SWEEP" -x prelude.img -s
     fi
-    echo "------------------------------------------------------------"
-done
 
+    rm -f prelude.img
 
-for lisp in *.lisp; do
-    ./test_lisp_code_cps -h 8388608 -g -c  $lisp
+    ./test_lisp_code_cps -h 8192 -z -w frozen.img test_arith_0.lisp > /dev/null
 
-    result=$?
-
-    echo "------------------------------------------------------------"
-    echo COMPRESSED CODE!
-    if [ $result -eq 1 ]
-    then
-	success_count=$((success_count+1))
-	echo $lisp SUCCESS
-    else
-	failing_tests="$failing_tests COMPRESSED: $lisp \n"
-	fail_count=$((fail_count+1))
-	echo $lisp FAILED
-    fi
-    echo "------------------------------------------------------------"
-done
+    run_suite "FROZEN_IMAGE" -x frozen.img
 
+    rm -f frozen.img
+fi
 
 echo -e $failing_tests
 echo Tests passed: $success_count
@@ -0,0 +1,8 @@
+(define f (lambda (x)
+	    (progn
+	      (define g (lambda (y) (let ((z (+ x y)) (w 'a)) (if (= w 'a) (list z (quote (+ 1 2))) 0))))
+	      (let () (if (> x 1) (g x))))))
+
+(define h (lambda (a b) (and a b (or nil (car (list a))))))
+
+(and (= (f 2) '(4 (+ 1 2))) (= (f 0) nil) (= (g 1) '(1 (+ 1 2))) (= (h 3 4) 3) (= (h nil 4) nil))
@@ -0,0 +1,12 @@
+(define tl (list 8 9))
+(define xs (append '(1 2 3) tl))
+(define ys (append (list 1 2 3 4) tl))
+
+(and (= (append '(1) tl) '(1 8 9))
+     (= (append (list 1 2) tl) '(1 2 8 9))
+     (= xs '(1 2 3 8 9))
+     (= ys '(1 2 3 4 8 9))
+     (= (drop 3 xs) tl)
+     (= (drop 4 ys) tl)
+     (= (append '(1 2) 3) (cons 1 (cons 2 3)))
+     (= (append nil tl) tl))
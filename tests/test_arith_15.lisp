@@ -0,0 +1 @@
+(= (+ 1.5 2.25) 3.75)
@@ -0,0 +1,3 @@
+(define f (lambda (x acc) (if (= x 0) acc (f (- x 1) (+ acc 0.5)))))
+
+(= (f 1000 0.0) 500.0)
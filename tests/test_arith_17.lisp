@@ -0,0 +1,3 @@
+(define a (- 1000.1 1000.0))
+
+(and (> a 0.0999) (< a 0.1001) (= (+ 1000.1 0.0) 1000.1) (= (* 2.0 1.5) 3.0))
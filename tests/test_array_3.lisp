@@ -0,0 +1,5 @@
+(define a "hello")
+(define a "world")
+(define churn (lambda (n) (if (= n 0) t (progn (list n n n n n n n n) (churn (- n 1))))))
+(churn 1000)
+(= (array-read a 0u28) \#w)
@@ -0,0 +1,7 @@
+(define xs (append (list 1 2 3 4 5) (append '(6 (7 8) 9) (list 10))))
+
+(and (= (length xs) 9)
+     (= (car (cdr (cdr (cdr (cdr (cdr xs)))))) 6)
+     (= (car (drop 6 xs)) '(7 8))
+     (= (foldl (lambda (a x) (+ a (if (= (type-of x) type-list) (+ (car x) (car (cdr x))) x))) 0 xs) 55)
+     (= (cons 0 (take 5 xs)) '(0 1 2 3 4 5)))
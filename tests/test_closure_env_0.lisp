@@ -0,0 +1,21 @@
+;; A closure shares the environment it is made in, so the innermost
+;; binding of a name is the one it sees, and making it takes the four
+;; cells of the closure whatever the size of the environment. A copy
+;; of this environment would take 24 more for each closure.
+
+(define one (lambda (a b c d e f g h i j k l m n o p q r s t u v w x)
+	      (lambda (y) y)))
+
+(define ten (lambda (a b c d e f g h i j k l m n o p q r s t u v w x)
+	      (progn (lambda (y) y) (lambda (y) y) (lambda (y) y) (lambda (y) y) (lambda (y) y)
+		     (lambda (y) y) (lambda (y) y) (lambda (y) y) (lambda (y) y) (lambda (y) y))))
+
+(define cells (lambda (f)
+		(let ((s0 (lookup 'alloc-total (heap-stats)))
+		      (r (f 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24))
+		      (s1 (lookup 'alloc-total (heap-stats))))
+		  (- s1 s0))))
+
+(and (= (((lambda (x) ((lambda (x) (lambda () x)) 2)) 1)) 2)
+     (= ((let ((x 1)) (let ((x 2)) (lambda () x)))) 2)
+     (< (- (cells ten) (cells one)) 100))
@@ -0,0 +1,4 @@
+(define acc nil)
+(define churn (lambda (n) (if (= n 0) t (progn (define acc (cons n acc)) (list n n n n n n n n) (churn (- n 1))))))
+(churn 1000)
+(= (length acc) 1000)
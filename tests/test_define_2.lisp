@@ -0,0 +1,4 @@
+(define zip (list 1 2 3 4 5))
+(define churn (lambda (k) (if (= k 0) t (progn (list k k k k k k k k) (churn (- k 1))))))
+(churn 2000)
+(= zip (list 1 2 3 4 5))
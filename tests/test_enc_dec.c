@@ -1,6 +1,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
 
 #include "heap.h"
 
@@ -44,6 +47,19 @@ int main(int argc, char **argv) {
   printf("DEC/ENC %d: %s \n", n++, res ? "ok" : "NOK!");
   res &= (dec_sym(enc_sym(268435455)) == 268435455);
   printf("DEC/ENC %d: %s \n", n++, res ? "ok" : "NOK!");
-  
+
+#if defined(_64_BIT_) && !defined(BOXED_FLOATS)
+  // Every float is immediate on 64 bit.
+  FLOAT fs[] = { 0.0f, -0.0f, 0.1f, -1000.1f, 1.0e-40f, FLT_MAX, INFINITY };
+  for (unsigned int i = 0; i < sizeof(fs) / sizeof(FLOAT); i ++) {
+    VALUE v = enc_f(fs[i]);
+    FLOAT f = dec_f(v);
+    res &= (type_of(v) == VAL_TYPE_FLOAT && memcmp(&fs[i], &f, sizeof(FLOAT)) == 0);
+    printf("DEC/ENC %d: %s \n", n++, res ? "ok" : "NOK!");
+  }
+  res &= (type_of(enc_f(NAN)) == VAL_TYPE_FLOAT && isnan(dec_f(enc_f(NAN))));
+  printf("DEC/ENC %d: %s \n", n++, res ? "ok" : "NOK!");
+#endif
+
   return res;
 }
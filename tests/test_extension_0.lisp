@@ -0,0 +1,6 @@
+(define churn (lambda (k) (if (= k 0) t (progn (list k k k k k k k k) (churn (- k 1))))))
+(churn 500)
+(define big (range 3000))
+(churn 500)
+(define small (range 10))
+(and (= (length big) 3000) (= small (list 0 1 2 3 4 5 6 7 8 9)))
@@ -0,0 +1,21 @@
+(define il (lambda (n x) (if (= n 0) x (il (- n 1) (* (+ x 1) 1)))))
+(define fl (lambda (n x) (if (= n 0) x (fl (- n 1) (* (+ x 0.5) 1.0)))))
+(define pid (lambda (n y i) (if (= n 0) y
+                                (let ((e (- 1.0 y)))
+                                  (pid (- n 1) (+ y (* 0.3 e) (* 0.05 i)) (+ i (* 0.1 e)))))))
+(define il3 (lambda (n y i) (if (= n 0) y
+                                (let ((e (- 1 y)))
+                                  (il3 (- n 1) (+ y (* 3 e) (* 5 i)) (+ i (* 1 e)))))))
+
+(define allocs (lambda (f)
+                 (let ((a (lookup 'alloc-total (heap-stats))))
+                   (progn (f) (- (lookup 'alloc-total (heap-stats)) a)))))
+
+;; Floats are always immediate on 64 bit, where integers have more
+;; than 28 bits, and on 32 bit when they are exact in 28 bits.
+(define wide (> (+ 134217727 1) 0))
+
+(and (< (allocs (lambda () (fl 200 0.0))) (+ (allocs (lambda () (il 200 0))) 50))
+     (= (fl 200 0.0) 100.0)
+     (or (not wide)
+         (< (allocs (lambda () (pid 200 0.0 0.0))) (+ (allocs (lambda () (il3 200 0 0))) 50))))
@@ -0,0 +1,11 @@
+(define mk (lambda (n) (list (lambda (x) (+ n x)) (lambda (x) (- x n)))))
+
+(define fs (mk 10))
+
+(define ck (lambda (y) (if (= (car (list y)) 7) y 0)))
+
+(define sh (lambda (a) (let ((c (+ a 1)) (b a)) (progn (let ((b 3)) b) (list c b)))))
+
+(define ev (lambda (q) (eval '(+ 1 2))))
+
+(and (= ((car fs) 1) 11) (= ((car (cdr fs)) 15) 5) (= (ck 7) 7) (= (sh 1) '(2 1)) (= (ev 0) 3))
@@ -0,0 +1,11 @@
+(define nest (lambda (n acc) (if (= n 0) acc (nest (- n 1) (list acc)))))
+
+(define depth (lambda (x n) (if (= x nil) n (depth (car x) (+ n 1)))))
+
+(define churn (lambda (n) (if (= n 0) t (progn (list n n n n n n n n) (churn (- n 1))))))
+
+(define deep (nest 2000 nil))
+
+(churn 2000)
+
+(= (depth deep 0) 2000)
@@ -0,0 +1,82 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "heap.h"
+#include "symrepr.h"
+
+
+int main(int argc, char **argv) {
+
+  int res = 1;
+
+  unsigned int heap_size = 4096;
+  unsigned int budget = 32;
+  unsigned int live = 1000;
+  heap_state_t hs;
+  heap_stats_t st;
+
+  res = symrepr_init();
+  if (!res) {
+    printf("Error initializing symrepr\n");
+    return 0;
+  }
+  printf("Initialized symrepr: OK\n");
+
+  res = heap_init(heap_size) && heap_set_gc_budget(budget);
+  if (!res) {
+    printf("Error initializing heap\n");
+    return 0;
+  }
+
+  printf("Initialized incremental heap: OK\n");
+
+  VALUE nil = enc_sym(symrepr_nil());
+  VALUE list = nil;
+  for (unsigned int i = 0; i < live; i ++) {
+    list = cons(enc_u(i), list);
+  }
+  while (heap_num_allocated() < heap_size / 2 + 100) {
+    if (!is_ptr(cons(nil, nil))) {
+      printf("Error allocating garbage\n");
+      return 0;
+    }
+  }
+  unsigned int allocated = heap_num_allocated();
+
+  // The first step starts the cycle and shades the roots, the others
+  // mark or sweep at most budget cells each.
+  unsigned int steps = 0;
+  do {
+    if (!heap_perform_gc_step(list, nil, nil, nil, nil, NULL, 0)) {
+      printf("Error in incremental step %u\n", steps);
+      return 0;
+    }
+    steps ++;
+    heap_get_state(&hs);
+    if (hs.gc_inc_max_work > budget) {
+      printf("Error step %u did %u cells of work, budget %u\n", steps, hs.gc_inc_max_work, budget);
+      return 0;
+    }
+  } while (hs.gc_inc_phase != GC_INC_IDLE && steps < heap_size);
+
+  if (hs.gc_inc_phase != GC_INC_IDLE || steps < heap_size / budget) {
+    printf("Error cycle took %u steps\n", steps);
+    return 0;
+  }
+  printf("Cycle of %u steps, at most %u cells per step: OK\n", steps, hs.gc_inc_max_work);
+
+  heap_get_stats(&st);
+  if (st.num_pauses != steps) {
+    printf("Error %u pauses for %u steps\n", st.num_pauses, steps);
+    return 0;
+  }
+
+  if (length(list) != live || heap_num_allocated() >= allocated) {
+    printf("Error cycle did not keep the live list and free the garbage\n");
+    return 0;
+  }
+  printf("Incremental cycle reclaimed %u cells: OK\n", allocated - heap_num_allocated());
+  return 1;
+
+}
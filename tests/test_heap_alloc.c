@@ -11,7 +11,7 @@ int main(int argc, char **argv) {
   int res = 1;
 
   unsigned int heap_size = 1024 * 1024; 
-  uint32_t cell;
+  VALUE cell;
 
   res = symrepr_init();
   if (!res) {
@@ -50,6 +50,24 @@ int main(int argc, char **argv) {
   }
 
   printf("HEAP allocation when full test: OK\n");
+
+  heap_del();
+
+  static cons_t cells[1024];
+  res = heap_init_addr(cells, 1024);
+  if (!res) {
+    printf("Error initializing heap at address\n");
+    return 0;
+  }
+
+  for (int i = 0; i < 1024; i ++) {
+    cell = heap_allocate_cell(PTR_TYPE_CONS);
+    if (!is_ptr(cell)) {
+      printf("Error allocating cell %d of heap at address\n", i);
+      return 0;
+    }
+  }
+  printf("Allocated all 1024 cells of heap at address: OK\n");
   return 1; 
   
 }
@@ -0,0 +1,9 @@
+(define churn (lambda (k) (if (= k 0) t (progn (list k k k k k k k k) (churn (- k 1))))))
+(churn 500)
+(define s (heap-stats))
+(and (> (lookup 'free s) 0)
+     (not (> (lookup 'freelist s) (lookup 'free s)))
+     (> (lookup 'alloc-total s) 4000)
+     (num-eq (foldl + 0 (lookup 'pause-hist s)) (lookup 'pauses s))
+     (num-eq (length (lookup 'pause-hist s)) 24)
+     (num-eq (length (lookup 'marked s)) 5))
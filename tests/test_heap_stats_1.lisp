@@ -0,0 +1,13 @@
+(define churn (lambda (k) (if (= k 0) t (progn (list k k k k k k k k) (churn (- k 1))))))
+(define major (lambda (s) (- (lookup 'gc s) (lookup 'minor s))))
+(define s0 (heap-stats))
+(churn 2000)
+(define s1 (heap-stats))
+
+;; Without a nursery there are no minor collections. With one the
+;; garbage of churn, more than a small heap holds, is reclaimed by
+;; minor collections alone.
+(or (num-eq (lookup 'minor s1) 0)
+    (and (> (lookup 'minor s1) (lookup 'minor s0))
+         (num-eq (major s1) (major s0))
+         (> (- (lookup 'alloc-total s1) (lookup 'alloc-total s0)) 16384)))
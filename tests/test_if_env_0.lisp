@@ -0,0 +1,13 @@
+;; The branches of an if and the last expression of a progn run in
+;; the environment of the if or progn, not in that of a call before.
+
+(define f (lambda (x) (= x 2)))
+
+(define g (lambda (x) (if (f 2) x 0)))
+
+(define h (lambda (x) (progn (f 2) x)))
+
+(and (= (let ((x 1)) (if (f 2) x 0)) 1)
+     (= (let ((x 1)) (progn (f 2) x)) 1)
+     (= (g 1) 1)
+     (= (h 1) 1))
@@ -0,0 +1,6 @@
+(define f (lambda (x) (let ((a) (b x 2)) (list a b))))
+
+(and (= (let ((a)) a) nil)
+     (= (let ((a 1 2)) a) 1)
+     (= (let ((1 2) (a 3)) a) 3)
+     (= (f 3) '(nil 3)))
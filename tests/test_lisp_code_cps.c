@@ -15,9 +15,12 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <ctype.h>
 #include <getopt.h>
 
@@ -29,9 +32,79 @@
 #include "tokpar.h"
 #include "prelude.h"
 #include "compression.h"
+#include "image.h"
+#include "extensions.h"
+#include "heap_stats.h"
+#include "mem.h"
+#include "heap_trace.h"
 
 #define EVAL_CPS_STACK_SIZE 256
 
+// (range n) is the list (0 1 ... n-1). It is built from the end and
+// garbage is collected in the middle if the heap runs out.
+VALUE ext_range(VALUE *args, int argn) {
+  if (argn < 1 || val_type(args[0]) != VAL_TYPE_I) return enc_sym(symrepr_eerror());
+
+  VALUE res = enc_sym(symrepr_nil());
+  if (!heap_push_root(&res)) return enc_sym(symrepr_merror());
+
+  for (INT i = dec_i(args[0]) - 1; i >= 0; i --) {
+    VALUE c = cons(enc_i(i), res);
+    if (type_of(c) == VAL_TYPE_SYMBOL && eval_cps_gc()) {
+      c = cons(enc_i(i), res);
+    }
+    if (type_of(c) == VAL_TYPE_SYMBOL) {
+      res = c;
+      break;
+    }
+    res = c;
+  }
+  heap_pop_roots(1);
+  return res;
+}
+
+// (scoped-eval e) evaluates e in a nested context. With heap scopes
+// the cells allocated by the evaluation are freed when it returns,
+// unless they are reachable from the result.
+VALUE ext_scoped_eval(VALUE *args, int argn) {
+  if (argn < 1) return enc_sym(symrepr_eerror());
+  eval_context_t *ctx = eval_cps_new_context_inherit_env(args[0], args[0]);
+  return eval_cps_drop_top_context(run_eval(ctx));
+}
+
+uint32_t timer_usec(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint32_t)t.tv_sec * 1000000u + (uint32_t)(t.tv_nsec / 1000);
+}
+
+uint64_t timer_nsec(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+#define TRACE_EVENTS 65536
+
+// A trace file is "LBMT", the version, the size of an event, the
+// number of events and the number of lost events, as uint32_t, and
+// then the events. Read by utils/heap_trace.py.
+int write_trace(char *filename) {
+  heap_trace_event_t *events = malloc(TRACE_EVENTS * sizeof(heap_trace_event_t));
+  if (!events) return 0;
+  uint32_t n = heap_trace_read(events, TRACE_EVENTS);
+  uint32_t header[5] = { 0, 1, sizeof(heap_trace_event_t), n, heap_trace_lost() };
+  memcpy(header, "LBMT", 4);
+
+  FILE *fp = fopen(filename, "wb");
+  int ok = fp &&
+    fwrite(header, sizeof(header), 1, fp) == 1 &&
+    fwrite(events, sizeof(heap_trace_event_t), n, fp) == n;
+  if (fp) fclose(fp);
+  free(events);
+  return ok;
+}
+
 int main(int argc, char **argv) {
 
   int res = 0;
@@ -39,11 +112,28 @@ int main(int argc, char **argv) {
   unsigned int heap_size = 8 * 1024 * 1024;  // 8 Megabytes is standard  
   bool growing_continuation_stack = false;
   bool compress_decompress = false;
+  unsigned int nursery_size = 0;
+  unsigned int gc_budget = 0;
+  bool lazy_sweep = false;
+  bool background_sweep = false;
+  bool compacting = false;
+  bool cdr_coding = false;
+  unsigned int arena_size = 0;
+  unsigned int region_size = 0;
+  unsigned int gc_threads = 0;
+  unsigned int gc_watermark = 0;
+  unsigned int scope_size = 0;
+  unsigned int pool_size = 0;
+  char *trace_out = NULL;
+  bool trace_alloc = false;
+  char *image_out = NULL;
+  char *image_in = NULL;
+  bool freeze = false;
 
   int c;
   opterr = 1;
   
-  while (( c = getopt(argc, argv, "gch:")) != -1) {
+  while (( c = getopt(argc, argv, "gclmszdkh:n:i:a:r:t:w:x:f:e:p:y:")) != -1) {
     switch (c) {
     case 'h':
       heap_size = (unsigned int)atoi((char *)optarg);
@@ -54,6 +144,57 @@ int main(int argc, char **argv) {
     case 'c':
       compress_decompress = true;
       break;
+    case 'n':
+      nursery_size = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'i':
+      gc_budget = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'l':
+      lazy_sweep = true;
+      break;
+    case 'm':
+      compacting = true;
+      break;
+    case 's':
+      background_sweep = true;
+      break;
+    case 'z':
+      freeze = true;
+      break;
+    case 'd':
+      cdr_coding = true;
+      break;
+    case 'a':
+      arena_size = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'r':
+      region_size = (unsigned int)atoi((char *)optarg);
+      break;
+    case 't':
+      gc_threads = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'f':
+      gc_watermark = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'e':
+      scope_size = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'p':
+      pool_size = (unsigned int)atoi((char *)optarg);
+      break;
+    case 'y':
+      trace_out = optarg;
+      break;
+    case 'k':
+      trace_alloc = true;
+      break;
+    case 'w':
+      image_out = optarg;
+      break;
+    case 'x':
+      image_in = optarg;
+      break;
     case '?':
       break;
     default:
@@ -64,6 +205,22 @@ int main(int argc, char **argv) {
   printf("Heap size: %u\n", heap_size);
   printf("Growing stack: %s\n", growing_continuation_stack ? "yes" : "no");
   printf("Compression: %s\n", compress_decompress ? "yes" : "no");
+  printf("Nursery size: %u\n", nursery_size);
+  printf("Incremental GC budget: %u\n", gc_budget);
+  printf("Lazy sweep: %s\n", lazy_sweep ? "yes" : "no");
+  printf("Background sweep: %s\n", background_sweep ? "yes" : "no");
+  printf("Compacting GC: %s\n", compacting ? "yes" : "no");
+  printf("CDR-coding: %s\n", cdr_coding ? "yes" : "no");
+  printf("Array arena size: %u\n", arena_size);
+  printf("Heap region size: %u\n", region_size);
+  printf("GC mark threads: %u\n", gc_threads);
+  printf("GC watermark: %u\n", gc_watermark);
+  printf("Heap scope size: %u\n", scope_size);
+  printf("Memory pool size: %u\n", pool_size);
+  printf("Heap trace: %s%s\n", trace_out ? trace_out : "no", trace_alloc ? " (with allocations)" : "");
+  printf("Freeze prelude: %s\n", freeze ? "yes" : "no");
+  printf("Save image: %s\n", image_out ? image_out : "no");
+  printf("Load image: %s\n", image_in ? image_in : "no");
   printf("------------------------------------------------------------\n");
 	 
   if (argc - optind < 1) {
@@ -89,12 +246,25 @@ int main(int argc, char **argv) {
   fseek(fp, 0, SEEK_SET);
   char *code_buffer = malloc((unsigned long)size * sizeof(char) + 1);
   size_t r = fread (code_buffer, 1, (unsigned int)size, fp);
+  code_buffer[r] = 0;
 
   if (r == 0) {
     printf("Error empty file?\n");
     return 0;
   }
 
+  // The pool has to be in place before anything is allocated.
+  if (pool_size > 0) {
+    unsigned char *pool = malloc(pool_size);
+    res = pool && mem_pool_init(pool, pool_size);
+    if (res)
+      printf("Memory pool initialized.\n");
+    else {
+      printf("Error initializing memory pool!\n");
+      return 0;
+    }
+  }
+
   res = symrepr_init();
   if (res)
     printf("Symrepr initialized.\n");
@@ -103,12 +273,151 @@ int main(int argc, char **argv) {
     return 0;
   }
   
-  res = heap_init(heap_size);
-  if (res)
-    printf("Heap initialized. Heap size: %f MiB. Free cons cells: %d\n", heap_size_bytes() / 1024.0 / 1024.0, heap_num_free());
-  else {
-    printf("Error initializing heap!\n");
-    return 0;
+  VALUE image_env = enc_sym(symrepr_nil());
+  if (image_in) {
+    res = image_load(image_in, &image_env);
+    if (res)
+      printf("Image loaded. Heap size: %f MiB. Free cons cells: %d\n", (double)heap_size_bytes() / 1024.0 / 1024.0, heap_num_free());
+    else {
+      printf("Error loading image!\n");
+      return 0;
+    }
+  } else {
+    res = heap_init(heap_size);
+    if (res)
+      printf("Heap initialized. Heap size: %f MiB. Free cons cells: %d\n", (double)heap_size_bytes() / 1024.0 / 1024.0, heap_num_free());
+    else {
+      printf("Error initializing heap!\n");
+      return 0;
+    }
+  }
+
+  heap_set_timer(timer_usec);
+
+  unsigned char *trace_buffer = NULL;
+  if (trace_out) {
+    unsigned int trace_bytes = TRACE_EVENTS * sizeof(heap_trace_event_t);
+    trace_buffer = malloc(trace_bytes);
+    heap_trace_set_clock(timer_nsec);
+    res = trace_buffer &&
+      heap_trace_init(trace_buffer, trace_bytes,
+		      trace_alloc ? HEAP_TRACE_ALL : HEAP_TRACE_DEFAULT);
+    if (res)
+      printf("Heap trace enabled.\n");
+    else {
+      printf("Error enabling heap trace!\n");
+      return 0;
+    }
+  }
+
+  if (nursery_size > 0) {
+    res = heap_set_nursery_size(nursery_size);
+    if (res)
+      printf("Generational GC enabled.\n");
+    else {
+      printf("Error enabling generational GC!\n");
+      return 0;
+    }
+  }
+
+  if (gc_budget > 0) {
+    res = heap_set_gc_budget(gc_budget);
+    if (res)
+      printf("Incremental GC enabled.\n");
+    else {
+      printf("Error enabling incremental GC!\n");
+      return 0;
+    }
+  }
+
+  if (lazy_sweep) {
+    res = heap_set_lazy_sweep(true);
+    if (res)
+      printf("Lazy sweep enabled.\n");
+    else {
+      printf("Error enabling lazy sweep!\n");
+      return 0;
+    }
+  }
+
+  if (background_sweep) {
+    res = heap_set_background_sweep(true);
+    if (res)
+      printf("Background sweep enabled.\n");
+    else {
+      printf("Error enabling background sweep!\n");
+      return 0;
+    }
+  }
+
+  if (compacting) {
+    res = heap_set_compacting(true);
+    if (res)
+      printf("Compacting GC enabled.\n");
+    else {
+      printf("Error enabling compacting GC!\n");
+      return 0;
+    }
+  }
+
+  if (cdr_coding) {
+    res = heap_set_cdr_coding(true);
+    if (res)
+      printf("CDR-coding enabled.\n");
+    else {
+      printf("Error enabling CDR-coding!\n");
+      return 0;
+    }
+  }
+
+  if (arena_size > 0) {
+    res = heap_set_array_arena(arena_size);
+    if (res)
+      printf("Array arena enabled.\n");
+    else {
+      printf("Error enabling array arena!\n");
+      return 0;
+    }
+  }
+
+  if (region_size > 0) {
+    res = heap_set_growth(region_size, 0, 75, true);
+    if (res)
+      printf("Heap growth enabled.\n");
+    else {
+      printf("Error enabling heap growth!\n");
+      return 0;
+    }
+  }
+
+  if (gc_threads > 0) {
+    res = heap_set_gc_threads(gc_threads);
+    if (res)
+      printf("Parallel marking enabled.\n");
+    else {
+      printf("Error enabling parallel marking!\n");
+      return 0;
+    }
+  }
+
+  if (gc_watermark > 0) {
+    res = heap_set_gc_watermark(gc_watermark);
+    if (res)
+      printf("GC watermark set.\n");
+    else {
+      printf("Error setting GC watermark!\n");
+      return 0;
+    }
+  }
+
+  if (scope_size > 0) {
+    res = heap_set_scope_size(scope_size);
+    if (res)
+      printf("Heap scopes enabled.\n");
+    else {
+      printf("Error enabling heap scopes!\n");
+      return 0;
+    }
   }
 
   res = eval_cps_init(EVAL_CPS_STACK_SIZE, growing_continuation_stack);
@@ -118,8 +427,41 @@ int main(int argc, char **argv) {
     printf("Error initializing evaluator.\n");
   }
 
-  VALUE prelude = prelude_load();
-  eval_cps_program(prelude);
+  res = extensions_add("range", ext_range);
+  res = res && extensions_add("heap-stats", ext_heap_stats);
+  res = res && extensions_add("mem-stats", ext_mem_stats);
+  res = res && extensions_add("scoped-eval", ext_scoped_eval);
+  if (!res) {
+    printf("Error adding extension!\n");
+    return 0;
+  }
+
+  if (image_in) {
+    eval_cps_set_env(image_env);
+  } else {
+    VALUE prelude = prelude_load();
+    eval_cps_program(prelude);
+  }
+
+  if (freeze) {
+    res = eval_cps_freeze();
+    if (res)
+      printf("Frozen cells: %u\n", heap_num_frozen());
+    else {
+      printf("Error freezing heap!\n");
+      return 0;
+    }
+  }
+
+  if (image_out) {
+    res = image_save(image_out, eval_cps_get_env());
+    if (res)
+      printf("Image saved.\n");
+    else {
+      printf("Error saving image!\n");
+      return 0;
+    }
+  }
 
   VALUE t;
   
@@ -135,7 +477,7 @@ int main(int argc, char **argv) {
     printf("\n\nDECOMPRESS TEST: %s\n\n", decompress_code);
     
     t = tokpar_parse_compressed(compressed_code);
-    free(compressed_code);
+    mem_free(compressed_code);
   } else { 
     t = tokpar_parse(code_buffer);
   }
@@ -175,8 +517,19 @@ int main(int argc, char **argv) {
     res = 0;
   }
   
+  extensions_del();
   symrepr_del();
   heap_del();
+  image_del();
+
+  if (trace_out) {
+    heap_trace_stop();
+    if (!write_trace(trace_out)) {
+      printf("Error writing heap trace!\n");
+      res = 0;
+    }
+    free(trace_buffer);
+  }
 
   return res;
 }
@@ -0,0 +1,11 @@
+(define s (mem-stats))
+(define heap (lookup 'heap s))
+(define pool (lookup 'pool s))
+(and (num-eq (length s) 10)
+     (> (+ (car heap) (car (lookup 'image s))) 0)
+     (not (> (car (cdr heap)) (car (drop 3 heap))))
+     (not (> (car heap) (car (drop 2 heap))))
+     (> (car (lookup 'symrepr s)) 0)
+     (> (car (cdr (lookup 'extensions s))) 3)
+     (not (> (car (cdr pool)) (car pool)))
+     (not (> (car (drop 2 pool)) (car (cdr pool)))))
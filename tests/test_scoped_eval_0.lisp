@@ -0,0 +1,17 @@
+(define churn (lambda (k) (if (= k 0) 'done (progn (list k k k k) (churn (- k 1))))))
+(define pair (lambda (x) (list x (+ x 1))))
+
+(define a (scoped-eval '(pair 1)))
+(define b (scoped-eval '(progn (churn 50) (+ 1 2))))
+(define c (scoped-eval '(append (pair 3) (list 5 6))))
+(scoped-eval '(define d (pair 7)))
+(define e (scoped-eval '(let ((xs (pair 9))) (lambda (y) (cons y xs)))))
+
+(and (= a '(1 2))
+     (= b 3)
+     (= c '(3 4 5 6))
+     (= d '(7 8))
+     (= (e 0) '(0 9 10))
+     (= (churn 100) 'done)
+     (= a '(1 2))
+     (= d '(7 8)))
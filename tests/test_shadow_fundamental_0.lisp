@@ -0,0 +1,14 @@
+;; A fundamental can be shadowed by a local variable and, once it is
+;; defined, by a global one.
+
+(define f (lambda (car) (car 1)))
+
+(define g (lambda (xs) (cdr xs)))
+
+(define local-ok (and (= (let ((+ -)) (+ 5 3)) 2)
+		      (= (f (lambda (x) (+ x 1))) 2)
+		      (= (g '(1 2)) '(2))))
+
+(define cdr car)
+
+(and local-ok (= (cdr '(1 2)) 1) (= (g '(1 2)) 1))
@@ -0,0 +1,150 @@
+    # Copyright 2020 Joel Svensson	svenssonjoel@yahoo.se
+
+    # This program is free software: you can redistribute it and/or modify
+    # it under the terms of the GNU General Public License as published by
+    # the Free Software Foundation, either version 3 of the License, or
+    # (at your option) any later version.
+
+    # This program is distributed in the hope that it will be useful,
+    # but WITHOUT ANY WARRANTY; without even the implied warranty of
+    # MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    # GNU General Public License for more details.
+
+    # You should have received a copy of the GNU General Public License
+    # along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Reads a heap trace (include/heap_trace.h), as written by
+# tests/test_lisp_code_cps -y, and prints a timeline of the
+# collections. With --maps DIR a map of the heap is written to DIR as a
+# PPM image after every collection, one pixel per cell:
+#
+#   black  not allocated since the trace started (or unknown)
+#   red    allocated since the last collection
+#   blue   allocated before the last collection
+#   yellow array
+#
+# Cell allocations are only in the trace with -k.
+
+import argparse
+import os
+import struct
+import sys
+
+ALLOC, GC_BEGIN, GC_MINOR, GC_END, ARRAY_ALLOC, ARRAY_FREE, RESIZE, SCOPE = range(8)
+KINDS = ['collect', 'step', 'compact', 'freeze']
+
+HEADER = struct.Struct('<4sIIII')
+EVENT = struct.Struct('<QIIHHI')
+
+def read_trace(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+    magic, version, size, count, lost = HEADER.unpack_from(data, 0)
+    if magic != b'LBMT' or version != 1 or size != EVENT.size:
+        sys.exit('%s: not a heap trace' % filename)
+    events = [EVENT.unpack_from(data, HEADER.size + i * size) for i in range(count)]
+    return events, lost
+
+def timeline(events, lost, csv):
+    if csv:
+        print('time_ns,kind,minor,pause_ns,in_use,marked,recovered')
+    else:
+        print('%12s %-8s %10s %10s %10s %10s' %
+              ('time (ms)', 'kind', 'pause (us)', 'in use', 'marked', 'recovered'))
+    t0 = events[0][0] if events else 0
+    begin = None
+    minor = False
+    pauses = []
+    arrays = [0, 0, 0, 0]   # allocated, freed, bytes allocated, bytes freed
+    scope = [0, 0]
+    for time, a, b, kind, sub, seq in events:
+        if kind == GC_BEGIN:
+            begin = (time, a)
+            minor = False
+        elif kind == GC_MINOR:
+            minor = True
+        elif kind == GC_END and begin:
+            pause = time - begin[0]
+            pauses.append(pause)
+            name = KINDS[sub] if sub < len(KINDS) else str(sub)
+            if csv:
+                print('%d,%s,%d,%d,%d,%d,%d' % (begin[0], name, minor, pause, begin[1], a, b))
+            else:
+                print('%12.3f %-8s %10.1f %10d %10d %10d' %
+                      ((begin[0] - t0) / 1e6, name + ('*' if minor else ''),
+                       pause / 1e3, begin[1], a, b))
+            begin = None
+        elif kind == ARRAY_ALLOC:
+            arrays[0] += 1
+            arrays[2] += b
+        elif kind == ARRAY_FREE:
+            arrays[1] += 1
+            arrays[3] += b
+        elif kind == RESIZE and not csv:
+            print('%12.3f resize %d cells' % ((time - t0) / 1e6, a))
+        elif kind == SCOPE:
+            scope[0] += a
+            scope[1] += b
+    if csv:
+        return
+    print()
+    print('Events: %d, lost: %d' % (len(events), lost))
+    if pauses:
+        print('Pauses: %d, max %.1f us, total %.1f us' %
+              (len(pauses), max(pauses) / 1e3, sum(pauses) / 1e3))
+    print('Arrays allocated/freed: %d/%d (%d/%d bytes)' % tuple(arrays))
+    print('Scope cells freed/kept: %d/%d' % tuple(scope))
+
+def heap_maps(events, directory, width):
+    size = 0
+    for time, a, b, kind, sub, seq in events:
+        if kind == RESIZE:
+            size = max(size, a)
+        elif kind in (ALLOC, ARRAY_ALLOC, ARRAY_FREE):
+            size = max(size, a + 1)
+    if size == 0:
+        sys.exit('no cells in the trace')
+    os.makedirs(directory, exist_ok=True)
+
+    colors = [b'\x00\x00\x00', b'\xff\x00\x00', b'\x00\x00\xff', b'\xff\xff\x00']
+    state = bytearray(size)
+    height = (size + width - 1) // width
+    n = 0
+    for time, a, b, kind, sub, seq in events:
+        if kind == ALLOC:
+            state[a] = 1
+        elif kind == ARRAY_ALLOC:
+            state[a] = 3
+        elif kind == ARRAY_FREE:
+            state[a] = 0
+        elif kind == GC_END:
+            pixels = bytearray()
+            for s in state:
+                pixels += colors[s]
+            pixels += b'\x00' * (3 * (width * height - size))
+            name = os.path.join(directory, 'heap_%05d.ppm' % n)
+            with open(name, 'wb') as f:
+                f.write(b'P6 %d %d 255\n' % (width, height))
+                f.write(pixels)
+            n += 1
+            for i in range(size):
+                if state[i] == 1:
+                    state[i] = 2
+    print('%d heap maps written to %s' % (n, directory))
+
+def main():
+    parser = argparse.ArgumentParser(description='Show a lispBM heap trace.')
+    parser.add_argument('trace')
+    parser.add_argument('--csv', action='store_true', help='timeline as CSV')
+    parser.add_argument('--maps', metavar='DIR', help='write heap maps to DIR')
+    parser.add_argument('--width', type=int, default=256, help='heap map width in cells')
+    args = parser.parse_args()
+
+    events, lost = read_trace(args.trace)
+    if args.maps:
+        heap_maps(events, args.maps, args.width)
+    else:
+        timeline(events, lost, args.csv)
+
+if __name__ == '__main__':
+    main()